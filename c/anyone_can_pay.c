@@ -104,44 +104,39 @@ int load_type_hash_and_amount(uint64_t cell_index, uint64_t cell_source,
   return CKB_SUCCESS;
 }
 
-int check_payment_unlock(uint64_t min_ckb_amount, uint128_t min_udt_amount) {
-  unsigned char lock_hash[BLAKE2B_BLOCK_SIZE] = {0};
-  InputWallet input_wallets[MAX_TYPE_HASH] = {0};
-  uint64_t len = BLAKE2B_BLOCK_SIZE;
-  /* load wallet lock hash */
-  int ret = ckb_load_script_hash(lock_hash, &len, 0);
-  if (ret != CKB_SUCCESS) {
-    return ERROR_SYSCALL;
+/* check the amounts of an output wallet paid to `input` */
+int check_wallet_amount(const InputWallet *input, uint64_t ckb_amount,
+                        uint128_t udt_amount, uint64_t min_ckb_amount,
+                        uint128_t min_udt_amount) {
+  uint64_t min_output_ckb_amount = 0;
+  uint128_t min_output_udt_amount = 0;
+  int overflow = 0;
+  overflow = uint64_overflow_add(&min_output_ckb_amount, input->ckb_amount,
+                                 min_ckb_amount);
+  int meet_ckb_cond = !overflow && ckb_amount >= min_output_ckb_amount;
+  overflow = uint128_overflow_add(&min_output_udt_amount, input->udt_amount,
+                                  min_udt_amount);
+  int meet_udt_cond = !overflow && udt_amount >= min_output_udt_amount;
+
+  /* fail if can't meet both conditions */
+  if (!(meet_ckb_cond || meet_udt_cond)) {
+    return ERROR_OUTPUT_AMOUNT_NOT_ENOUGH;
   }
-  if (len > BLAKE2B_BLOCK_SIZE) {
-    return ERROR_SCRIPT_TOO_LONG;
-  }
-
-  /* iterate inputs and find input wallet cell */
-  int i = 0;
-  len = BLAKE2B_BLOCK_SIZE;
-  while (1) {
-    if (i >= MAX_TYPE_HASH) {
-      return ERROR_TOO_MUCH_TYPE_HASH_INPUTS;
-    }
-
-    ret = load_type_hash_and_amount(
-        i, CKB_SOURCE_GROUP_INPUT, input_wallets[i].type_hash,
-        &input_wallets[i].ckb_amount, &input_wallets[i].udt_amount,
-        &input_wallets[i].is_ckb_only);
-    if (ret == CKB_INDEX_OUT_OF_BOUND) {
-      break;
-    } else if (ret != CKB_SUCCESS) {
-      return ret;
-    }
-
-    i++;
+  /* output coins must meet condition, or remain the old amount */
+  if ((!meet_ckb_cond && ckb_amount != input->ckb_amount) ||
+      (!meet_udt_cond && udt_amount != input->udt_amount)) {
+    return ERROR_OUTPUT_AMOUNT_NOT_ENOUGH;
   }
+  return CKB_SUCCESS;
+}
 
-  int input_wallets_cnt = i;
-
+/* pair every output wallet cell with one of the input wallets */
+int check_output_wallets(unsigned char lock_hash[BLAKE2B_BLOCK_SIZE],
+                         InputWallet *input_wallets, int input_wallets_cnt,
+                         uint64_t min_ckb_amount, uint128_t min_udt_amount) {
+  int ret;
   /* iterate outputs wallet cell */
-  i = 0;
+  int i = 0;
   while (1) {
     uint8_t output_lock_hash[BLAKE2B_BLOCK_SIZE] = {0};
     uint8_t output_type_hash[BLAKE2B_BLOCK_SIZE] = {0};
@@ -195,25 +190,10 @@ int check_payment_unlock(uint64_t min_ckb_amount, uint128_t min_udt_amount) {
         continue;
       }
       /* compare amount */
-      uint64_t min_output_ckb_amount = 0;
-      uint128_t min_output_udt_amount = 0;
-      int overflow = 0;
-      overflow = uint64_overflow_add(
-          &min_output_ckb_amount, input_wallets[j].ckb_amount, min_ckb_amount);
-      int meet_ckb_cond = !overflow && ckb_amount >= min_output_ckb_amount;
-      overflow = uint128_overflow_add(
-          &min_output_udt_amount, input_wallets[j].udt_amount, min_udt_amount);
-      int meet_udt_cond = !overflow && udt_amount >= min_output_udt_amount;
-
-      /* fail if can't meet both conditions */
-      if (!(meet_ckb_cond || meet_udt_cond)) {
-        return ERROR_OUTPUT_AMOUNT_NOT_ENOUGH;
-      }
-      /* output coins must meet condition, or remain the old amount */
-      if ((!meet_ckb_cond && ckb_amount != input_wallets[j].ckb_amount) ||
-          (!meet_udt_cond && udt_amount != input_wallets[j].udt_amount)) {
-
-        return ERROR_OUTPUT_AMOUNT_NOT_ENOUGH;
+      ret = check_wallet_amount(&input_wallets[j], ckb_amount, udt_amount,
+                                min_ckb_amount, min_udt_amount);
+      if (ret != CKB_SUCCESS) {
+        return ret;
       }
 
       /* increase counter */
@@ -249,6 +229,240 @@ int check_payment_unlock(uint64_t min_ckb_amount, uint128_t min_udt_amount) {
   return CKB_SUCCESS;
 }
 
+/*
+ * Pairing hints: the input_type field of the first witness of the group may
+ * hold, for every input wallet of the group in order, the index of the output
+ * wallet paying it as a little-endian uint16. Wallet builders know the pairing,
+ * with the hints it's checked in linear time instead of pairing every output
+ * with every input.
+ *
+ * check_payment_hints returns CKB_SUCCESS when they prove a pairing
+ * check_output_wallets would accept: every hinted output pays its input (lock,
+ * type and amount), no output is hinted twice, every output with the wallet
+ * lock is hinted, and no two inputs have the same type, so that no output
+ * could pair with two of them. Anything else, wrong or foreign data in
+ * input_type included, falls back to check_output_wallets, which also gives
+ * the error. Wrong hints cost more than no hints: the hinted
+ * pass up to the hint which fails, then the full pairing.
+ */
+#define HINT_SIZE 2
+#define MAX_HINTED_OUTPUT 65535
+#define TYPE_SLOTS 512
+
+int load_payment_hints(uint8_t *witness, uint64_t witness_len,
+                       mol_seg_t *hints) {
+  mol_seg_t witness_seg;
+  witness_seg.ptr = witness;
+  witness_seg.size = witness_len;
+  if (witness_len == 0 ||
+      MolReader_WitnessArgs_verify(&witness_seg, false) != MOL_OK) {
+    return ERROR_ENCODING;
+  }
+  mol_seg_t input_type_seg = MolReader_WitnessArgs_get_input_type(&witness_seg);
+  if (MolReader_BytesOpt_is_none(&input_type_seg)) {
+    return CKB_ITEM_MISSING;
+  }
+  *hints = MolReader_Bytes_raw_bytes(&input_type_seg);
+  if (hints->size == 0 || hints->size % HINT_SIZE != 0 ||
+      hints->size / HINT_SIZE >= MAX_TYPE_HASH) {
+    return ERROR_ENCODING;
+  }
+  return CKB_SUCCESS;
+}
+
+/* Not inlined: like the wallet table of check_payment_wallets, its tables
+ * (about 16.5 KB) stay out of the stack frame of check_payment_unlock. */
+__attribute__((noinline)) int check_payment_hints(
+    unsigned char lock_hash[BLAKE2B_BLOCK_SIZE], mol_seg_t *hints,
+    uint64_t min_ckb_amount, uint128_t min_udt_amount) {
+  int hints_cnt = hints->size / HINT_SIZE;
+  int max_hint = 0;
+  for (int i = 0; i < hints_cnt; i++) {
+    int hint = hints->ptr[i * HINT_SIZE] | (hints->ptr[i * HINT_SIZE + 1] << 8);
+    if (hint > max_hint) {
+      max_hint = hint;
+    }
+  }
+  /* hinted outputs, only cleared up to the highest hint */
+  uint8_t hinted[MAX_HINTED_OUTPUT / 8 + 1];
+  memset(hinted, 0, max_hint / 8 + 1);
+  /* type hashes of the inputs, indexed by their first bytes in `slots` */
+  uint8_t type_hashes[MAX_TYPE_HASH][BLAKE2B_BLOCK_SIZE];
+  uint8_t slots[TYPE_SLOTS] = {0};
+  int has_ckb_only_input = 0;
+
+  for (int i = 0; i < hints_cnt; i++) {
+    InputWallet input = {0};
+    int ret = load_type_hash_and_amount(
+        i, CKB_SOURCE_GROUP_INPUT, input.type_hash, &input.ckb_amount,
+        &input.udt_amount, &input.is_ckb_only);
+    if (ret != CKB_SUCCESS) {
+      return ret;
+    }
+    /* no two inputs of the same type */
+    if (input.is_ckb_only) {
+      if (has_ckb_only_input) {
+        return ERROR_DUPLICATED_INPUTS;
+      }
+      has_ckb_only_input = 1;
+    } else {
+      int slot = (input.type_hash[0] | (input.type_hash[1] << 8)) % TYPE_SLOTS;
+      while (slots[slot] != 0) {
+        if (memcmp(type_hashes[slots[slot] - 1], input.type_hash,
+                   BLAKE2B_BLOCK_SIZE) == 0) {
+          return ERROR_DUPLICATED_INPUTS;
+        }
+        slot = (slot + 1) % TYPE_SLOTS;
+      }
+      memcpy(type_hashes[i], input.type_hash, BLAKE2B_BLOCK_SIZE);
+      slots[slot] = i + 1;
+    }
+
+    /* the hinted output */
+    int hint = hints->ptr[i * HINT_SIZE] | (hints->ptr[i * HINT_SIZE + 1] << 8);
+    if (hinted[hint / 8] & (1 << (hint % 8))) {
+      return ERROR_DUPLICATED_OUTPUTS;
+    }
+    hinted[hint / 8] |= 1 << (hint % 8);
+    int is_ckb_only = 0;
+    uint8_t type_hash[BLAKE2B_BLOCK_SIZE] = {0};
+    uint64_t ckb_amount = 0;
+    uint128_t udt_amount = 0;
+    ret = load_type_hash_and_amount(hint, CKB_SOURCE_OUTPUT, type_hash,
+                                    &ckb_amount, &udt_amount, &is_ckb_only);
+    if (ret != CKB_SUCCESS) {
+      return ret;
+    }
+    int has_same_type =
+        is_ckb_only
+            ? input.is_ckb_only
+            : memcmp(type_hash, input.type_hash, BLAKE2B_BLOCK_SIZE) == 0;
+    if (!has_same_type) {
+      return ERROR_NO_PAIR;
+    }
+    ret = check_wallet_amount(&input, ckb_amount, udt_amount, min_ckb_amount,
+                              min_udt_amount);
+    if (ret != CKB_SUCCESS) {
+      return ret;
+    }
+  }
+
+  /* one hint for every input */
+  uint64_t capacity = 0;
+  uint64_t len = 0;
+  int ret = ckb_load_cell_by_field(&capacity, &len, 0, hints_cnt,
+                                   CKB_SOURCE_GROUP_INPUT,
+                                   CKB_CELL_FIELD_CAPACITY);
+  if (ret != CKB_INDEX_OUT_OF_BOUND) {
+    return ERROR_TOO_MUCH_TYPE_HASH_INPUTS;
+  }
+
+  /* exactly the hinted outputs have the wallet lock */
+  for (int i = 0;; i++) {
+    uint8_t output_lock_hash[BLAKE2B_BLOCK_SIZE];
+    len = BLAKE2B_BLOCK_SIZE;
+    ret = ckb_checked_load_cell_by_field(output_lock_hash, &len, 0, i,
+                                         CKB_SOURCE_OUTPUT,
+                                         CKB_CELL_FIELD_LOCK_HASH);
+    if (ret == CKB_INDEX_OUT_OF_BOUND) {
+      break;
+    }
+    if (ret != CKB_SUCCESS || len != BLAKE2B_BLOCK_SIZE) {
+      return ERROR_ENCODING;
+    }
+    int has_same_lock =
+        memcmp(output_lock_hash, lock_hash, BLAKE2B_BLOCK_SIZE) == 0;
+    int is_hinted = i <= max_hint && (hinted[i / 8] & (1 << (i % 8)));
+    if (has_same_lock != is_hinted) {
+      return ERROR_NO_PAIR;
+    }
+  }
+  return CKB_SUCCESS;
+}
+
+/* Pair the outputs with a group of several wallets, first_wallet being the
+ * one of group input 0. Not inlined: the wallet table (about 20 KB) stays out
+ * of the stack frame of check_payment_unlock, which single-wallet groups
+ * use. */
+__attribute__((noinline)) int check_payment_wallets(
+    unsigned char lock_hash[BLAKE2B_BLOCK_SIZE],
+    const InputWallet *first_wallet, uint64_t min_ckb_amount,
+    uint128_t min_udt_amount) {
+  InputWallet input_wallets[MAX_TYPE_HASH] = {0};
+  input_wallets[0] = *first_wallet;
+
+  /* iterate inputs and find input wallet cell */
+  int i = 1;
+  while (1) {
+    if (i >= MAX_TYPE_HASH) {
+      return ERROR_TOO_MUCH_TYPE_HASH_INPUTS;
+    }
+
+    int ret = load_type_hash_and_amount(
+        i, CKB_SOURCE_GROUP_INPUT, input_wallets[i].type_hash,
+        &input_wallets[i].ckb_amount, &input_wallets[i].udt_amount,
+        &input_wallets[i].is_ckb_only);
+    if (ret == CKB_INDEX_OUT_OF_BOUND) {
+      break;
+    } else if (ret != CKB_SUCCESS) {
+      return ret;
+    }
+
+    i++;
+  }
+
+  return check_output_wallets(lock_hash, input_wallets, i, min_ckb_amount,
+                              min_udt_amount);
+}
+
+int check_payment_unlock(uint64_t min_ckb_amount, uint128_t min_udt_amount,
+                         uint8_t *first_witness, uint64_t first_witness_len) {
+  unsigned char lock_hash[BLAKE2B_BLOCK_SIZE] = {0};
+  uint64_t len = BLAKE2B_BLOCK_SIZE;
+  /* load wallet lock hash */
+  int ret = ckb_load_script_hash(lock_hash, &len, 0);
+  if (ret != CKB_SUCCESS) {
+    return ERROR_SYSCALL;
+  }
+  if (len > BLAKE2B_BLOCK_SIZE) {
+    return ERROR_SCRIPT_TOO_LONG;
+  }
+
+  mol_seg_t hints;
+  if (load_payment_hints(first_witness, first_witness_len, &hints) ==
+          CKB_SUCCESS &&
+      check_payment_hints(lock_hash, &hints, min_ckb_amount, min_udt_amount) ==
+          CKB_SUCCESS) {
+    return CKB_SUCCESS;
+  }
+
+  InputWallet first_wallet = {0};
+  ret = load_type_hash_and_amount(
+      0, CKB_SOURCE_GROUP_INPUT, first_wallet.type_hash,
+      &first_wallet.ckb_amount, &first_wallet.udt_amount,
+      &first_wallet.is_ckb_only);
+  if (ret == CKB_INDEX_OUT_OF_BOUND) {
+    return check_output_wallets(lock_hash, &first_wallet, 0, min_ckb_amount,
+                                min_udt_amount);
+  } else if (ret != CKB_SUCCESS) {
+    return ret;
+  }
+
+  /* Most payments have a single wallet in the group: pair it without the
+   * wallet table. Looking for a second wallet is the syscall which would end
+   * the input loop of check_payment_wallets anyway. */
+  uint64_t capacity = 0;
+  len = 0;
+  ret = ckb_load_cell_by_field(&capacity, &len, 0, 1, CKB_SOURCE_GROUP_INPUT,
+                               CKB_CELL_FIELD_CAPACITY);
+  if (ret == CKB_INDEX_OUT_OF_BOUND) {
+    return check_output_wallets(lock_hash, &first_wallet, 1, min_ckb_amount,
+                                min_udt_amount);
+  }
+  return check_payment_wallets(lock_hash, &first_wallet, min_ckb_amount,
+                               min_udt_amount);
+}
+
 int read_args(unsigned char *pubkey_hash, uint64_t *min_ckb_amount,
               uint128_t *min_udt_amount) {
   int ret;
@@ -322,7 +536,11 @@ int main() {
     return verify_secp256k1_blake160_sighash_all_with_witness(
         pubkey_hash, first_witness, first_witness_len);
   } else {
-    /* unlock via payment */
-    return check_payment_unlock(min_ckb_amount, min_udt_amount);
+    /* unlock via payment, the witness may carry pairing hints */
+    if (ret != ERROR_ENCODING && ret != ERROR_ARGUMENTS_LEN) {
+      first_witness_len = 0;
+    }
+    return check_payment_unlock(min_ckb_amount, min_udt_amount, first_witness,
+                                first_witness_len);
   }
 }
@@ -0,0 +1,574 @@
+#ifndef CKB_MISCELLANEOUS_SCRIPTS_RSA_MONTGOMERY_H
+#define CKB_MISCELLANEOUS_SCRIPTS_RSA_MONTGOMERY_H
+
+/**
+ * Montgomery arithmetic dedicated to the RSA public key operation.
+ *
+ * mbedtls_rsa_public goes through mbedtls_mpi_exp_mod, which is written for
+ * arbitrary (secret) exponents: sliding windows, dynamic allocations and a
+ * fresh R^2 mod N on every call. Public exponents are tiny, E = 65537 only
+ * needs 16 squarings and 1 multiplication, so this file implements exactly
+ * that on plain limb arrays. The context (N, R^2 mod N and -N^(-1) mod 2^64)
+ * is computed once and can be reused for every signature under the same key.
+ *
+ * For 1024, 2048 and 4096-bit moduli a multiplication is a fixed-size product
+ * (Comba, with one level of Karatsuba at 4096 bits) followed by a Montgomery
+ * reduction. Other sizes use the interleaved (CIOS) loop of rsa_mont_mul_n.
+ *
+ * Only public data is processed here: the code is not constant time.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t rsa_limb_t;
+typedef unsigned __int128 rsa_dlimb_t;
+
+#define RSA_LIMB_BITS 64
+#define RSA_LIMB_BYTES 8
+#define RSA_MAX_LIMBS (4096 / RSA_LIMB_BITS)
+
+enum RsaMontErrorCode {
+  RSA_MONT_SUCCESS = 0,
+  RSA_MONT_ERROR_INVALID_MODULUS = 1,
+  RSA_MONT_ERROR_INVALID_EXPONENT,
+  RSA_MONT_ERROR_INPUT_TOO_LARGE,
+};
+
+typedef struct RsaMontContext {
+  // number of limbs in N
+  uint32_t limbs;
+  // -N^(-1) mod 2^64
+  rsa_limb_t mm;
+  // modulus, least significant limb first
+  rsa_limb_t N[RSA_MAX_LIMBS];
+  // R^2 mod N, where R = 2^(64 * limbs)
+  rsa_limb_t RR[RSA_MAX_LIMBS];
+} RsaMontContext;
+
+// little endian bytes, as N in RsaInfo
+static void rsa_limbs_read_le(rsa_limb_t *x, uint32_t limbs,
+                              const uint8_t *buf) {
+  for (uint32_t i = 0; i < limbs; i++) {
+    rsa_limb_t v = 0;
+    for (int j = RSA_LIMB_BYTES - 1; j >= 0; j--) {
+      v = (v << 8) | buf[i * RSA_LIMB_BYTES + j];
+    }
+    x[i] = v;
+  }
+}
+
+// big endian bytes, as the signature and the encoded message
+static void rsa_limbs_read_be(rsa_limb_t *x, uint32_t limbs,
+                              const uint8_t *buf) {
+  const uint8_t *p = buf + limbs * RSA_LIMB_BYTES;
+  for (uint32_t i = 0; i < limbs; i++) {
+    rsa_limb_t v = 0;
+    p -= RSA_LIMB_BYTES;
+    for (int j = 0; j < RSA_LIMB_BYTES; j++) {
+      v = (v << 8) | p[j];
+    }
+    x[i] = v;
+  }
+}
+
+static void rsa_limbs_write_be(const rsa_limb_t *x, uint32_t limbs,
+                               uint8_t *buf) {
+  uint8_t *p = buf + limbs * RSA_LIMB_BYTES;
+  for (uint32_t i = 0; i < limbs; i++) {
+    rsa_limb_t v = x[i];
+    p -= RSA_LIMB_BYTES;
+    for (int j = RSA_LIMB_BYTES - 1; j >= 0; j--) {
+      p[j] = (uint8_t)v;
+      v >>= 8;
+    }
+  }
+}
+
+static int rsa_limbs_cmp(const rsa_limb_t *a, const rsa_limb_t *b,
+                         uint32_t limbs) {
+  for (uint32_t i = limbs; i > 0; i--) {
+    if (a[i - 1] != b[i - 1]) {
+      return a[i - 1] > b[i - 1] ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+// r = a - b, returns the borrow. r can alias a or b.
+static rsa_limb_t rsa_limbs_sub(rsa_limb_t *r, const rsa_limb_t *a,
+                                const rsa_limb_t *b, uint32_t limbs) {
+  rsa_limb_t borrow = 0;
+  for (uint32_t i = 0; i < limbs; i++) {
+    rsa_limb_t ai = a[i];
+    rsa_limb_t d = ai - b[i];
+    rsa_limb_t borrow2 = d > ai;
+    r[i] = d - borrow;
+    borrow = borrow2 | (r[i] > d);
+  }
+  return borrow;
+}
+
+// r = a + b, returns the carry. r can alias a or b.
+static rsa_limb_t rsa_limbs_add(rsa_limb_t *r, const rsa_limb_t *a,
+                                const rsa_limb_t *b, uint32_t limbs) {
+  rsa_limb_t carry = 0;
+  for (uint32_t i = 0; i < limbs; i++) {
+    rsa_limb_t s = a[i] + carry;
+    rsa_limb_t carry2 = s < carry;
+    r[i] = s + b[i];
+    carry = carry2 | (r[i] < s);
+  }
+  return carry;
+}
+
+// x = 2 * x mod N, with x < N
+static void rsa_mont_double(const RsaMontContext *ctx, rsa_limb_t *x) {
+  uint32_t n = ctx->limbs;
+  rsa_limb_t carry = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    rsa_limb_t v = x[i];
+    x[i] = (v << 1) | carry;
+    carry = v >> (RSA_LIMB_BITS - 1);
+  }
+  if (carry || rsa_limbs_cmp(x, ctx->N, n) >= 0) {
+    rsa_limbs_sub(x, x, ctx->N, n);
+  }
+}
+
+#define RSA_MONT_INLINE static inline __attribute__((always_inline))
+
+/**
+ * r = a * b / R mod N, CIOS method. a and b must be less than N.
+ * r can alias a or b. n is the number of limbs: callers pass a compile time
+ * constant so the loops are specialised for each key size.
+ */
+RSA_MONT_INLINE void rsa_mont_mul_n(const RsaMontContext *ctx, rsa_limb_t *r,
+                                    const rsa_limb_t *a, const rsa_limb_t *b,
+                                    uint32_t n) {
+  const rsa_limb_t *N = ctx->N;
+  rsa_limb_t t[RSA_MAX_LIMBS + 2];
+  for (uint32_t i = 0; i < n + 2; i++) {
+    t[i] = 0;
+  }
+
+  for (uint32_t i = 0; i < n; i++) {
+    rsa_dlimb_t uv = 0;
+    rsa_limb_t c = 0;
+    rsa_limb_t bi = b[i];
+    for (uint32_t j = 0; j < n; j++) {
+      uv = (rsa_dlimb_t)a[j] * bi + t[j] + c;
+      t[j] = (rsa_limb_t)uv;
+      c = (rsa_limb_t)(uv >> RSA_LIMB_BITS);
+    }
+    uv = (rsa_dlimb_t)t[n] + c;
+    t[n] = (rsa_limb_t)uv;
+    t[n + 1] = (rsa_limb_t)(uv >> RSA_LIMB_BITS);
+
+    rsa_limb_t m = t[0] * ctx->mm;
+    uv = (rsa_dlimb_t)m * N[0] + t[0];
+    c = (rsa_limb_t)(uv >> RSA_LIMB_BITS);
+    for (uint32_t j = 1; j < n; j++) {
+      uv = (rsa_dlimb_t)m * N[j] + t[j] + c;
+      t[j - 1] = (rsa_limb_t)uv;
+      c = (rsa_limb_t)(uv >> RSA_LIMB_BITS);
+    }
+    uv = (rsa_dlimb_t)t[n] + c;
+    t[n - 1] = (rsa_limb_t)uv;
+    t[n] = t[n + 1] + (rsa_limb_t)(uv >> RSA_LIMB_BITS);
+  }
+
+  if (t[n] != 0 || rsa_limbs_cmp(t, N, n) >= 0) {
+    rsa_limbs_sub(t, t, N, n);
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    r[i] = t[i];
+  }
+}
+
+typedef void (*RsaMontMulFn)(const RsaMontContext *ctx, rsa_limb_t *r,
+                             const rsa_limb_t *a, const rsa_limb_t *b);
+
+/**
+ * acc = x^E in Montgomery form, x in Montgomery form, E > 1.
+ * x is clobbered: it's reused to convert acc back from Montgomery form.
+ * mul is a compile time constant in every caller, it gets inlined.
+ */
+RSA_MONT_INLINE void rsa_mont_exp_n(const RsaMontContext *ctx,
+                                    rsa_limb_t *acc, rsa_limb_t *x,
+                                    uint32_t E, uint32_t n, RsaMontMulFn mul) {
+  for (uint32_t i = 0; i < n; i++) {
+    acc[i] = x[i];
+  }
+  int bit = 31 - __builtin_clz(E);
+  for (bit--; bit >= 0; bit--) {
+    mul(ctx, acc, acc, acc);
+    if ((E >> bit) & 1) {
+      mul(ctx, acc, acc, x);
+    }
+  }
+  // back from Montgomery form: multiply by 1
+  for (uint32_t i = 0; i < n; i++) {
+    x[i] = 0;
+  }
+  x[0] = 1;
+  mul(ctx, acc, acc, x);
+}
+
+// rsa_mont_mul_n for any number of limbs, the fallback of rsa_mont_mul.
+static void rsa_mont_mul_any(const RsaMontContext *ctx, rsa_limb_t *r,
+                             const rsa_limb_t *a, const rsa_limb_t *b) {
+  rsa_mont_mul_n(ctx, r, a, b, ctx->limbs);
+}
+
+/**
+ * r = a * b, 2 * n limbs, product scanning (Comba): the result is produced
+ * one column at a time, accumulated in three limbs that stay in registers.
+ * r must not alias a or b.
+ */
+RSA_MONT_INLINE void rsa_mul_comba_n(rsa_limb_t *r, const rsa_limb_t *a,
+                                     const rsa_limb_t *b, uint32_t n) {
+  rsa_limb_t c0 = 0, c1 = 0, c2 = 0;
+  for (uint32_t k = 0; k < 2 * n - 1; k++) {
+    uint32_t i = k < n ? 0 : k - n + 1;
+    uint32_t last = k < n ? k : n - 1;
+    for (; i <= last; i++) {
+      rsa_dlimb_t uv = (rsa_dlimb_t)a[i] * b[k - i];
+      rsa_dlimb_t acc = (((rsa_dlimb_t)c1 << RSA_LIMB_BITS) | c0) + uv;
+      c2 += acc < uv;
+      c0 = (rsa_limb_t)acc;
+      c1 = (rsa_limb_t)(acc >> RSA_LIMB_BITS);
+    }
+    r[k] = c0;
+    c0 = c1;
+    c1 = c2;
+    c2 = 0;
+  }
+  r[2 * n - 1] = c0;
+}
+
+/**
+ * r = t / R mod N, with t < N * R of 2 * n limbs, which is clobbered.
+ * Montgomery reduction one row at a time: the carry out of t[i + n] is kept
+ * in `top` and added with the next row instead of being propagated.
+ */
+RSA_MONT_INLINE void rsa_mont_redc_n(const RsaMontContext *ctx, rsa_limb_t *r,
+                                     rsa_limb_t *t, uint32_t n) {
+  const rsa_limb_t *N = ctx->N;
+  rsa_limb_t top = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    rsa_limb_t m = t[i] * ctx->mm;
+    rsa_limb_t c = 0;
+    for (uint32_t j = 0; j < n; j++) {
+      rsa_dlimb_t uv = (rsa_dlimb_t)m * N[j] + t[i + j] + c;
+      t[i + j] = (rsa_limb_t)uv;
+      c = (rsa_limb_t)(uv >> RSA_LIMB_BITS);
+    }
+    rsa_dlimb_t uv = (rsa_dlimb_t)t[i + n] + c + top;
+    t[i + n] = (rsa_limb_t)uv;
+    top = (rsa_limb_t)(uv >> RSA_LIMB_BITS);
+  }
+  // t[n..2n) + top * R < 2 * N
+  if (top != 0 || rsa_limbs_cmp(t + n, N, n) >= 0) {
+    rsa_limbs_sub(t + n, t + n, N, n);
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    r[i] = t[n + i];
+  }
+}
+
+// Products of the supported operand sizes, 2 * n limbs each.
+static void rsa_mul_1024(rsa_limb_t *r, const rsa_limb_t *a,
+                         const rsa_limb_t *b) {
+  rsa_mul_comba_n(r, a, b, 1024 / RSA_LIMB_BITS);
+}
+
+static void rsa_mul_2048(rsa_limb_t *r, const rsa_limb_t *a,
+                         const rsa_limb_t *b) {
+  rsa_mul_comba_n(r, a, b, 2048 / RSA_LIMB_BITS);
+}
+
+/**
+ * One level of Karatsuba over rsa_mul_2048: 3 products of 32 limbs instead
+ * of 4. With B = 2^2048, a = a1 * B + a0 and b = b1 * B + b0:
+ * a * b = z2 * B^2 + (z1 - z2 - z0) * B + z0, where z0 = a0 * b0,
+ * z2 = a1 * b1 and z1 = (a0 + a1) * (b0 + b1).
+ */
+static void rsa_mul_4096(rsa_limb_t *r, const rsa_limb_t *a,
+                         const rsa_limb_t *b) {
+  const uint32_t h = 2048 / RSA_LIMB_BITS;
+  rsa_limb_t sa[2048 / RSA_LIMB_BITS];
+  rsa_limb_t sb[2048 / RSA_LIMB_BITS];
+  rsa_limb_t z1[2 * 2048 / RSA_LIMB_BITS + 1];
+
+  rsa_limb_t ca = rsa_limbs_add(sa, a, a + h, h);
+  rsa_limb_t cb = rsa_limbs_add(sb, b, b + h, h);
+  rsa_mul_2048(r, a, b);
+  rsa_mul_2048(r + 2 * h, a + h, b + h);
+  rsa_mul_2048(z1, sa, sb);
+  // the carries of the sums: (sa + ca * B) * (sb + cb * B)
+  // = sa * sb + (ca * sb + cb * sa) * B + ca * cb * B^2
+  z1[2 * h] = ca & cb;
+  if (ca) {
+    z1[2 * h] += rsa_limbs_add(z1 + h, z1 + h, sb, h);
+  }
+  if (cb) {
+    z1[2 * h] += rsa_limbs_add(z1 + h, z1 + h, sa, h);
+  }
+  z1[2 * h] -= rsa_limbs_sub(z1, z1, r, 2 * h);
+  z1[2 * h] -= rsa_limbs_sub(z1, z1, r + 2 * h, 2 * h);
+
+  rsa_limb_t carry = rsa_limbs_add(r + h, r + h, z1, 2 * h + 1);
+  for (uint32_t i = 3 * h + 1; i < 4 * h; i++) {
+    r[i] += carry;
+    carry = r[i] < carry;
+  }
+}
+
+// One copy per supported key size, with the limb count known at compile time:
+// the product kernel rsa_mul_<bits> then the Montgomery reduction.
+#define RSA_MONT_SPECIALIZE(bits)                                            \
+  static void rsa_mont_mul_##bits(const RsaMontContext *ctx, rsa_limb_t *r,  \
+                                  const rsa_limb_t *a, const rsa_limb_t *b) { \
+    rsa_limb_t t[2 * (bits) / RSA_LIMB_BITS];                                \
+    rsa_mul_##bits(t, a, b);                                                 \
+    rsa_mont_redc_n(ctx, r, t, (bits) / RSA_LIMB_BITS);                      \
+  }                                                                          \
+  static void rsa_mont_exp_##bits(const RsaMontContext *ctx,                 \
+                                  rsa_limb_t *acc, rsa_limb_t *x,            \
+                                  uint32_t E) {                              \
+    rsa_mont_exp_n(ctx, acc, x, E, (bits) / RSA_LIMB_BITS,                   \
+                   rsa_mont_mul_##bits);                                     \
+  }
+
+RSA_MONT_SPECIALIZE(1024)
+RSA_MONT_SPECIALIZE(2048)
+RSA_MONT_SPECIALIZE(4096)
+
+static void rsa_mont_mul(const RsaMontContext *ctx, rsa_limb_t *r,
+                         const rsa_limb_t *a, const rsa_limb_t *b) {
+  switch (ctx->limbs) {
+    case 1024 / RSA_LIMB_BITS:
+      rsa_mont_mul_1024(ctx, r, a, b);
+      break;
+    case 2048 / RSA_LIMB_BITS:
+      rsa_mont_mul_2048(ctx, r, a, b);
+      break;
+    case 4096 / RSA_LIMB_BITS:
+      rsa_mont_mul_4096(ctx, r, a, b);
+      break;
+    default:
+      rsa_mont_mul_any(ctx, r, a, b);
+      break;
+  }
+}
+
+// x = R mod N. R - N < N unless the top bit of N is clear, which takes a
+// few more subtractions.
+static void rsa_mont_r_mod_n(const RsaMontContext *ctx, rsa_limb_t *x) {
+  uint32_t n = ctx->limbs;
+  for (uint32_t i = 0; i < n; i++) {
+    x[i] = 0;
+  }
+  rsa_limbs_sub(x, x, ctx->N, n);
+  while (rsa_limbs_cmp(x, ctx->N, n) >= 0) {
+    rsa_limbs_sub(x, x, ctx->N, n);
+  }
+}
+
+/**
+ * Prepare a context for modulus N.
+ * @param n_le N in little endian, as stored in RsaInfo.
+ * @param n_bytes length of N in bytes, a multiple of 8, at most 512.
+ */
+static int rsa_mont_init(RsaMontContext *ctx, const uint8_t *n_le,
+                         uint32_t n_bytes) {
+  if (n_bytes == 0 || n_bytes % RSA_LIMB_BYTES != 0 ||
+      n_bytes / RSA_LIMB_BYTES > RSA_MAX_LIMBS) {
+    return RSA_MONT_ERROR_INVALID_MODULUS;
+  }
+  uint32_t n = n_bytes / RSA_LIMB_BYTES;
+  ctx->limbs = n;
+  rsa_limbs_read_le(ctx->N, n, n_le);
+  // RSA modulus is odd, and it must use all limbs
+  if ((ctx->N[0] & 1) == 0 || ctx->N[n - 1] == 0) {
+    return RSA_MONT_ERROR_INVALID_MODULUS;
+  }
+
+  // N^(-1) mod 2^64 by Newton iteration, each step doubles the correct bits:
+  // x = N0 is correct for the lowest 3 bits.
+  rsa_limb_t inv = ctx->N[0];
+  for (int i = 0; i < 5; i++) {
+    inv *= 2 - ctx->N[0] * inv;
+  }
+  ctx->mm = ~inv + 1;
+
+  rsa_limb_t *x = ctx->RR;
+  rsa_mont_r_mod_n(ctx, x);
+  // x = 2^64 * R mod N, the Montgomery form of 2^64
+  uint32_t e = RSA_LIMB_BITS;
+  for (uint32_t i = 0; i < e; i++) {
+    rsa_mont_double(ctx, x);
+  }
+  // squaring the Montgomery form of 2^e gives the one of 2^(2e): walk up to
+  // 2^(64 * limbs) = R, its Montgomery form is R^2 mod N.
+  uint32_t r_bits = n * RSA_LIMB_BITS;
+  while (e * 2 <= r_bits) {
+    rsa_mont_mul(ctx, x, x, x);
+    e *= 2;
+  }
+  for (; e < r_bits; e++) {
+    rsa_mont_double(ctx, x);
+  }
+  return RSA_MONT_SUCCESS;
+}
+
+/**
+ * Load a context computed ahead of time by rsa_mont_init, e.g. stored in a
+ * cell. Only the shape of N is checked: see rsa_mont_check.
+ * @param n_le N in little endian.
+ * @param rr_le R^2 mod N in little endian.
+ * @param mm -N^(-1) mod 2^64.
+ * @param n_bytes length of N and RR in bytes.
+ */
+static int rsa_mont_load(RsaMontContext *ctx, const uint8_t *n_le,
+                         const uint8_t *rr_le, rsa_limb_t mm,
+                         uint32_t n_bytes) {
+  if (n_bytes == 0 || n_bytes % RSA_LIMB_BYTES != 0 ||
+      n_bytes / RSA_LIMB_BYTES > RSA_MAX_LIMBS) {
+    return RSA_MONT_ERROR_INVALID_MODULUS;
+  }
+  uint32_t n = n_bytes / RSA_LIMB_BYTES;
+  ctx->limbs = n;
+  ctx->mm = mm;
+  rsa_limbs_read_le(ctx->N, n, n_le);
+  rsa_limbs_read_le(ctx->RR, n, rr_le);
+  if ((ctx->N[0] & 1) == 0 || ctx->N[n - 1] == 0) {
+    return RSA_MONT_ERROR_INVALID_MODULUS;
+  }
+  return RSA_MONT_SUCCESS;
+}
+
+// bit length of N
+static uint32_t rsa_mont_bits(const RsaMontContext *ctx) {
+  rsa_limb_t top = ctx->N[ctx->limbs - 1];
+  uint32_t bits = (ctx->limbs - 1) * RSA_LIMB_BITS;
+  while (top != 0) {
+    bits++;
+    top >>= 1;
+  }
+  return bits;
+}
+
+/**
+ * Whether ctx was prepared for the modulus n_le (little endian), e.g. to
+ * look up a cached context.
+ */
+static bool rsa_mont_same_modulus(const RsaMontContext *ctx,
+                                  const uint8_t *n_le, uint32_t n_bytes) {
+  if (ctx->limbs * RSA_LIMB_BYTES != n_bytes) {
+    return false;
+  }
+  for (uint32_t i = 0; i < ctx->limbs; i++) {
+    rsa_limb_t v = 0;
+    rsa_limbs_read_le(&v, 1, n_le + i * RSA_LIMB_BYTES);
+    if (v != ctx->N[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Check that the constants of a loaded context belong to N: N * mm = -1
+ * mod 2^64, RR < N and RR / R = R mod N. It costs one Montgomery
+ * multiplication, much cheaper than rsa_mont_init.
+ */
+static int rsa_mont_check(const RsaMontContext *ctx) {
+  uint32_t n = ctx->limbs;
+  if (ctx->N[0] * ctx->mm != (rsa_limb_t)-1) {
+    return RSA_MONT_ERROR_INVALID_MODULUS;
+  }
+  if (rsa_limbs_cmp(ctx->RR, ctx->N, n) >= 0) {
+    return RSA_MONT_ERROR_INVALID_MODULUS;
+  }
+  // leaving Montgomery form: RR * 1 / R must be R mod N
+  rsa_limb_t one[RSA_MAX_LIMBS];
+  rsa_limb_t r[RSA_MAX_LIMBS];
+  for (uint32_t i = 0; i < n; i++) {
+    one[i] = 0;
+  }
+  one[0] = 1;
+  rsa_mont_mul(ctx, one, ctx->RR, one);
+  rsa_mont_r_mod_n(ctx, r);
+  if (rsa_limbs_cmp(one, r, n) != 0) {
+    return RSA_MONT_ERROR_INVALID_MODULUS;
+  }
+  return RSA_MONT_SUCCESS;
+}
+
+/**
+ * RSA public operation: out = in^E mod N.
+ * @param in big endian, limbs * 8 bytes, must be less than N.
+ * @param E public exponent, greater than 1.
+ * @param out big endian, limbs * 8 bytes.
+ */
+static int rsa_mont_exp_public(const RsaMontContext *ctx, const uint8_t *in,
+                               uint32_t E, uint8_t *out) {
+  uint32_t n = ctx->limbs;
+  rsa_limb_t x[RSA_MAX_LIMBS];
+  rsa_limb_t acc[RSA_MAX_LIMBS];
+
+  if (E < 2) {
+    return RSA_MONT_ERROR_INVALID_EXPONENT;
+  }
+  rsa_limbs_read_be(x, n, in);
+  if (rsa_limbs_cmp(x, ctx->N, n) >= 0) {
+    return RSA_MONT_ERROR_INPUT_TOO_LARGE;
+  }
+
+  // to Montgomery form
+  rsa_mont_mul(ctx, x, x, ctx->RR);
+  switch (n) {
+    case 1024 / RSA_LIMB_BITS:
+      rsa_mont_exp_1024(ctx, acc, x, E);
+      break;
+    case 2048 / RSA_LIMB_BITS:
+      rsa_mont_exp_2048(ctx, acc, x, E);
+      break;
+    case 4096 / RSA_LIMB_BITS:
+      rsa_mont_exp_4096(ctx, acc, x, E);
+      break;
+    default:
+      rsa_mont_exp_n(ctx, acc, x, E, n, rsa_mont_mul_any);
+      break;
+  }
+
+  rsa_limbs_write_be(acc, n, out);
+  return RSA_MONT_SUCCESS;
+}
+
+// x = N - x, with x < N. 0 stays 0.
+static void rsa_mont_negate(const RsaMontContext *ctx, rsa_limb_t *x) {
+  uint32_t n = ctx->limbs;
+  rsa_limb_t nonzero = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    nonzero |= x[i];
+  }
+  if (nonzero) {
+    rsa_limbs_sub(x, ctx->N, x, n);
+  }
+}
+
+/**
+ * Rabin-Williams public operation: x = x^2 mod N, with x < N. Two Montgomery
+ * multiplications, x * x / R then times R^2 / R, instead of the 19 of
+ * rsa_mont_exp_public with E = 65537.
+ */
+static void rsa_mont_square(const RsaMontContext *ctx, rsa_limb_t *x) {
+  rsa_mont_mul(ctx, x, x, x);
+  rsa_mont_mul(ctx, x, x, ctx->RR);
+}
+
+#endif  // CKB_MISCELLANEOUS_SCRIPTS_RSA_MONTGOMERY_H
@@ -0,0 +1,386 @@
+#ifndef CKB_MISCELLANEOUS_SCRIPTS_RSA_SHA2_H
+#define CKB_MISCELLANEOUS_SCRIPTS_RSA_SHA2_H
+
+/**
+ * SHA-224/256 and SHA-384/512 for the RSA library, tuned for CKB-VM.
+ *
+ * The portable mbedtls code keeps the message schedule in a 64 (80) word
+ * array and loops over a round macro, which costs a lot of loads and stores
+ * on RV64. Here the schedule is a 16 word ring expanded on the fly and the
+ * rounds are unrolled 16 at a time, rotating the working variables by name
+ * instead of moving them. The rotations are written as shifts: with the
+ * bit-manipulation extension (Zbb) enabled, the compiler turns them into
+ * ror/rori(w).
+ *
+ * There are no secret-dependent branches or table lookups, the running time
+ * only depends on the message length.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct RsaSha256Context {
+  uint32_t state[8];
+  // total length in bytes
+  uint64_t total;
+  uint8_t buffer[64];
+  // 1 for SHA-224
+  uint32_t is224;
+} RsaSha256Context;
+
+typedef struct RsaSha512Context {
+  uint64_t state[8];
+  // total length in bytes, messages are far below 2^61 bytes
+  uint64_t total;
+  uint8_t buffer[128];
+  // 1 for SHA-384
+  uint32_t is384;
+} RsaSha512Context;
+
+#define RSA_SHA2_INLINE static inline __attribute__((always_inline))
+
+RSA_SHA2_INLINE uint32_t rsa_sha2_rotr32(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+RSA_SHA2_INLINE uint64_t rsa_sha2_rotr64(uint64_t x, int n) {
+  return (x >> n) | (x << (64 - n));
+}
+
+RSA_SHA2_INLINE uint32_t rsa_sha2_load_be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+RSA_SHA2_INLINE uint64_t rsa_sha2_load_be64(const uint8_t *p) {
+  return ((uint64_t)rsa_sha2_load_be32(p) << 32) | rsa_sha2_load_be32(p + 4);
+}
+
+RSA_SHA2_INLINE void rsa_sha2_store_be32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+RSA_SHA2_INLINE void rsa_sha2_store_be64(uint8_t *p, uint64_t v) {
+  rsa_sha2_store_be32(p, (uint32_t)(v >> 32));
+  rsa_sha2_store_be32(p + 4, (uint32_t)v);
+}
+
+// shared by both sizes: choose and majority
+#define RSA_SHA2_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define RSA_SHA2_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+/*
+ * SHA-256
+ */
+
+static const uint32_t RSA_SHA256_K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1,
+    0x923F82A4, 0xAB1C5ED5, 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174, 0xE49B69C1, 0xEFBE4786,
+    0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147,
+    0x06CA6351, 0x14292967, 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85, 0xA2BFE8A1, 0xA81A664B,
+    0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A,
+    0x5B9CCA4F, 0x682E6FF3, 0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+#define RSA_SHA256_S0(x)                                                    \
+  (rsa_sha2_rotr32(x, 2) ^ rsa_sha2_rotr32(x, 13) ^ rsa_sha2_rotr32(x, 22))
+#define RSA_SHA256_S1(x)                                                    \
+  (rsa_sha2_rotr32(x, 6) ^ rsa_sha2_rotr32(x, 11) ^ rsa_sha2_rotr32(x, 25))
+#define RSA_SHA256_G0(x)                                        \
+  (rsa_sha2_rotr32(x, 7) ^ rsa_sha2_rotr32(x, 18) ^ ((x) >> 3))
+#define RSA_SHA256_G1(x)                                          \
+  (rsa_sha2_rotr32(x, 17) ^ rsa_sha2_rotr32(x, 19) ^ ((x) >> 10))
+
+// W[i & 15] becomes W[i + 16] of the schedule
+#define RSA_SHA256_EXPAND(W, i)                                         \
+  (W[(i)&15] += RSA_SHA256_G1(W[((i) + 14) & 15]) + W[((i) + 9) & 15] + \
+                RSA_SHA256_G0(W[((i) + 1) & 15]))
+
+// one round, the caller rotates a..h by renaming
+#define RSA_SHA256_ROUND(a, b, c, d, e, f, g, h, k, w)                 \
+  do {                                                                 \
+    uint32_t t1 = h + RSA_SHA256_S1(e) + RSA_SHA2_CH(e, f, g) + k + w; \
+    uint32_t t2 = RSA_SHA256_S0(a) + RSA_SHA2_MAJ(a, b, c);            \
+    d += t1;                                                           \
+    h = t1 + t2;                                                       \
+  } while (0)
+
+// 16 rounds from K[j], W already holds the words of these rounds
+#define RSA_SHA256_ROUNDS16(W, j)                                            \
+  do {                                                                       \
+    RSA_SHA256_ROUND(a, b, c, d, e, f, g, h, RSA_SHA256_K[(j) + 0], W[0]);   \
+    RSA_SHA256_ROUND(h, a, b, c, d, e, f, g, RSA_SHA256_K[(j) + 1], W[1]);   \
+    RSA_SHA256_ROUND(g, h, a, b, c, d, e, f, RSA_SHA256_K[(j) + 2], W[2]);   \
+    RSA_SHA256_ROUND(f, g, h, a, b, c, d, e, RSA_SHA256_K[(j) + 3], W[3]);   \
+    RSA_SHA256_ROUND(e, f, g, h, a, b, c, d, RSA_SHA256_K[(j) + 4], W[4]);   \
+    RSA_SHA256_ROUND(d, e, f, g, h, a, b, c, RSA_SHA256_K[(j) + 5], W[5]);   \
+    RSA_SHA256_ROUND(c, d, e, f, g, h, a, b, RSA_SHA256_K[(j) + 6], W[6]);   \
+    RSA_SHA256_ROUND(b, c, d, e, f, g, h, a, RSA_SHA256_K[(j) + 7], W[7]);   \
+    RSA_SHA256_ROUND(a, b, c, d, e, f, g, h, RSA_SHA256_K[(j) + 8], W[8]);   \
+    RSA_SHA256_ROUND(h, a, b, c, d, e, f, g, RSA_SHA256_K[(j) + 9], W[9]);   \
+    RSA_SHA256_ROUND(g, h, a, b, c, d, e, f, RSA_SHA256_K[(j) + 10], W[10]); \
+    RSA_SHA256_ROUND(f, g, h, a, b, c, d, e, RSA_SHA256_K[(j) + 11], W[11]); \
+    RSA_SHA256_ROUND(e, f, g, h, a, b, c, d, RSA_SHA256_K[(j) + 12], W[12]); \
+    RSA_SHA256_ROUND(d, e, f, g, h, a, b, c, RSA_SHA256_K[(j) + 13], W[13]); \
+    RSA_SHA256_ROUND(c, d, e, f, g, h, a, b, RSA_SHA256_K[(j) + 14], W[14]); \
+    RSA_SHA256_ROUND(b, c, d, e, f, g, h, a, RSA_SHA256_K[(j) + 15], W[15]); \
+  } while (0)
+
+static void rsa_sha256_compress(uint32_t state[8], const uint8_t *block) {
+  uint32_t W[16];
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+  for (int i = 0; i < 16; i++) {
+    W[i] = rsa_sha2_load_be32(block + 4 * i);
+  }
+  RSA_SHA256_ROUNDS16(W, 0);
+  for (int j = 16; j < 64; j += 16) {
+    for (int i = 0; i < 16; i++) {
+      RSA_SHA256_EXPAND(W, i);
+    }
+    RSA_SHA256_ROUNDS16(W, j);
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+static void rsa_sha256_starts(RsaSha256Context *ctx, int is224) {
+  static const uint32_t IV256[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+                                    0xA54FF53A, 0x510E527F, 0x9B05688C,
+                                    0x1F83D9AB, 0x5BE0CD19};
+  static const uint32_t IV224[8] = {0xC1059ED8, 0x367CD507, 0x3070DD17,
+                                    0xF70E5939, 0xFFC00B31, 0x68581511,
+                                    0x64F98FA7, 0xBEFA4FA4};
+  memcpy(ctx->state, is224 ? IV224 : IV256, sizeof(ctx->state));
+  ctx->total = 0;
+  ctx->is224 = is224 ? 1 : 0;
+}
+
+static void rsa_sha256_update(RsaSha256Context *ctx, const uint8_t *input,
+                              size_t len) {
+  size_t used = (size_t)(ctx->total & 63);
+  ctx->total += len;
+
+  if (used > 0) {
+    size_t fill = 64 - used;
+    if (len < fill) {
+      memcpy(ctx->buffer + used, input, len);
+      return;
+    }
+    memcpy(ctx->buffer + used, input, fill);
+    rsa_sha256_compress(ctx->state, ctx->buffer);
+    input += fill;
+    len -= fill;
+  }
+  // full blocks are compressed in place, without copying
+  while (len >= 64) {
+    rsa_sha256_compress(ctx->state, input);
+    input += 64;
+    len -= 64;
+  }
+  if (len > 0) {
+    memcpy(ctx->buffer, input, len);
+  }
+}
+
+// output: 32 bytes, or 28 for SHA-224
+static void rsa_sha256_finish(RsaSha256Context *ctx, uint8_t *output) {
+  size_t used = (size_t)(ctx->total & 63);
+  uint64_t bits = ctx->total << 3;
+
+  ctx->buffer[used++] = 0x80;
+  if (used > 56) {
+    memset(ctx->buffer + used, 0, 64 - used);
+    rsa_sha256_compress(ctx->state, ctx->buffer);
+    used = 0;
+  }
+  memset(ctx->buffer + used, 0, 56 - used);
+  rsa_sha2_store_be64(ctx->buffer + 56, bits);
+  rsa_sha256_compress(ctx->state, ctx->buffer);
+
+  int words = ctx->is224 ? 7 : 8;
+  for (int i = 0; i < words; i++) {
+    rsa_sha2_store_be32(output + 4 * i, ctx->state[i]);
+  }
+}
+
+/*
+ * SHA-512
+ */
+
+static const uint64_t RSA_SHA512_K[80] = {
+    0x428A2F98D728AE22, 0x7137449123EF65CD, 0xB5C0FBCFEC4D3B2F,
+    0xE9B5DBA58189DBBC, 0x3956C25BF348B538, 0x59F111F1B605D019,
+    0x923F82A4AF194F9B, 0xAB1C5ED5DA6D8118, 0xD807AA98A3030242,
+    0x12835B0145706FBE, 0x243185BE4EE4B28C, 0x550C7DC3D5FFB4E2,
+    0x72BE5D74F27B896F, 0x80DEB1FE3B1696B1, 0x9BDC06A725C71235,
+    0xC19BF174CF692694, 0xE49B69C19EF14AD2, 0xEFBE4786384F25E3,
+    0x0FC19DC68B8CD5B5, 0x240CA1CC77AC9C65, 0x2DE92C6F592B0275,
+    0x4A7484AA6EA6E483, 0x5CB0A9DCBD41FBD4, 0x76F988DA831153B5,
+    0x983E5152EE66DFAB, 0xA831C66D2DB43210, 0xB00327C898FB213F,
+    0xBF597FC7BEEF0EE4, 0xC6E00BF33DA88FC2, 0xD5A79147930AA725,
+    0x06CA6351E003826F, 0x142929670A0E6E70, 0x27B70A8546D22FFC,
+    0x2E1B21385C26C926, 0x4D2C6DFC5AC42AED, 0x53380D139D95B3DF,
+    0x650A73548BAF63DE, 0x766A0ABB3C77B2A8, 0x81C2C92E47EDAEE6,
+    0x92722C851482353B, 0xA2BFE8A14CF10364, 0xA81A664BBC423001,
+    0xC24B8B70D0F89791, 0xC76C51A30654BE30, 0xD192E819D6EF5218,
+    0xD69906245565A910, 0xF40E35855771202A, 0x106AA07032BBD1B8,
+    0x19A4C116B8D2D0C8, 0x1E376C085141AB53, 0x2748774CDF8EEB99,
+    0x34B0BCB5E19B48A8, 0x391C0CB3C5C95A63, 0x4ED8AA4AE3418ACB,
+    0x5B9CCA4F7763E373, 0x682E6FF3D6B2B8A3, 0x748F82EE5DEFB2FC,
+    0x78A5636F43172F60, 0x84C87814A1F0AB72, 0x8CC702081A6439EC,
+    0x90BEFFFA23631E28, 0xA4506CEBDE82BDE9, 0xBEF9A3F7B2C67915,
+    0xC67178F2E372532B, 0xCA273ECEEA26619C, 0xD186B8C721C0C207,
+    0xEADA7DD6CDE0EB1E, 0xF57D4F7FEE6ED178, 0x06F067AA72176FBA,
+    0x0A637DC5A2C898A6, 0x113F9804BEF90DAE, 0x1B710B35131C471B,
+    0x28DB77F523047D84, 0x32CAAB7B40C72493, 0x3C9EBE0A15C9BEBC,
+    0x431D67C49C100D4C, 0x4CC5D4BECB3E42B6, 0x597F299CFC657E2A,
+    0x5FCB6FAB3AD6FAEC, 0x6C44198C4A475817,
+};
+
+#define RSA_SHA512_S0(x)                                                     \
+  (rsa_sha2_rotr64(x, 28) ^ rsa_sha2_rotr64(x, 34) ^ rsa_sha2_rotr64(x, 39))
+#define RSA_SHA512_S1(x)                                                     \
+  (rsa_sha2_rotr64(x, 14) ^ rsa_sha2_rotr64(x, 18) ^ rsa_sha2_rotr64(x, 41))
+#define RSA_SHA512_G0(x)                                       \
+  (rsa_sha2_rotr64(x, 1) ^ rsa_sha2_rotr64(x, 8) ^ ((x) >> 7))
+#define RSA_SHA512_G1(x)                                         \
+  (rsa_sha2_rotr64(x, 19) ^ rsa_sha2_rotr64(x, 61) ^ ((x) >> 6))
+
+#define RSA_SHA512_EXPAND(W, i)                                         \
+  (W[(i)&15] += RSA_SHA512_G1(W[((i) + 14) & 15]) + W[((i) + 9) & 15] + \
+                RSA_SHA512_G0(W[((i) + 1) & 15]))
+
+#define RSA_SHA512_ROUND(a, b, c, d, e, f, g, h, k, w)                 \
+  do {                                                                 \
+    uint64_t t1 = h + RSA_SHA512_S1(e) + RSA_SHA2_CH(e, f, g) + k + w; \
+    uint64_t t2 = RSA_SHA512_S0(a) + RSA_SHA2_MAJ(a, b, c);            \
+    d += t1;                                                           \
+    h = t1 + t2;                                                       \
+  } while (0)
+
+#define RSA_SHA512_ROUNDS16(W, j)                                            \
+  do {                                                                       \
+    RSA_SHA512_ROUND(a, b, c, d, e, f, g, h, RSA_SHA512_K[(j) + 0], W[0]);   \
+    RSA_SHA512_ROUND(h, a, b, c, d, e, f, g, RSA_SHA512_K[(j) + 1], W[1]);   \
+    RSA_SHA512_ROUND(g, h, a, b, c, d, e, f, RSA_SHA512_K[(j) + 2], W[2]);   \
+    RSA_SHA512_ROUND(f, g, h, a, b, c, d, e, RSA_SHA512_K[(j) + 3], W[3]);   \
+    RSA_SHA512_ROUND(e, f, g, h, a, b, c, d, RSA_SHA512_K[(j) + 4], W[4]);   \
+    RSA_SHA512_ROUND(d, e, f, g, h, a, b, c, RSA_SHA512_K[(j) + 5], W[5]);   \
+    RSA_SHA512_ROUND(c, d, e, f, g, h, a, b, RSA_SHA512_K[(j) + 6], W[6]);   \
+    RSA_SHA512_ROUND(b, c, d, e, f, g, h, a, RSA_SHA512_K[(j) + 7], W[7]);   \
+    RSA_SHA512_ROUND(a, b, c, d, e, f, g, h, RSA_SHA512_K[(j) + 8], W[8]);   \
+    RSA_SHA512_ROUND(h, a, b, c, d, e, f, g, RSA_SHA512_K[(j) + 9], W[9]);   \
+    RSA_SHA512_ROUND(g, h, a, b, c, d, e, f, RSA_SHA512_K[(j) + 10], W[10]); \
+    RSA_SHA512_ROUND(f, g, h, a, b, c, d, e, RSA_SHA512_K[(j) + 11], W[11]); \
+    RSA_SHA512_ROUND(e, f, g, h, a, b, c, d, RSA_SHA512_K[(j) + 12], W[12]); \
+    RSA_SHA512_ROUND(d, e, f, g, h, a, b, c, RSA_SHA512_K[(j) + 13], W[13]); \
+    RSA_SHA512_ROUND(c, d, e, f, g, h, a, b, RSA_SHA512_K[(j) + 14], W[14]); \
+    RSA_SHA512_ROUND(b, c, d, e, f, g, h, a, RSA_SHA512_K[(j) + 15], W[15]); \
+  } while (0)
+
+static void rsa_sha512_compress(uint64_t state[8], const uint8_t *block) {
+  uint64_t W[16];
+  uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+  for (int i = 0; i < 16; i++) {
+    W[i] = rsa_sha2_load_be64(block + 8 * i);
+  }
+  RSA_SHA512_ROUNDS16(W, 0);
+  for (int j = 16; j < 80; j += 16) {
+    for (int i = 0; i < 16; i++) {
+      RSA_SHA512_EXPAND(W, i);
+    }
+    RSA_SHA512_ROUNDS16(W, j);
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+static void rsa_sha512_starts(RsaSha512Context *ctx, int is384) {
+  static const uint64_t IV512[8] = {
+      0x6A09E667F3BCC908, 0xBB67AE8584CAA73B, 0x3C6EF372FE94F82B,
+      0xA54FF53A5F1D36F1, 0x510E527FADE682D1, 0x9B05688C2B3E6C1F,
+      0x1F83D9ABFB41BD6B, 0x5BE0CD19137E2179};
+  static const uint64_t IV384[8] = {
+      0xCBBB9D5DC1059ED8, 0x629A292A367CD507, 0x9159015A3070DD17,
+      0x152FECD8F70E5939, 0x67332667FFC00B31, 0x8EB44A8768581511,
+      0xDB0C2E0D64F98FA7, 0x47B5481DBEFA4FA4};
+  memcpy(ctx->state, is384 ? IV384 : IV512, sizeof(ctx->state));
+  ctx->total = 0;
+  ctx->is384 = is384 ? 1 : 0;
+}
+
+static void rsa_sha512_update(RsaSha512Context *ctx, const uint8_t *input,
+                              size_t len) {
+  size_t used = (size_t)(ctx->total & 127);
+  ctx->total += len;
+
+  if (used > 0) {
+    size_t fill = 128 - used;
+    if (len < fill) {
+      memcpy(ctx->buffer + used, input, len);
+      return;
+    }
+    memcpy(ctx->buffer + used, input, fill);
+    rsa_sha512_compress(ctx->state, ctx->buffer);
+    input += fill;
+    len -= fill;
+  }
+  while (len >= 128) {
+    rsa_sha512_compress(ctx->state, input);
+    input += 128;
+    len -= 128;
+  }
+  if (len > 0) {
+    memcpy(ctx->buffer, input, len);
+  }
+}
+
+// output: 64 bytes, or 48 for SHA-384
+static void rsa_sha512_finish(RsaSha512Context *ctx, uint8_t *output) {
+  size_t used = (size_t)(ctx->total & 127);
+
+  ctx->buffer[used++] = 0x80;
+  if (used > 112) {
+    memset(ctx->buffer + used, 0, 128 - used);
+    rsa_sha512_compress(ctx->state, ctx->buffer);
+    used = 0;
+  }
+  // 128-bit length, the high half is always 0 here
+  memset(ctx->buffer + used, 0, 120 - used);
+  rsa_sha2_store_be64(ctx->buffer + 120, ctx->total << 3);
+  rsa_sha512_compress(ctx->state, ctx->buffer);
+
+  int words = ctx->is384 ? 6 : 8;
+  for (int i = 0; i < words; i++) {
+    rsa_sha2_store_be64(output + 8 * i, ctx->state[i]);
+  }
+}
+
+#endif  // CKB_MISCELLANEOUS_SCRIPTS_RSA_SHA2_H
@@ -8,10 +8,26 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "mbedtls/ecdsa.h"
 #include "mbedtls/md.h"
 #include "mbedtls/md_internal.h"
 #include "mbedtls/memory_buffer_alloc.h"
 #include "mbedtls/rsa.h"
+#include "mbedtls/sha1.h"
+// A private copy: locks linking build/libvalidate_signature_rsa.a mostly have
+// their own blake2b.h.
+#define DEFAULT_PERSONAL rsa_blake2b_default_personal
+#define blake2b_init_param rsa_blake2b_init_param
+#define blake2b_init rsa_blake2b_init
+#define blake2b_init_key rsa_blake2b_init_key
+#define blake2b_update rsa_blake2b_update
+#define blake2b_final rsa_blake2b_final
+#define blake2b rsa_blake2b
+#define blake2 rsa_blake2
+#define crypto_hash rsa_crypto_hash
+#include "blake2b.h"
+#include "rsa_montgomery.h"
+#include "rsa_sha2.h"
 
 #if defined(CKB_USE_SIM)
 #include <stdio.h>
@@ -52,6 +68,9 @@ enum ErrorCode {
   ERROR_ISO97962_INVALID_ARG12,
   ERROR_ISO97962_INVALID_ARG13,
   ERROR_WRONG_PUBKEY,
+  ERROR_RSA_INVALID_PRECOMPUTED_KEY,
+  ERROR_SECP256R1_INVALID_PUBKEY,
+  ERROR_SECP256R1_VERIFY_FAILED,
 };
 
 #define CHECK2(cond, code) \
@@ -72,34 +91,52 @@ enum ErrorCode {
     }                \
   } while (0)
 
-int md_string(const mbedtls_md_info_t *md_info, const uint8_t *buf, size_t n,
-              unsigned char *output);
-int validate_signature_iso9796_2(void *, const uint8_t *sig_buf,
-                                 size_t sig_size, const uint8_t *msg_buf,
-                                 size_t msg_size, uint8_t *out,
-                                 size_t *out_len);
-
-bool is_valid_iso97962_md_type(uint8_t md) {
+/**
+ * mbedtls_md_setup allocates the digest context on the heap, this one lives on
+ * the stack: hashing doesn't need mbedtls_memory_buffer_alloc_init.
+ * SHA-2 goes through the kernels in rsa_sha2.h, SHA-1 (ISO 9796-2 only)
+ * through mbedtls.
+ */
+typedef struct MdContext {
+  mbedtls_md_type_t type;
+  union {
+    mbedtls_sha1_context sha1;
+    RsaSha256Context sha256;
+    RsaSha512Context sha512;
+  } u;
+} MdContext;
+
+static int md_starts(MdContext *ctx, mbedtls_md_type_t type);
+static int md_update(MdContext *ctx, const uint8_t *buf, size_t n);
+static int md_finish(MdContext *ctx, uint8_t *output);
+static int md_string(const mbedtls_md_info_t *md_info, const uint8_t *buf,
+                     size_t n, unsigned char *output);
+static int validate_signature_iso9796_2(void *, const uint8_t *sig_buf,
+                                        size_t sig_size, const uint8_t *msg_buf,
+                                        size_t msg_size, uint8_t *out,
+                                        size_t *out_len);
+
+static bool is_valid_iso97962_md_type(uint8_t md) {
   return md == CKB_MD_SHA1 || md == CKB_MD_SHA224 || md == CKB_MD_SHA256 ||
          md == CKB_MD_SHA384 || md == CKB_MD_SHA512;
 }
 
 // remove SHA1 and RIPEMD160 as options for the message digest hash functions.
-bool is_valid_rsa_md_type(uint8_t md) {
+static bool is_valid_rsa_md_type(uint8_t md) {
   return md == CKB_MD_SHA224 || md == CKB_MD_SHA256 || md == CKB_MD_SHA384 ||
          md == CKB_MD_SHA512;
 }
 
-bool is_valid_key_size(uint8_t size) {
+static bool is_valid_key_size(uint8_t size) {
   return size == CKB_KEYSIZE_1024 || size == CKB_KEYSIZE_2048 ||
          size == CKB_KEYSIZE_4096;
 }
 
-bool is_valid_key_size_in_bit(uint32_t size) {
+static bool is_valid_key_size_in_bit(uint32_t size) {
   return size == 1024 || size == 2048 || size == 4096;
 }
 
-bool is_valid_padding(uint8_t padding) {
+static bool is_valid_padding(uint8_t padding) {
   return padding == CKB_PKCS_15 || padding == CKB_PKCS_21;
 }
 
@@ -116,24 +153,7 @@ uint32_t get_key_size(uint8_t key_size_enum) {
   }
 }
 
-int check_pubkey(mbedtls_mpi *N, mbedtls_mpi *E) {
-  int err = 0;
-  size_t key_size = mbedtls_mpi_size(N) * 8;
-  CHECK2(is_valid_key_size_in_bit(key_size), ERROR_WRONG_PUBKEY);
-
-  mbedtls_mpi two;
-  mbedtls_mpi_init(&two);
-  err = mbedtls_mpi_lset(&two, 2);
-  CHECK(err);
-  CHECK2(mbedtls_mpi_cmp_mpi(&two, E) < 0 && mbedtls_mpi_cmp_mpi(E, N) < 0,
-         ERROR_WRONG_PUBKEY);
-
-  err = 0;
-exit:
-  return err;
-}
-
-mbedtls_md_type_t convert_md_type(uint8_t type) {
+static mbedtls_md_type_t convert_md_type(uint8_t type) {
   mbedtls_md_type_t result = MBEDTLS_MD_NONE;
   switch (type) {
     case CKB_MD_SHA224:
@@ -158,7 +178,7 @@ mbedtls_md_type_t convert_md_type(uint8_t type) {
   return result;
 }
 
-int convert_padding(uint8_t padding) {
+static int convert_padding(uint8_t padding) {
   if (padding == CKB_PKCS_15) {
     return MBEDTLS_RSA_PKCS_V15;
   } else if (padding == CKB_PKCS_21) {
@@ -169,11 +189,169 @@ int convert_padding(uint8_t padding) {
   return -1;
 }
 
+static uint32_t read_u32_le(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_u64_le(const uint8_t *p) {
+  return (uint64_t)read_u32_le(p) | ((uint64_t)read_u32_le(p + 4) << 32);
+}
+
+static uint8_t *get_precomputed_rr(const RsaPrecomputedKey *key) {
+  int length = get_key_size(key->key_size) / 8;
+  // RsaPrecomputedKey is a variable length buffer too, see get_rsa_signature
+  return (uint8_t *)&key->N[length];
+}
+
+static uint32_t calculate_precomputed_key_length(int key_size) {
+  return offsetof(RsaPrecomputedKey, N) + key_size / 4;
+}
+
+/**
+ * blake160(common header + E + N) of a RsaPrecomputedKey, the public key hash
+ * of the same key in a RsaInfo.
+ */
+static void rsa_precomputed_key_hash(const RsaPrecomputedKey *key,
+                                     uint8_t hash[RSA_KEY_HASH_SIZE]) {
+  // blake2b-256, personalization "ckb-default-hash"
+  uint8_t buf[32];
+  blake2b_state blake2b_ctx;
+
+  blake2b_init(&blake2b_ctx, sizeof(buf));
+  blake2b_update(&blake2b_ctx, &key->algorithm_id,
+                 offsetof(RsaPrecomputedKey, key_hash) -
+                     offsetof(RsaPrecomputedKey, algorithm_id));
+  blake2b_update(&blake2b_ctx, key->N, get_key_size(key->key_size) / 8);
+  blake2b_final(&blake2b_ctx, buf, sizeof(buf));
+  memcpy(hash, buf, RSA_KEY_HASH_SIZE);
+}
+
+/**
+ * Check a RsaPrecomputedKey of len bytes: its layout, its key_hash and that its
+ * Montgomery constants belong to N. Nothing is written to the key, it's checked
+ * again by every verification with it.
+ * @param mont output, the Montgomery context of the key.
+ */
+static int rsa_load_precomputed_key(const RsaPrecomputedKey *key, size_t len,
+                                    RsaMontContext *mont) {
+  int err = 0;
+  uint32_t key_size = 0;
+  uint8_t hash[RSA_KEY_HASH_SIZE];
+
+  CHECK2(key != NULL && len >= offsetof(RsaPrecomputedKey, N),
+         ERROR_RSA_INVALID_PRECOMPUTED_KEY);
+  CHECK2(key->magic == RSA_PRECOMPUTED_KEY_MAGIC,
+         ERROR_RSA_INVALID_PRECOMPUTED_KEY);
+  CHECK2(key->algorithm_id == CKB_VERIFY_RSA, ERROR_RSA_INVALID_ID);
+  CHECK2(is_valid_rsa_md_type(key->md_type), ERROR_INVALID_MD_TYPE);
+  CHECK2(is_valid_padding(key->padding), ERROR_INVALID_PADDING);
+  CHECK2(is_valid_key_size(key->key_size), ERROR_RSA_INVALID_KEY_SIZE);
+  key_size = get_key_size(key->key_size);
+  CHECK2(len == calculate_precomputed_key_length(key_size),
+         ERROR_RSA_INVALID_PARAM2);
+
+  // same as check_pubkey_raw
+  CHECK2(key->N[key_size / 8 - 1] != 0, ERROR_WRONG_PUBKEY);
+  CHECK2(read_u32_le((const uint8_t *)&key->E) > 2, ERROR_WRONG_PUBKEY);
+
+  // locks find the key cell by key_hash, it must be the hash of this key
+  rsa_precomputed_key_hash(key, hash);
+  CHECK2(memcmp(hash, key->key_hash, RSA_KEY_HASH_SIZE) == 0,
+         ERROR_RSA_INVALID_PRECOMPUTED_KEY);
+
+  err = rsa_mont_load(mont, key->N, get_precomputed_rr(key),
+                      read_u64_le((const uint8_t *)&key->mm), key_size / 8);
+  CHECK2(err == RSA_MONT_SUCCESS, ERROR_RSA_INVALID_PRECOMPUTED_KEY);
+  err = rsa_mont_check(mont);
+  CHECK2(err == RSA_MONT_SUCCESS, ERROR_RSA_INVALID_PRECOMPUTED_KEY);
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+// "RSAC", marks an arena initialized by load_prefilled_data
+#define RSA_CACHE_MAGIC 0x43415352
+#define RSA_KEY_CACHE_SIZE 4
+
+/**
+ * Arena filled by load_prefilled_data and reused by all validate_signature*
+ * calls of a script run. It keeps the Montgomery context (R^2 mod N and
+ * -N^(-1) mod 2^64) of the last public keys, so a key is prepared only once.
+ */
+typedef struct RsaPrefilledCache {
+  uint32_t magic;
+  // slot replaced on the next miss
+  uint32_t next;
+  // limbs is 0 for an empty slot
+  RsaMontContext keys[RSA_KEY_CACHE_SIZE];
+} RsaPrefilledCache;
+
+static RsaPrefilledCache *get_rsa_cache(void *prefilled_data) {
+  RsaPrefilledCache *cache = (RsaPrefilledCache *)prefilled_data;
+  if (cache == NULL || cache->magic != RSA_CACHE_MAGIC) {
+    return NULL;
+  }
+  return cache;
+}
+
+/**
+ * Get the Montgomery context of N from the cache in prefilled_data, or
+ * prepare it there. Without a cache, it's prepared in local.
+ * @param mont output, the context to use.
+ */
+static int rsa_get_mont(void *prefilled_data, const uint8_t *n_le,
+                        uint32_t key_size, RsaMontContext *local,
+                        const RsaMontContext **mont) {
+  RsaPrefilledCache *cache = get_rsa_cache(prefilled_data);
+  RsaMontContext *slot = local;
+
+  if (cache != NULL) {
+    for (uint32_t i = 0; i < RSA_KEY_CACHE_SIZE; i++) {
+      if (rsa_mont_same_modulus(&cache->keys[i], n_le, key_size / 8)) {
+        *mont = &cache->keys[i];
+        return CKB_SUCCESS;
+      }
+    }
+    slot = &cache->keys[cache->next];
+    cache->next = (cache->next + 1) % RSA_KEY_CACHE_SIZE;
+  }
+  if (rsa_mont_init(slot, n_le, key_size / 8) != RSA_MONT_SUCCESS) {
+    slot->limbs = 0;
+    return ERROR_WRONG_PUBKEY;
+  }
+  *mont = slot;
+  return CKB_SUCCESS;
+}
+
 __attribute__((visibility("default"))) int load_prefilled_data(void *data,
                                                                size_t *len) {
-  (void)data;
-  *len = 0;
-  return CKB_SUCCESS;
+  int err = 0;
+  RsaPrefilledCache *cache = (RsaPrefilledCache *)data;
+
+  if (data == NULL) {
+    *len = sizeof(RsaPrefilledCache);
+    return CKB_SUCCESS;
+  }
+  if (*len >= sizeof(uint32_t) && cache->magic == RSA_PRECOMPUTED_KEY_MAGIC) {
+    RsaMontContext mont;
+    return rsa_load_precomputed_key((const RsaPrecomputedKey *)data, *len,
+                                    &mont);
+  }
+  CHECK2(*len >= sizeof(RsaPrefilledCache), ERROR_RSA_INVALID_PARAM2);
+  CHECK2(((uintptr_t)data & (sizeof(rsa_limb_t) - 1)) == 0,
+         ERROR_RSA_INVALID_PARAM1);
+  cache->magic = RSA_CACHE_MAGIC;
+  cache->next = 0;
+  for (uint32_t i = 0; i < RSA_KEY_CACHE_SIZE; i++) {
+    cache->keys[i].limbs = 0;
+  }
+  *len = sizeof(RsaPrefilledCache);
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
 }
 
 uint8_t *get_rsa_signature(RsaInfo *info) {
@@ -186,86 +364,651 @@ uint8_t *get_rsa_signature(RsaInfo *info) {
 
 uint32_t calculate_rsa_info_length(int key_size) { return 8 + key_size / 4; }
 
-int validate_signature_rsa(void *prefilled_data,
-                           const uint8_t *signature_buffer,
-                           size_t signature_size, const uint8_t *msg_buf,
-                           size_t msg_size, uint8_t *output,
-                           size_t *output_len) {
-  (void)prefilled_data;
-  (void)output;
-  (void)output_len;
-  int err = ERROR_RSA_ONLY_INIT;
-  uint8_t hash_buf[MBEDTLS_MD_MAX_SIZE] = {0};
-  uint32_t hash_size = 0;
-  uint32_t key_size = 0;
-  bool is_rsa_inited = false;
-  mbedtls_rsa_context rsa;
+// DER encoded DigestInfo prefixes, see RFC 8017, section 9.2, note 1.
+static const uint8_t SHA224_DIGEST_INFO[] = {
+    0x30, 0x2d, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+    0x65, 0x03, 0x04, 0x02, 0x04, 0x05, 0x00, 0x04, 0x1c};
+static const uint8_t SHA256_DIGEST_INFO[] = {
+    0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+    0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20};
+static const uint8_t SHA384_DIGEST_INFO[] = {
+    0x30, 0x41, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+    0x65, 0x03, 0x04, 0x02, 0x02, 0x05, 0x00, 0x04, 0x30};
+static const uint8_t SHA512_DIGEST_INFO[] = {
+    0x30, 0x51, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+    0x65, 0x03, 0x04, 0x02, 0x03, 0x05, 0x00, 0x04, 0x40};
 
-  RsaInfo *input_info = (RsaInfo *)signature_buffer;
+/**
+ * Check an EMSA-PKCS1-v1_5 encoded message:
+ * 0x00 || 0x01 || 0xFF ... 0xFF || 0x00 || DigestInfo || hash
+ * It accepts the same encoding as mbedtls_rsa_rsassa_pkcs1_v15_verify.
+ */
+static int pkcs1_v15_check_encoding(const uint8_t *em, size_t em_len,
+                                    mbedtls_md_type_t md_type,
+                                    const uint8_t *hash, size_t hash_size) {
+  const uint8_t *prefix = NULL;
+  size_t prefix_len = 0;
+  if (md_type == MBEDTLS_MD_SHA224) {
+    prefix = SHA224_DIGEST_INFO;
+    prefix_len = sizeof(SHA224_DIGEST_INFO);
+  } else if (md_type == MBEDTLS_MD_SHA256) {
+    prefix = SHA256_DIGEST_INFO;
+    prefix_len = sizeof(SHA256_DIGEST_INFO);
+  } else if (md_type == MBEDTLS_MD_SHA384) {
+    prefix = SHA384_DIGEST_INFO;
+    prefix_len = sizeof(SHA384_DIGEST_INFO);
+  } else if (md_type == MBEDTLS_MD_SHA512) {
+    prefix = SHA512_DIGEST_INFO;
+    prefix_len = sizeof(SHA512_DIGEST_INFO);
+  } else {
+    return ERROR_INVALID_MD_TYPE;
+  }
+  // at least 8 bytes of 0xFF padding
+  if (em_len < prefix_len + hash_size + 11) {
+    return ERROR_RSA_VERIFY_FAILED;
+  }
+  size_t ps_end = em_len - prefix_len - hash_size - 1;
+  int diff = em[0] ^ 0x00;
+  diff |= em[1] ^ 0x01;
+  for (size_t i = 2; i < ps_end; i++) {
+    diff |= em[i] ^ 0xFF;
+  }
+  diff |= em[ps_end] ^ 0x00;
+  diff |= memcmp(em + ps_end + 1, prefix, prefix_len);
+  diff |= memcmp(em + ps_end + 1 + prefix_len, hash, hash_size);
+  return diff == 0 ? CKB_SUCCESS : ERROR_RSA_VERIFY_FAILED;
+}
 
-  // for key size with 1024 and 2048 bits, it uses up to 7K bytes.
-  int alloc_buff_size = 1024 * 7;
-  // for key size with 4096 bits, it uses 12K bytes at most.
-  if (input_info->key_size == CKB_KEYSIZE_4096) alloc_buff_size = 1024 * 12;
-  unsigned char alloc_buff[alloc_buff_size];
-  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+static uint32_t get_rsa_exponent(const RsaInfo *info) {
+  return read_u32_le((const uint8_t *)&info->E);
+}
+
+/**
+ * Same checks as check_pubkey, without going through mbedtls_mpi:
+ * the most significant byte of N is not zero and 2 < E < N.
+ * E is 32 bits and N at least 1024 bits, so E < N always holds.
+ */
+static int check_pubkey_raw(const RsaInfo *info, uint32_t key_size) {
+  if (info->N[key_size / 8 - 1] == 0) {
+    return ERROR_WRONG_PUBKEY;
+  }
+  if (get_rsa_exponent(info) <= 2) {
+    return ERROR_WRONG_PUBKEY;
+  }
+  return CKB_SUCCESS;
+}
+
+/**
+ * PKCS#1 v1.5 verification on top of the dedicated public key operation
+ * in rsa_montgomery.h. Everything lives on the stack: no mbedtls_mpi and no
+ * mbedtls_memory_buffer_alloc_init.
+ */
+static int rsa_pkcs1_v15_verify_mont(const RsaMontContext *mont, uint32_t E,
+                                     const uint8_t *sig,
+                                     mbedtls_md_type_t md_type,
+                                     const uint8_t *hash, size_t hash_size) {
+  int err = 0;
+  uint8_t em[RSA_MAX_LIMBS * RSA_LIMB_BYTES];
+
+  err = rsa_mont_exp_public(mont, sig, E, em);
+  CHECK2(err == RSA_MONT_SUCCESS, ERROR_RSA_VERIFY_FAILED);
+  err = pkcs1_v15_check_encoding(em, mont->limbs * RSA_LIMB_BYTES, md_type,
+                                 hash, hash_size);
+  CHECK(err);
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+/**
+ * MGF1 (RFC 8017, B.2.1) with the digest md_type: the mask generated from
+ * seed is xored into buf in place, one digest block at a time. The same
+ * digest context is restarted for every block.
+ */
+static int pss_mgf1_xor(MdContext *md, mbedtls_md_type_t md_type, uint8_t *buf,
+                        size_t len, const uint8_t *seed, size_t seed_len) {
+  int err = 0;
+  uint8_t mask[MBEDTLS_MD_MAX_SIZE];
+  uint8_t counter[4] = {0};
+
+  for (size_t pos = 0; pos < len; pos += seed_len) {
+    err = md_starts(md, md_type);
+    CHECK(err);
+    err = md_update(md, seed, seed_len);
+    CHECK(err);
+    err = md_update(md, counter, sizeof(counter));
+    CHECK(err);
+    err = md_finish(md, mask);
+    CHECK(err);
+    size_t n = len - pos < seed_len ? len - pos : seed_len;
+    for (size_t i = 0; i < n; i++) {
+      buf[pos + i] ^= mask[i];
+    }
+    // big endian counter, len is far below 2^32 blocks
+    for (int i = 3; i >= 0 && ++counter[i] == 0; i--) {
+    }
+  }
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+/**
+ * EMSA-PSS verification (RFC 8017, 9.1.2) on top of rsa_montgomery.h, with
+ * the same rules as mbedtls_rsa_rsassa_pss_verify: MGF1 uses the message
+ * digest and any salt length is accepted. DB is unmasked in place in the
+ * encoded message, no allocation.
+ */
+static int rsa_pss_verify_mont(const RsaMontContext *mont, uint32_t E,
+                               const uint8_t *sig, mbedtls_md_type_t md_type,
+                               const uint8_t *hash, size_t hash_size) {
+  int err = 0;
+  static const uint8_t zeros[8] = {0};
+  uint8_t em[RSA_MAX_LIMBS * RSA_LIMB_BYTES];
+  uint8_t result[MBEDTLS_MD_MAX_SIZE];
+  MdContext md;
+  size_t len = mont->limbs * RSA_LIMB_BYTES;
+  // emBits
+  int msb = (int)rsa_mont_bits(mont) - 1;
+  uint8_t *p = em;
+
+  err = rsa_mont_exp_public(mont, sig, E, em);
+  CHECK2(err == RSA_MONT_SUCCESS, ERROR_RSA_VERIFY_FAILED);
+  CHECK2(em[len - 1] == 0xBC, ERROR_RSA_VERIFY_FAILED);
+  // the bits above emBits must be 0
+  CHECK2((em[0] >> (8 - (int)len * 8 + msb)) == 0, ERROR_RSA_VERIFY_FAILED);
+  if (msb % 8 == 0) {
+    p++;
+    len--;
+  }
+  CHECK2(len >= hash_size + 2, ERROR_RSA_VERIFY_FAILED);
+
+  // EM = maskedDB || H || 0xBC
+  uint8_t *hash_start = p + len - hash_size - 1;
+  err = pss_mgf1_xor(&md, md_type, p, len - hash_size - 1, hash_start,
+                     hash_size);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  em[0] &= 0xFF >> (len * 8 - msb);
+
+  // DB = PS (zeros) || 0x01 || salt
+  while (p < hash_start - 1 && *p == 0) {
+    p++;
+  }
+  CHECK2(*p++ == 0x01, ERROR_RSA_VERIFY_FAILED);
+
+  // H' = Hash(0x00 * 8 || mHash || salt)
+  err = md_starts(&md, md_type);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  err = md_update(&md, zeros, sizeof(zeros));
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  err = md_update(&md, hash, hash_size);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  err = md_update(&md, p, hash_start - p);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  err = md_finish(&md, result);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  CHECK2(memcmp(hash_start, result, hash_size) == 0, ERROR_RSA_VERIFY_FAILED);
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+/**
+ * Verify sig with the prepared key, for both paddings.
+ * @param padding CKB_PKCS_15 or CKB_PKCS_21.
+ */
+static int rsa_verify_mont(const RsaMontContext *mont, uint32_t E,
+                           uint8_t padding, const uint8_t *sig,
+                           mbedtls_md_type_t md_type, const uint8_t *hash,
+                           size_t hash_size) {
+  if (convert_padding(padding) == MBEDTLS_RSA_PKCS_V15) {
+    return rsa_pkcs1_v15_verify_mont(mont, E, sig, md_type, hash, hash_size);
+  } else {
+    return rsa_pss_verify_mont(mont, E, sig, md_type, hash, hash_size);
+  }
+}
+
+/**
+ * Check the RsaInfo header and public key, before hashing the message.
+ * @param has_signature false when the buffer ends with N, see
+ * validate_signature_batch.
+ * @param key_size output, "KeySize" in bits.
+ */
+static int rsa_check_info(const uint8_t *signature_buffer,
+                          size_t signature_size, bool has_signature,
+                          uint32_t *key_size) {
+  int err = 0;
+  RsaInfo *input_info = (RsaInfo *)signature_buffer;
 
   CHECK2(is_valid_rsa_md_type(input_info->md_type), ERROR_INVALID_MD_TYPE);
   CHECK2(is_valid_padding(input_info->padding), ERROR_INVALID_PADDING);
   CHECK2(is_valid_key_size(input_info->key_size), ERROR_RSA_INVALID_KEY_SIZE);
-  key_size = get_key_size(input_info->key_size);
-  CHECK2(key_size > 0, ERROR_RSA_INVALID_KEY_SIZE);
+  *key_size = get_key_size(input_info->key_size);
+  CHECK2(*key_size > 0, ERROR_RSA_INVALID_KEY_SIZE);
   CHECK2(signature_buffer != NULL, ERROR_RSA_INVALID_PARAM1);
-  CHECK2(msg_buf != NULL, ERROR_RSA_INVALID_PARAM1);
-  CHECK2(signature_size == (size_t)calculate_rsa_info_length(key_size),
-         ERROR_RSA_INVALID_PARAM2);
+  size_t expected_size = calculate_rsa_info_length(*key_size);
+  if (!has_signature) expected_size -= *key_size / 8;
+  CHECK2(signature_size == expected_size, ERROR_RSA_INVALID_PARAM2);
 
   mbedtls_md_type_t md_type = convert_md_type(input_info->md_type);
   const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(md_type);
   CHECK2(md_info != NULL, ERROR_RSA_INVALID_MD_TYPE2);
 
-  hash_size = md_info->size;
-  int padding = convert_padding(input_info->padding);
+  CHECK(check_pubkey_raw(input_info, *key_size));
 
-  is_rsa_inited = true;
-  mbedtls_rsa_init(&rsa, padding, 0);
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
 
-  err = mbedtls_mpi_read_binary_le(
-      &rsa.E, (const unsigned char *)&input_info->E, sizeof(uint32_t));
-  CHECK2(err == 0, ERROR_MBEDTLS_ERROR_1);
+/**
+ * Verify the signature in RsaInfo against the message hash, the digest type
+ * is the one in RsaInfo. rsa_check_info must have succeeded.
+ * @param prefilled_data arena from load_prefilled_data or NULL.
+ */
+static int rsa_verify_hash(void *prefilled_data, RsaInfo *info,
+                           uint32_t key_size, const uint8_t *hash) {
+  int err = 0;
+  RsaMontContext local;
+  const RsaMontContext *mont = NULL;
+  mbedtls_md_type_t md_type = convert_md_type(info->md_type);
+  const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(md_type);
+  size_t hash_size = md_info->size;
 
-  err = mbedtls_mpi_read_binary_le(&rsa.N, input_info->N, key_size / 8);
-  CHECK2(err == 0, ERROR_MBEDTLS_ERROR_1);
+  err = rsa_get_mont(prefilled_data, info->N, key_size, &local, &mont);
+  if (err != 0) {
+    return err;
+  }
+  err = rsa_verify_mont(mont, get_rsa_exponent(info), info->padding,
+                        get_rsa_signature(info), md_type, hash, hash_size);
+  if (err != 0) {
+    return ERROR_RSA_VERIFY_FAILED;
+  }
+  return CKB_SUCCESS;
+}
 
-  CHECK(check_pubkey(&rsa.N, &rsa.E));
+static int validate_signature_rsa(void *prefilled_data,
+                                  const uint8_t *signature_buffer,
+                                  size_t signature_size, const uint8_t *msg_buf,
+                                  size_t msg_size, uint8_t *output,
+                                  size_t *output_len) {
+  (void)output;
+  (void)output_len;
+  int err = ERROR_RSA_ONLY_INIT;
+  uint8_t hash_buf[MBEDTLS_MD_MAX_SIZE] = {0};
+  uint32_t key_size = 0;
 
-  rsa.len = (mbedtls_mpi_bitlen(&rsa.N) + 7) >> 3;
-  CHECK2(is_valid_key_size_in_bit(rsa.len * 8), ERROR_WRONG_PUBKEY);
+  RsaInfo *input_info = (RsaInfo *)signature_buffer;
 
-  err = md_string(md_info, msg_buf, msg_size, hash_buf);
+  err = rsa_check_info(signature_buffer, signature_size, true, &key_size);
+  CHECK(err);
+  CHECK2(msg_buf != NULL, ERROR_RSA_INVALID_PARAM1);
+
+  mbedtls_md_type_t md_type = convert_md_type(input_info->md_type);
+  err = md_string(mbedtls_md_info_from_type(md_type), msg_buf, msg_size,
+                  hash_buf);
   CHECK2(err == 0, ERROR_MD_FAILED);
 
-  err = mbedtls_rsa_pkcs1_verify(&rsa, NULL, NULL, MBEDTLS_RSA_PUBLIC, md_type,
-                                 hash_size, hash_buf,
-                                 get_rsa_signature(input_info));
-  if (err != 0) {
-    err = ERROR_RSA_VERIFY_FAILED;
-    goto exit;
+  err = rsa_verify_hash(prefilled_data, input_info, key_size, hash_buf);
+  CHECK(err);
+
+  err = CKB_SUCCESS;
+
+exit:
+  return err;
+}
+
+/**
+ * Verify a RsaSignatureOnly with the public key from a RsaPrecomputedKey.
+ */
+static int validate_signature_rsa_precomputed(void *prefilled_data,
+                                              const uint8_t *sig_buf,
+                                              size_t sig_len,
+                                              const uint8_t *msg_buf,
+                                              size_t msg_len, uint8_t *output,
+                                              size_t *output_len) {
+  (void)output;
+  (void)output_len;
+  int err = 0;
+  uint8_t hash_buf[MBEDTLS_MD_MAX_SIZE] = {0};
+  RsaPrecomputedKey *key = (RsaPrecomputedKey *)prefilled_data;
+  RsaSignatureOnly *sig_info = (RsaSignatureOnly *)sig_buf;
+  RsaMontContext mont;
+
+  CHECK2(key != NULL && is_valid_key_size(key->key_size),
+         ERROR_RSA_INVALID_PRECOMPUTED_KEY);
+  uint32_t key_size = get_key_size(key->key_size);
+  // The key is in caller memory, maybe modified since load_prefilled_data:
+  // check it again, it costs one Montgomery multiplication and a blake2b.
+  err = rsa_load_precomputed_key(
+      key, calculate_precomputed_key_length(key_size), &mont);
+  CHECK(err);
+  CHECK2(sig_len >= offsetof(RsaSignatureOnly, sig), ERROR_RSA_INVALID_PARAM2);
+  // the signer commits to the key parameters
+  CHECK2(sig_info->key_size == key->key_size &&
+             sig_info->padding == key->padding &&
+             sig_info->md_type == key->md_type,
+         ERROR_WRONG_PUBKEY);
+  CHECK2(sig_len == offsetof(RsaSignatureOnly, sig) + key_size / 8,
+         ERROR_RSA_INVALID_PARAM2);
+  CHECK2(msg_buf != NULL, ERROR_RSA_INVALID_PARAM1);
+
+  mbedtls_md_type_t md_type = convert_md_type(key->md_type);
+  const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(md_type);
+  size_t hash_size = md_info->size;
+  err = md_string(md_info, msg_buf, msg_len, hash_buf);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+
+  err = rsa_verify_mont(&mont, read_u32_le((uint8_t *)&key->E), key->padding,
+                        sig_info->sig, md_type, hash_buf, hash_size);
+  CHECK2(err == 0, ERROR_RSA_VERIFY_FAILED);
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+/**
+ * Check the public key of a CKB_VERIFY_RABIN_WILLIAMS RsaInfo: the most
+ * significant byte of N is not zero, E is 2 and N = 5 mod 8.
+ */
+static int rabin_williams_check_pubkey(const RsaInfo *info, uint32_t key_size) {
+  if (info->N[key_size / 8 - 1] == 0) {
+    return ERROR_WRONG_PUBKEY;
+  }
+  if (get_rsa_exponent(info) != 2) {
+    return ERROR_WRONG_PUBKEY;
+  }
+  if ((info->N[0] & 7) != 5) {
+    return ERROR_WRONG_PUBKEY;
   }
+  return CKB_SUCCESS;
+}
+
+/**
+ * Rabin-Williams verification of an EMSA-PKCS1-v1_5 encoding: accepts s when
+ * EM = e * f * s^2 mod N for one of the tweaks e in {1, -1}, f in {1, 2}.
+ * s^2 is computed once, each candidate costs a doubling and a subtraction.
+ * pkcs1_v15_check_encoding doesn't ASSERT on the candidates that don't match.
+ */
+static int rabin_williams_verify_mont(const RsaMontContext *mont,
+                                      const uint8_t *sig,
+                                      mbedtls_md_type_t md_type,
+                                      const uint8_t *hash, size_t hash_size) {
+  uint32_t n = mont->limbs;
+  rsa_limb_t x[RSA_MAX_LIMBS];
+  rsa_limb_t candidate[RSA_MAX_LIMBS];
+  uint8_t em[RSA_MAX_LIMBS * RSA_LIMB_BYTES];
+
+  rsa_limbs_read_be(x, n, sig);
+  if (rsa_limbs_cmp(x, mont->N, n) >= 0) {
+    return ERROR_RSA_VERIFY_FAILED;
+  }
+  // s and N - s verify the same message: only the smaller one is accepted,
+  // so that the signature can't be changed without the private key
+  rsa_limbs_sub(candidate, mont->N, x, n);
+  if (rsa_limbs_cmp(x, candidate, n) > 0) {
+    return ERROR_RSA_VERIFY_FAILED;
+  }
+
+  rsa_mont_square(mont, x);
+  // bit 0 of tweak: e = -1, bit 1: f = 2
+  for (int tweak = 0; tweak < 4; tweak++) {
+    for (uint32_t i = 0; i < n; i++) {
+      candidate[i] = x[i];
+    }
+    if (tweak & 2) {
+      rsa_mont_double(mont, candidate);
+    }
+    if (tweak & 1) {
+      rsa_mont_negate(mont, candidate);
+    }
+    rsa_limbs_write_be(candidate, n, em);
+    if (pkcs1_v15_check_encoding(em, n * RSA_LIMB_BYTES, md_type, hash,
+                                 hash_size) == CKB_SUCCESS) {
+      return CKB_SUCCESS;
+    }
+  }
+  return ERROR_RSA_VERIFY_FAILED;
+}
+
+/**
+ * Verify a RsaInfo with algorithm_id CKB_VERIFY_RABIN_WILLIAMS, see
+ * validate_signature_rsa.h. Same key cache as CKB_VERIFY_RSA, but the public
+ * operation is a single modular squaring.
+ */
+static int validate_signature_rabin_williams(void *prefilled_data,
+                                             const uint8_t *sig_buf,
+                                             size_t sig_len,
+                                             const uint8_t *msg_buf,
+                                             size_t msg_len, uint8_t *output,
+                                             size_t *output_len) {
+  (void)output;
+  (void)output_len;
+  int err = 0;
+  uint8_t hash_buf[MBEDTLS_MD_MAX_SIZE] = {0};
+  RsaInfo *info = (RsaInfo *)sig_buf;
+  RsaMontContext local;
+  const RsaMontContext *mont = NULL;
+
+  CHECK2(is_valid_rsa_md_type(info->md_type), ERROR_INVALID_MD_TYPE);
+  CHECK2(info->padding == CKB_PKCS_15, ERROR_INVALID_PADDING);
+  CHECK2(is_valid_key_size(info->key_size), ERROR_RSA_INVALID_KEY_SIZE);
+  uint32_t key_size = get_key_size(info->key_size);
+  CHECK2(sig_len == calculate_rsa_info_length(key_size),
+         ERROR_RSA_INVALID_PARAM2);
+  CHECK(rabin_williams_check_pubkey(info, key_size));
+  CHECK2(msg_buf != NULL, ERROR_RSA_INVALID_PARAM1);
+
+  mbedtls_md_type_t md_type = convert_md_type(info->md_type);
+  const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(md_type);
+  CHECK2(md_info != NULL, ERROR_RSA_INVALID_MD_TYPE2);
+  err = md_string(md_info, msg_buf, msg_len, hash_buf);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+
+  err = rsa_get_mont(prefilled_data, info->N, key_size, &local, &mont);
+  CHECK(err);
+  err = rabin_williams_verify_mont(mont, get_rsa_signature(info), md_type,
+                                   hash_buf, md_info->size);
+  CHECK2(err == 0, ERROR_RSA_VERIFY_FAILED);
 
   err = CKB_SUCCESS;
+exit:
+  return err;
+}
 
+// heap of mbedtls_ecdsa_verify on P-256: the precomputed multiples of the
+// generator and the public key, plus temporaries. Measured over 200
+// signatures with mbedtls 2.28 and 64-bit limbs: a peak of 5240 bytes in 75
+// blocks, 10144 bytes of arena with the block headers. The size is that plus
+// SECP256R1_ARENA_MARGIN_PERCENT, rounded up to 1 KB. The simulator built
+// with MBEDTLS_MEMORY_DEBUG (see CMakeLists.txt) checks the margin in
+// test_validate_signature_secp256r1.
+#define SECP256R1_ARENA_SIZE (13 * 1024)
+#define SECP256R1_ARENA_MARGIN_PERCENT 25
+
+/**
+ * Verify a Secp256r1Info: ECDSA on P-256 over the SHA-256 of the message.
+ * The mbedtls heap is the SignatureArena opened by validate_signature.
+ */
+static int validate_signature_secp256r1(void *prefilled_data,
+                                        const uint8_t *sig_buf, size_t sig_len,
+                                        const uint8_t *msg_buf, size_t msg_len,
+                                        uint8_t *output, size_t *output_len) {
+  (void)prefilled_data;
+  (void)sig_len;
+  (void)output;
+  (void)output_len;
+  int err = 0;
+  const Secp256r1Info *info = (const Secp256r1Info *)sig_buf;
+  uint8_t hash_buf[32] = {0};
+  // SEC1 uncompressed point: 0x04 || X || Y
+  uint8_t point[1 + sizeof(info->pubkey)];
+  mbedtls_ecp_group grp;
+  mbedtls_ecp_point Q;
+  mbedtls_mpi r;
+  mbedtls_mpi s;
+
+  mbedtls_ecp_group_init(&grp);
+  mbedtls_ecp_point_init(&Q);
+  mbedtls_mpi_init(&r);
+  mbedtls_mpi_init(&s);
+
+  CHECK2(info->md_type == CKB_MD_SHA256, ERROR_INVALID_MD_TYPE);
+  CHECK2(info->padding == 0, ERROR_INVALID_PADDING);
+  CHECK2(msg_buf != NULL, ERROR_RSA_INVALID_PARAM1);
+
+  err = md_string(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), msg_buf,
+                  msg_len, hash_buf);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+
+  err = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+  CHECK2(err == 0, ERROR_MBEDTLS_ERROR_1);
+  point[0] = 0x04;
+  memcpy(point + 1, info->pubkey, sizeof(info->pubkey));
+  err = mbedtls_ecp_point_read_binary(&grp, &Q, point, sizeof(point));
+  CHECK2(err == 0, ERROR_SECP256R1_INVALID_PUBKEY);
+  // on the curve, not the point at infinity
+  err = mbedtls_ecp_check_pubkey(&grp, &Q);
+  CHECK2(err == 0, ERROR_SECP256R1_INVALID_PUBKEY);
+
+  err = mbedtls_mpi_read_binary(&r, info->sig, 32);
+  CHECK2(err == 0, ERROR_MBEDTLS_ERROR_1);
+  err = mbedtls_mpi_read_binary(&s, info->sig + 32, 32);
+  CHECK2(err == 0, ERROR_MBEDTLS_ERROR_1);
+  // r and s out of [1, n-1] are rejected too
+  err = mbedtls_ecdsa_verify(&grp, hash_buf, sizeof(hash_buf), &Q, &r, &s);
+  CHECK2(err == 0, ERROR_SECP256R1_VERIFY_FAILED);
+
+  err = CKB_SUCCESS;
 exit:
-  if (is_rsa_inited) mbedtls_rsa_free(&rsa);
+  mbedtls_mpi_free(&s);
+  mbedtls_mpi_free(&r);
+  mbedtls_ecp_point_free(&Q);
+  mbedtls_ecp_group_free(&grp);
   return err;
 }
 
+/**
+ * The mbedtls heap of one validate_signature call, on the stack. The
+ * allocator of mbedtls is global, so there is exactly one arena: it's opened
+ * by validate_signature before the algorithm runs, and nothing below
+ * initializes the allocator again.
+ */
+typedef struct SignatureArena {
+  unsigned char *buf;
+  size_t size;
+} SignatureArena;
+
+static void signature_arena_open(SignatureArena *arena, unsigned char *buf,
+                                 size_t size) {
+  arena->buf = buf;
+  arena->size = size;
+  if (size > 0) {
+    mbedtls_memory_buffer_alloc_init(buf, size);
+  }
+}
+
+#if defined(MBEDTLS_MEMORY_DEBUG)
+// sizeof(memory_header) of mbedtls memory_buffer_alloc.c, before every block
+#define SIGNATURE_ARENA_BLOCK_HEADER (8 * sizeof(size_t))
+// peak usage of the last arena with a heap, with the block headers, in bytes
+static size_t g_signature_arena_peak = 0;
+#endif
+
+/**
+ * Report the peak usage of the arena, also kept in g_signature_arena_peak.
+ * It's only tracked by mbedtls built with MBEDTLS_MEMORY_DEBUG.
+ */
+static void signature_arena_close(SignatureArena *arena, uint8_t algorithm_id) {
+  (void)algorithm_id;
+#if defined(MBEDTLS_MEMORY_DEBUG)
+  if (arena->size > 0) {
+    size_t max_used = 0;
+    size_t max_blocks = 0;
+    mbedtls_memory_buffer_alloc_max_get(&max_used, &max_blocks);
+    g_signature_arena_peak =
+        max_used + max_blocks * SIGNATURE_ARENA_BLOCK_HEADER;
+    mbedtls_printf("arena of algorithm %d: peak %d of %d bytes, %d blocks\n",
+                   algorithm_id, (int)max_used, (int)arena->size,
+                   (int)max_blocks);
+  }
+#endif
+  arena->buf = NULL;
+  arena->size = 0;
+}
+
+typedef int (*ValidateSignatureFn)(void *prefilled_data,
+                                   const uint8_t *sig_buf, size_t sig_len,
+                                   const uint8_t *msg_buf, size_t msg_len,
+                                   uint8_t *output, size_t *output_len);
+
+/**
+ * An algorithm of validate_signature, selected by the algorithm_id of the
+ * common header.
+ */
+typedef struct SignatureAlgorithm {
+  uint8_t id;
+  // key_size of the common header
+  bool (*is_valid_key_size)(uint8_t key_size_enum);
+  // the exact sig_len for a valid key_size
+  size_t (*signature_length)(uint8_t key_size_enum);
+  // bytes of SignatureArena, 0 when mbedtls doesn't allocate
+  size_t arena_size;
+  ValidateSignatureFn verify;
+} SignatureAlgorithm;
+
+static size_t rsa_info_length(uint8_t key_size_enum) {
+  return calculate_rsa_info_length(get_key_size(key_size_enum));
+}
+
+static size_t rsa_signature_only_length(uint8_t key_size_enum) {
+  return offsetof(RsaSignatureOnly, sig) + get_key_size(key_size_enum) / 8;
+}
+
+static bool is_valid_secp256r1_key_size(uint8_t key_size_enum) {
+  return key_size_enum == CKB_KEYSIZE_P256;
+}
+
+static size_t secp256r1_info_length(uint8_t key_size_enum) {
+  (void)key_size_enum;
+  return sizeof(Secp256r1Info);
+}
+
+// adding an algorithm only takes a new entry here
+static const SignatureAlgorithm SIGNATURE_ALGORITHMS[] = {
+    {CKB_VERIFY_RSA, is_valid_key_size, rsa_info_length, 0,
+     validate_signature_rsa},
+    {CKB_VERIFY_ISO9796_2, is_valid_key_size, rsa_info_length, 0,
+     validate_signature_iso9796_2},
+    {CKB_VERIFY_RSA_PRECOMPUTED, is_valid_key_size, rsa_signature_only_length,
+     0, validate_signature_rsa_precomputed},
+    {CKB_VERIFY_SECP256R1, is_valid_secp256r1_key_size, secp256r1_info_length,
+     SECP256R1_ARENA_SIZE, validate_signature_secp256r1},
+    {CKB_VERIFY_RABIN_WILLIAMS, is_valid_key_size, rsa_info_length, 0,
+     validate_signature_rabin_williams},
+};
+
+static const SignatureAlgorithm *find_signature_algorithm(uint8_t id) {
+  for (size_t i = 0;
+       i < sizeof(SIGNATURE_ALGORITHMS) / sizeof(SIGNATURE_ALGORITHMS[0]);
+       i++) {
+    if (SIGNATURE_ALGORITHMS[i].id == id) {
+      return &SIGNATURE_ALGORITHMS[i];
+    }
+  }
+  return NULL;
+}
+
 /**
  * entry for different algorithms
- * The fist byte of signature_buffer is the algorithm_id, it can be:
- * #define CKB_VERIFY_RSA 1
- * #define CKB_VERIFY_ISO9796_2 2
-s */
+ * The fist byte of signature_buffer is the algorithm_id, see
+ * SIGNATURE_ALGORITHMS. The key size and the length of signature_buffer are
+ * checked here, before the algorithm runs.
+ */
 __attribute__((visibility("default"))) int validate_signature(
     void *prefilled_data, const uint8_t *sig_buf, size_t sig_len,
     const uint8_t *msg_buf, size_t msg_len, uint8_t *output,
@@ -280,38 +1023,253 @@ __attribute__((visibility("default"))) int validate_signature(
     ASSERT(0);
     return ERROR_RSA_INVALID_PARAM1;
   }
+  if (sig_len < offsetof(RsaInfo, E)) {
+    ASSERT(0);
+    return ERROR_RSA_INVALID_PARAM2;
+  }
 
-  uint8_t id = ((RsaInfo *)sig_buf)->algorithm_id;
-
-  if (id == CKB_VERIFY_RSA) {
-    return validate_signature_rsa(prefilled_data, sig_buf, sig_len, msg_buf,
-                                  msg_len, output, output_len);
-  } else if (id == CKB_VERIFY_ISO9796_2) {
-    return validate_signature_iso9796_2(prefilled_data, sig_buf, sig_len,
-                                        msg_buf, msg_len, output, output_len);
-  } else {
+  const RsaInfo *header = (const RsaInfo *)sig_buf;
+  const SignatureAlgorithm *algorithm =
+      find_signature_algorithm(header->algorithm_id);
+  if (algorithm == NULL) {
     return ERROR_RSA_INVALID_ID;
   }
+  if (!algorithm->is_valid_key_size(header->key_size)) {
+    ASSERT(0);
+    return ERROR_RSA_INVALID_KEY_SIZE;
+  }
+  if (sig_len != algorithm->signature_length(header->key_size)) {
+    ASSERT(0);
+    return ERROR_RSA_INVALID_PARAM2;
+  }
+
+  SignatureArena arena;
+  unsigned char arena_buf[algorithm->arena_size > 0 ? algorithm->arena_size
+                                                    : 1];
+  signature_arena_open(&arena, arena_buf, algorithm->arena_size);
+  int err = algorithm->verify(prefilled_data, sig_buf, sig_len, msg_buf,
+                              msg_len, output, output_len);
+  signature_arena_close(&arena, header->algorithm_id);
+  return err;
 }
 
-int md_string(const mbedtls_md_info_t *md_info, const uint8_t *buf, size_t n,
-              unsigned char *output) {
+// "RSAS", marks an initialized RsaStreamState
+#define RSA_STREAM_MAGIC 0x53415352
+
+// the real layout of ValidateSignatureContext
+typedef struct RsaStreamState {
+  uint32_t magic;
+  uint32_t key_size;
+  RsaInfo *info;
+  void *prefilled_data;
+  MdContext md;
+} RsaStreamState;
+
+_Static_assert(sizeof(RsaStreamState) <= sizeof(ValidateSignatureContext),
+               "ValidateSignatureContext is too small");
+
+__attribute__((visibility("default"))) int validate_signature_init(
+    void *prefilled_data, ValidateSignatureContext *ctx,
+    const uint8_t *sig_buf, size_t sig_len) {
   int err = 0;
-  mbedtls_md_context_t ctx;
-  mbedtls_md_init(&ctx);
+  RsaStreamState *state = (RsaStreamState *)ctx;
 
-  CHECK2(md_info != NULL, MBEDTLS_ERR_MD_BAD_INPUT_DATA);
-  err = mbedtls_md_setup(&ctx, md_info, 0);
+  if (sizeof(RsaInfo) != (PLACEHOLDER_SIZE * 2 + 8)) {
+    ASSERT(0);
+    return ERROR_BAD_MEMORY_LAYOUT;
+  }
+  CHECK2(ctx != NULL && sig_buf != NULL, ERROR_RSA_INVALID_PARAM1);
+  state->magic = 0;
+  CHECK2(((RsaInfo *)sig_buf)->algorithm_id == CKB_VERIFY_RSA,
+         ERROR_RSA_INVALID_ID);
+
+  err = rsa_check_info(sig_buf, sig_len, true, &state->key_size);
   CHECK(err);
-  err = mbedtls_md_starts(&ctx);
+  state->info = (RsaInfo *)sig_buf;
+  state->prefilled_data = prefilled_data;
+  err = md_starts(&state->md, convert_md_type(state->info->md_type));
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  state->magic = RSA_STREAM_MAGIC;
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+__attribute__((visibility("default"))) int validate_signature_update(
+    ValidateSignatureContext *ctx, const uint8_t *msg_buf, size_t msg_len) {
+  int err = 0;
+  RsaStreamState *state = (RsaStreamState *)ctx;
+
+  CHECK2(ctx != NULL && state->magic == RSA_STREAM_MAGIC,
+         ERROR_RSA_INVALID_PARAM1);
+  CHECK2(msg_buf != NULL || msg_len == 0, ERROR_RSA_INVALID_PARAM1);
+  err = md_update(&state->md, msg_buf, msg_len);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+__attribute__((visibility("default"))) int validate_signature_final(
+    ValidateSignatureContext *ctx, uint8_t *output, size_t *output_len) {
+  (void)output;
+  (void)output_len;
+  int err = 0;
+  uint8_t hash_buf[MBEDTLS_MD_MAX_SIZE] = {0};
+  RsaStreamState *state = (RsaStreamState *)ctx;
+
+  CHECK2(ctx != NULL && state->magic == RSA_STREAM_MAGIC,
+         ERROR_RSA_INVALID_PARAM1);
+  // a context can't be finalized twice
+  state->magic = 0;
+  err = md_finish(&state->md, hash_buf);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+
+  err = rsa_verify_hash(state->prefilled_data, state->info, state->key_size,
+                        hash_buf);
   CHECK(err);
-  err = mbedtls_md_update(&ctx, (const unsigned char *)buf, n);
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+/**
+ * Verify the signatures in items with the key in info, which has passed
+ * rsa_check_info. The key is prepared once for all of them.
+ */
+static int rsa_verify_batch(void *prefilled_data, RsaInfo *info,
+                            uint32_t key_size,
+                            const ValidateSignatureBatchItem *items,
+                            size_t count, size_t *failed_index) {
+  int err = 0;
+  uint8_t hash_buf[MBEDTLS_MD_MAX_SIZE] = {0};
+  RsaMontContext local;
+  const RsaMontContext *mont = NULL;
+
+  mbedtls_md_type_t md_type = convert_md_type(info->md_type);
+  const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(md_type);
+  size_t hash_size = md_info->size;
+  uint32_t E = get_rsa_exponent(info);
+
+  err = rsa_get_mont(prefilled_data, info->N, key_size, &local, &mont);
   CHECK(err);
-  err = mbedtls_md_finish(&ctx, output);
+
+  for (size_t i = 0; i < count; i++) {
+    if (failed_index != NULL) *failed_index = i;
+    CHECK2(items[i].sig != NULL && items[i].msg != NULL,
+           ERROR_RSA_INVALID_PARAM1);
+    err = md_string(md_info, items[i].msg, items[i].msg_len, hash_buf);
+    CHECK2(err == 0, ERROR_MD_FAILED);
+    err = rsa_verify_mont(mont, E, info->padding, items[i].sig, md_type,
+                          hash_buf, hash_size);
+    CHECK2(err == 0, ERROR_RSA_VERIFY_FAILED);
+  }
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+__attribute__((visibility("default"))) int validate_signature_batch(
+    void *prefilled_data, const uint8_t *pubkey_buf, size_t pubkey_len,
+    const ValidateSignatureBatchItem *items, size_t count,
+    size_t *failed_index) {
+  int err = 0;
+  uint32_t key_size = 0;
+  RsaInfo *info = (RsaInfo *)pubkey_buf;
+
+  if (sizeof(RsaInfo) != (PLACEHOLDER_SIZE * 2 + 8)) {
+    ASSERT(0);
+    return ERROR_BAD_MEMORY_LAYOUT;
+  }
+  CHECK2(pubkey_buf != NULL, ERROR_RSA_INVALID_PARAM1);
+  CHECK2(info->algorithm_id == CKB_VERIFY_RSA, ERROR_RSA_INVALID_ID);
+  // parse and check the public key only once
+  err = rsa_check_info(pubkey_buf, pubkey_len, false, &key_size);
+  CHECK(err);
+  CHECK2(items != NULL, ERROR_RSA_INVALID_PARAM1);
+  // an empty batch proves nothing
+  CHECK2(count > 0, ERROR_RSA_INVALID_PARAM2);
+
+  err = rsa_verify_batch(prefilled_data, info, key_size, items, count,
+                         failed_index);
+  CHECK(err);
+
+  err = CKB_SUCCESS;
+exit:
+  return err;
+}
+
+static int md_starts(MdContext *ctx, mbedtls_md_type_t type) {
+  ctx->type = type;
+  switch (type) {
+    case MBEDTLS_MD_SHA1:
+      mbedtls_sha1_init(&ctx->u.sha1);
+      return mbedtls_sha1_starts_ret(&ctx->u.sha1);
+    case MBEDTLS_MD_SHA224:
+    case MBEDTLS_MD_SHA256:
+      rsa_sha256_starts(&ctx->u.sha256, type == MBEDTLS_MD_SHA224);
+      return 0;
+    case MBEDTLS_MD_SHA384:
+    case MBEDTLS_MD_SHA512:
+      rsa_sha512_starts(&ctx->u.sha512, type == MBEDTLS_MD_SHA384);
+      return 0;
+    default:
+      return MBEDTLS_ERR_MD_BAD_INPUT_DATA;
+  }
+}
+
+static int md_update(MdContext *ctx, const uint8_t *buf, size_t n) {
+  switch (ctx->type) {
+    case MBEDTLS_MD_SHA1:
+      return mbedtls_sha1_update_ret(&ctx->u.sha1, buf, n);
+    case MBEDTLS_MD_SHA224:
+    case MBEDTLS_MD_SHA256:
+      rsa_sha256_update(&ctx->u.sha256, buf, n);
+      return 0;
+    case MBEDTLS_MD_SHA384:
+    case MBEDTLS_MD_SHA512:
+      rsa_sha512_update(&ctx->u.sha512, buf, n);
+      return 0;
+    default:
+      return MBEDTLS_ERR_MD_BAD_INPUT_DATA;
+  }
+}
+
+static int md_finish(MdContext *ctx, uint8_t *output) {
+  switch (ctx->type) {
+    case MBEDTLS_MD_SHA1:
+      return mbedtls_sha1_finish_ret(&ctx->u.sha1, output);
+    case MBEDTLS_MD_SHA224:
+    case MBEDTLS_MD_SHA256:
+      rsa_sha256_finish(&ctx->u.sha256, output);
+      return 0;
+    case MBEDTLS_MD_SHA384:
+    case MBEDTLS_MD_SHA512:
+      rsa_sha512_finish(&ctx->u.sha512, output);
+      return 0;
+    default:
+      return MBEDTLS_ERR_MD_BAD_INPUT_DATA;
+  }
+}
+
+static int md_string(const mbedtls_md_info_t *md_info, const uint8_t *buf,
+                     size_t n, unsigned char *output) {
+  int err = 0;
+  MdContext ctx;
+
+  CHECK2(md_info != NULL, MBEDTLS_ERR_MD_BAD_INPUT_DATA);
+  err = md_starts(&ctx, md_info->type);
+  CHECK(err);
+  err = md_update(&ctx, buf, n);
+  CHECK(err);
+  err = md_finish(&ctx, output);
   CHECK(err);
   err = 0;
 exit:
-  mbedtls_md_free(&ctx);
   return err;
 }
 
@@ -332,7 +1290,7 @@ enum Trailer {
   TRAILER_SHA512_256 = 0x3aCC
 };
 
-uint16_t get_trailer_by_md(mbedtls_md_type_t md) {
+static uint16_t get_trailer_by_md(mbedtls_md_type_t md) {
   if (md == MBEDTLS_MD_NONE) {
     return TRAILER_IMPLICIT;
   } else if (md == MBEDTLS_MD_SHA1) {
@@ -361,8 +1319,8 @@ typedef struct ISO97962Encoding {
   uint32_t trailer;
 } ISO97962Encoding;
 
-void iso97962_init(ISO97962Encoding *enc, uint32_t key_size_byte,
-                   mbedtls_md_type_t md, bool implicity) {
+static void iso97962_init(ISO97962Encoding *enc, uint32_t key_size_byte,
+                          mbedtls_md_type_t md, bool implicity) {
   enc->key_size = key_size_byte * 8;
   enc->md = md;
   enc->implicity = implicity;
@@ -370,25 +1328,14 @@ void iso97962_init(ISO97962Encoding *enc, uint32_t key_size_byte,
   enc->trailer = get_trailer_by_md(md);
 }
 
-int iso97962_verify(ISO97962Encoding *enc, const uint8_t *block,
-                    uint32_t block_len, const uint8_t *origin,
-                    uint32_t origin_len, uint8_t *msg, uint32_t *msg_len) {
-  int err = 0;
-  const mbedtls_md_info_t *digest = mbedtls_md_info_from_type(enc->md);
-  if (digest == NULL) {
-    return ERROR_ISO97962_INVALID_ARG6;
-  }
-  int hash_len = digest->size;
-  uint8_t hash[MBEDTLS_MD_MAX_SIZE] = {0};
-
-  int alloc_buff_size = 20 * 1024;
-  uint8_t alloc_buff[alloc_buff_size];
-  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
-
-  CHECK2(block != NULL && msg != NULL, ERROR_ISO97962_INVALID_ARG1);
-  CHECK2(*msg_len >= block_len, ERROR_ISO97962_INVALID_ARG1);
-  CHECK2(block_len == enc->key_size / 8, ERROR_ISO97962_INVALID_ARG1);
-
+/**
+ * Check the header, trailer and padding of a recovered block. On success,
+ * the recoverable message part is block[*msg_start .. *hash_off) and the hash
+ * starts at block[*hash_off].
+ */
+static int iso97962_parse(ISO97962Encoding *enc, const uint8_t *block,
+                          uint32_t block_len, int hash_len, int *msg_start,
+                          int *hash_off) {
   if (((block[0] & 0xC0) ^ 0x40) != 0) {
     return ERROR_ISO97962_INVALID_ARG2;
   }
@@ -413,7 +1360,7 @@ int iso97962_verify(ISO97962Encoding *enc, const uint8_t *block,
         }
       }
     } else {
-      // this branch can't be reached due to "if (digest == NULL)" above.
+      // this branch can't be reached due to "if (digest == NULL)" in callers.
       // but still keep it here for defensive purpose
       return ERROR_ISO97962_INVALID_ARG4;
     }
@@ -422,79 +1369,98 @@ int iso97962_verify(ISO97962Encoding *enc, const uint8_t *block,
   }
 
   // find out how much padding we've got
-  int msg_start = 0;
+  int start = 0;
 
-  for (msg_start = 0; msg_start != block_len; msg_start++) {
-    if (((block[msg_start] & 0x0f) ^ 0x0a) == 0) {
+  for (start = 0; start != block_len; start++) {
+    if (((block[start] & 0x0f) ^ 0x0a) == 0) {
       break;
     }
   }
-  msg_start++;
+  start++;
 
-  int off = block_len - delta - digest->size;
-  if ((off - msg_start) <= 0) {
+  int off = block_len - delta - hash_len;
+  if ((off - start) <= 0) {
     return ERROR_ISO97962_INVALID_ARG5;
   }
+  *msg_start = start;
+  *hash_off = off;
+  return 0;
+}
 
-  if ((block[0] & 0x20) == 0) {
-    mbedtls_md(digest, block + msg_start, off - msg_start, hash);
-
-    *msg_len = off - msg_start;
-    memcpy(msg, block + msg_start, *msg_len);
+/**
+ * Single pass verification of a recovered block, see ISO/IEC 9796-2:2010,
+ * scheme 1. With partial recovery, the hash covers m1 || m2 where m1 is the
+ * recoverable part found in the block and m2 is msg. With full recovery, it
+ * covers m1 only. The digest is streamed, m1 is never copied except into out,
+ * truncated to *out_len.
+ */
+static int iso97962_verify_recoverable(ISO97962Encoding *enc,
+                                       const uint8_t *block, uint32_t block_len,
+                                       const uint8_t *msg, size_t msg_len,
+                                       uint8_t *out, size_t *out_len) {
+  int err = 0;
+  const mbedtls_md_info_t *digest = mbedtls_md_info_from_type(enc->md);
+  if (digest == NULL) {
+    return ERROR_ISO97962_INVALID_ARG6;
+  }
+  int hash_len = digest->size;
+  uint8_t hash[MBEDTLS_MD_MAX_SIZE] = {0};
 
-    for (int i = 0; i != hash_len; i++) {
-      if (block[off + i] != hash[i]) {
-        err = ERROR_ISO97962_MISMATCH_HASH;
-        goto exit;
-      }
-    }
+  CHECK2(block != NULL && block_len == enc->key_size / 8,
+         ERROR_ISO97962_INVALID_ARG1);
 
-  } else {
-    mbedtls_md(digest, origin, origin_len, hash);
+  int msg_start = 0;
+  int off = 0;
+  err = iso97962_parse(enc, block, block_len, hash_len, &msg_start, &off);
+  if (err != 0) {
+    return err;
+  }
+  const uint8_t *m1 = block + msg_start;
+  uint32_t m1_len = off - msg_start;
 
-    *msg_len = off - msg_start;
-    memcpy(msg, block + msg_start, *msg_len);
+  MdContext ctx;
+  err = md_starts(&ctx, enc->md);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  err = md_update(&ctx, m1, m1_len);
+  CHECK2(err == 0, ERROR_MD_FAILED);
+  if ((block[0] & 0x20) != 0) {
+    err = md_update(&ctx, msg, msg_len);
+    CHECK2(err == 0, ERROR_MD_FAILED);
+  }
+  err = md_finish(&ctx, hash);
+  CHECK2(err == 0, ERROR_MD_FAILED);
 
-    for (int i = 0; i != hash_len; i++) {
-      if (block[off + i] != hash[i]) {
-        err = ERROR_ISO97962_MISMATCH_HASH;
-        goto exit;
-      }
-    }
+  if (memcmp(block + off, hash, hash_len) != 0) {
+    err = ERROR_ISO97962_MISMATCH_HASH;
+    goto exit;
   }
+
+  size_t copy_size = m1_len > *out_len ? *out_len : m1_len;
+  memcpy(out, m1, copy_size);
+  *out_len = copy_size;
+
   err = 0;
 exit:
   return err;
 }
 
-int validate_signature_iso9796_2(void *_p, const uint8_t *sig_buf,
-                                 size_t sig_len, const uint8_t *msg_buf,
-                                 size_t msg_len, uint8_t *out,
-                                 size_t *out_len) {
+static int validate_signature_iso9796_2(void *prefilled_data,
+                                        const uint8_t *sig_buf, size_t sig_len,
+                                        const uint8_t *msg_buf, size_t msg_len,
+                                        uint8_t *out, size_t *out_len) {
   int err = 0;
 
-  (void)_p;
   RsaInfo *info = (RsaInfo *)sig_buf;
-  mbedtls_rsa_context rsa;
-  mbedtls_mpi N;
-  mbedtls_mpi E;
+  RsaMontContext local;
+  const RsaMontContext *mont = NULL;
 
   if (sig_len < sizeof(RsaInfo)) {
     return ERROR_ISO97962_INVALID_ARG12;
   }
-  uint32_t key_size_byte = get_key_size(info->key_size) / 8;
+  uint32_t key_size = get_key_size(info->key_size);
+  uint32_t key_size_byte = key_size / 8;
 
-  uint8_t *sig = NULL;
   uint8_t block[key_size_byte];
-  uint8_t m1[key_size_byte];
-  uint32_t m1_len = key_size_byte;
-  uint8_t full_msg[key_size_byte * 2];
-  uint8_t new_msg[key_size_byte * 2];
-  uint32_t new_msg_len = key_size_byte;
-
-  int alloc_buff_size = 20 * 1024;
-  unsigned char alloc_buff[alloc_buff_size];
-  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
 
   CHECK2(key_size_byte > 0, ERROR_ISO97962_INVALID_ARG7);
   CHECK2(msg_buf != NULL, ERROR_ISO97962_INVALID_ARG8);
@@ -503,45 +1469,26 @@ int validate_signature_iso9796_2(void *_p, const uint8_t *sig_buf,
   CHECK2(key_size_byte > 0, ERROR_ISO97962_INVALID_ARG8);
   CHECK2(is_valid_iso97962_md_type(info->md_type), ERROR_INVALID_MD_TYPE);
 
-  mbedtls_mpi_init(&N);
-  mbedtls_mpi_init(&E);
-
-  err = mbedtls_mpi_read_binary_le(&N, (uint8_t *)info->N, key_size_byte);
-  CHECK2(err == 0, ERROR_ISO97962_INVALID_ARG9);
-  err = mbedtls_mpi_read_binary_le(&E, (uint8_t *)&info->E, 4);
-  CHECK2(err == 0, ERROR_ISO97962_INVALID_ARG10);
-
-  CHECK(check_pubkey(&N, &E));
-
-  mbedtls_rsa_init(&rsa, MBEDTLS_RSA_PKCS_V15, 0);
-  err = mbedtls_rsa_import(&rsa, &N, NULL, NULL, NULL, &E);
-  CHECK2(err == 0, ERROR_ISO97962_INVALID_ARG11);
-
-  sig = get_rsa_signature(info);
-
-  err = mbedtls_rsa_public(&rsa, sig, block);
-  CHECK2(err == 0, ERROR_ISO97962_INVALID_ARG12);
+  CHECK(check_pubkey_raw(info, key_size));
+  // same public key operation as CKB_VERIFY_RSA, no heap
+  err = rsa_get_mont(prefilled_data, info->N, key_size, &local, &mont);
+  CHECK(err);
+  err = rsa_mont_exp_public(mont, get_rsa_signature(info),
+                            get_rsa_exponent(info), block);
+  CHECK2(err == RSA_MONT_SUCCESS, ERROR_ISO97962_INVALID_ARG12);
 
   ISO97962Encoding enc = {0};
   mbedtls_md_type_t md_type = convert_md_type(info->md_type);
 
   iso97962_init(&enc, key_size_byte, md_type, false);
-  err = iso97962_verify(&enc, block, key_size_byte, msg_buf, msg_len, m1,
-                        &m1_len);
-  CHECK2(err == 0 || err == ERROR_ISO97962_MISMATCH_HASH,
+  err = iso97962_verify_recoverable(&enc, block, key_size_byte, msg_buf,
+                                    msg_len, out, out_len);
+  // malformed blocks are reported as ERROR_ISO97962_INVALID_ARG9, as before
+  CHECK2(err == 0 || err == ERROR_ISO97962_MISMATCH_HASH ||
+             err == ERROR_MD_FAILED,
          ERROR_ISO97962_INVALID_ARG9);
-
-  memcpy(full_msg, m1, m1_len);
-  memcpy(full_msg + m1_len, msg_buf, msg_len);
-
-  err = iso97962_verify(&enc, block, sizeof(block), full_msg, m1_len + msg_len,
-                        new_msg, &new_msg_len);
   CHECK(err);
 
-  uint32_t copy_size = new_msg_len > *out_len ? *out_len : new_msg_len;
-  memcpy(out, new_msg, copy_size);
-  *out = copy_size;
-
   err = 0;
 exit:
   if (err == 0) {
@@ -2,18 +2,30 @@
 #define CKB_MISCELLANEOUS_SCRIPTS_RSA_ALL_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 // used as algorithm_id, see below
 // when algorithm_id is CKB_VERIFY_RSA, use RsaInfo structure
 #define CKB_VERIFY_RSA 1
 // when algorithm_id is CKB_VERIFY_ISO9796_2, use RsaInfo structure
 #define CKB_VERIFY_ISO9796_2 2
+// when algorithm_id is CKB_VERIFY_RSA_PRECOMPUTED, use RsaSignatureOnly
+// structure, the public key comes from a RsaPrecomputedKey passed as
+// prefilled_data
+#define CKB_VERIFY_RSA_PRECOMPUTED 3
+// when algorithm_id is CKB_VERIFY_SECP256R1, use Secp256r1Info structure
+#define CKB_VERIFY_SECP256R1 4
+// when algorithm_id is CKB_VERIFY_RABIN_WILLIAMS, use RsaInfo structure with
+// E = 2, see below
+#define CKB_VERIFY_RABIN_WILLIAMS 5
 
 // used as key_size enum values: their "KeySize" are 1024, 2048, 4098 bits.
 // The term "KeySize" has same meaning below.
 #define CKB_KEYSIZE_1024 1
 #define CKB_KEYSIZE_2048 2
 #define CKB_KEYSIZE_4096 3
+// key_size of CKB_VERIFY_SECP256R1, a 256-bit curve
+#define CKB_KEYSIZE_P256 4
 
 // used as padding value
 // PKCS# 1.5
@@ -85,6 +97,93 @@ typedef struct RsaInfo {
   uint8_t sig[PLACEHOLDER_SIZE];
 } RsaInfo;
 
+/** CKB_VERIFY_RABIN_WILLIAMS: Rabin-Williams signatures in the RsaInfo layout.
+E is 2 and N = p * q with p = 3 mod 8 and q = 7 mod 8, so N = 5 mod 8. padding
+must be CKB_PKCS_15.
+
+The signer computes the EMSA-PKCS1-v1_5 encoding EM of the message hash, picks
+the tweaks e in {1, -1} and f in {1, 2} for which EM / (e * f) is a square mod
+N (exactly one pair works for such N), and signs with a square root s of it:
+EM = e * f * s^2 mod N. The tweaks aren't part of the signature, the verifier
+tries all four. s and N - s are both roots, only the smaller one is accepted.
+
+The signer must always return the same root for the same message: two
+different roots of EM reveal the factors of N.
+*/
+
+/** signature (in witness) memory layout for CKB_VERIFY_RSA_PRECOMPUTED
+-----------------------------------------------------------
+|common header| RSA Signature (KeySize/8 bytes)|
+-----------------------------------------------------------
+The common header must be the same as in the RsaPrecomputedKey, except
+algorithm_id. It's KeySize/8 + 4 bytes shorter than RsaInfo.
+*/
+typedef struct RsaSignatureOnly {
+  uint8_t algorithm_id;
+  uint8_t key_size;
+  uint8_t padding;
+  uint8_t md_type;
+  uint8_t sig[PLACEHOLDER_SIZE];
+} RsaSignatureOnly;
+
+// "RSAK"
+#define RSA_PRECOMPUTED_KEY_MAGIC 0x4b415352
+// length of RsaPrecomputedKey.key_hash, blake160
+#define RSA_KEY_HASH_SIZE 20
+
+/** public key prepared ahead of time, normally stored in a cell dep
+ * The Montgomery constants (R^2 mod N and -N^(-1) mod 2^64) are computed
+ * off-chain once. Loading them costs one Montgomery multiplication, instead of
+ * computing R^2 mod N on every verification.
+ *
+------------------------------------------------------------------------
+|magic|common header| E |key hash| mm |  N (KeySize/8) | RR (KeySize/8)|
+------------------------------------------------------------------------
+All integers are in little endian. So the total length in byte is:
+40 + KeySize/8 + KeySize/8.
+*/
+typedef struct RsaPrecomputedKey {
+  // RSA_PRECOMPUTED_KEY_MAGIC
+  uint32_t magic;
+  // same as RsaInfo, algorithm_id is CKB_VERIFY_RSA
+  uint8_t algorithm_id;
+  uint8_t key_size;
+  uint8_t padding;
+  uint8_t md_type;
+  uint32_t E;
+  // blake160(common header + E + N), same as the public key hash of RsaInfo.
+  // Checked by the library, so a lock can find the key cell by the hash in
+  // its args.
+  uint8_t key_hash[RSA_KEY_HASH_SIZE];
+  // -N^(-1) mod 2^64
+  uint64_t mm;
+  // RSA public key, part N, KeySize/8 bytes.
+  uint8_t N[PLACEHOLDER_SIZE];
+  // R^2 mod N, where R = 2^KeySize. KeySize/8 bytes.
+  uint8_t RR[PLACEHOLDER_SIZE];
+} RsaPrecomputedKey;
+
+/** signature (in witness) memory layout for CKB_VERIFY_SECP256R1
+-------------------------------------------------------------
+|common header| public key (64 bytes)| ECDSA signature (64 bytes)|
+-------------------------------------------------------------
+ECDSA over secp256r1 (NIST P-256) with SHA-256, which is ES256 of WebAuthn.
+key_size is CKB_KEYSIZE_P256, padding is 0 and md_type is CKB_MD_SHA256.
+The public key is the uncompressed point X || Y, the signature is r || s. All
+of them are 32 bytes big endian integers. So the total length in byte is:
+4 + 64 + 64.
+
+The public key hash is calculated by: blake160(common header + public key).
+*/
+typedef struct Secp256r1Info {
+  uint8_t algorithm_id;
+  uint8_t key_size;
+  uint8_t padding;
+  uint8_t md_type;
+  uint8_t pubkey[64];
+  uint8_t sig[64];
+} Secp256r1Info;
+
 /**
  * get offset of signature based on key size.
  */
@@ -102,10 +201,14 @@ uint32_t get_key_size(uint8_t key_size_enum);
 
 /**
  *
- * @param prefilled_data ignore. Not used.
+ * @param prefilled_data RsaPrecomputedKey for CKB_VERIFY_RSA_PRECOMPUTED.
+ * Otherwise NULL, or the arena initialized by load_prefilled_data to reuse the
+ * prepared public keys across calls.
  * @param signature_buffer pointer to signature buffer. It is casted to type
- * "RsaInfo*"
- * @param signature_size size of signature_buffer.
+ * "RsaInfo*", "RsaSignatureOnly*" for CKB_VERIFY_RSA_PRECOMPUTED or
+ * "Secp256r1Info*" for CKB_VERIFY_SECP256R1.
+ * @param signature_size size of signature_buffer, exactly the length of the
+ * structure for its algorithm_id and key_size.
  * @param message_buffer pointer to message buffer.
  * @param message_size size of message_buffer.
  * @param output ignore. Not used
@@ -117,11 +220,94 @@ int validate_signature(void *prefilled_data, const uint8_t *signature_buffer,
                        size_t msg_size, uint8_t *output, size_t *output_len);
 
 /**
- * Note: there is no prefilled data for RSA.
- * Always succeed.
- * @param data not used.
- * @param len not used.
- * @return always succeed.
+ * Opaque state of a streaming validation, see validate_signature_init.
+ * It's allocated by the caller, e.g. on stack.
+ */
+typedef struct ValidateSignatureContext {
+  uint64_t opaque[48];
+} ValidateSignatureContext;
+
+/**
+ * Streaming version of validate_signature: the message is passed in pieces
+ * through validate_signature_update, so it doesn't need to be assembled in
+ * one buffer. Only CKB_VERIFY_RSA is supported.
+ *
+ * @param prefilled_data NULL or the arena from load_prefilled_data, see
+ * validate_signature. It must stay valid until validate_signature_final.
+ * @param ctx context to initialize.
+ * @param signature_buffer pointer to signature buffer, see RsaInfo. It must
+ * stay valid until validate_signature_final returns.
+ * @param signature_size size of signature_buffer.
+ * @return 0 succeed; otherwise fail.
+ */
+int validate_signature_init(void *prefilled_data, ValidateSignatureContext *ctx,
+                            const uint8_t *signature_buffer,
+                            size_t signature_size);
+
+/**
+ * Feed the next piece of the message into the digest.
+ * @return 0 succeed; otherwise fail.
+ */
+int validate_signature_update(ValidateSignatureContext *ctx,
+                              const uint8_t *msg_buf, size_t msg_size);
+
+/**
+ * Finish the digest and verify the signature. The context can't be used
+ * anymore afterwards.
+ * @param output ignore. Not used
+ * @param output_len ignore. Not used.
+ * @return 0 succeed; otherwise fail.
+ */
+int validate_signature_final(ValidateSignatureContext *ctx, uint8_t *output,
+                             size_t *output_len);
+
+/**
+ * One signature of a batch, see validate_signature_batch.
+ */
+typedef struct ValidateSignatureBatchItem {
+  // RSA signature, KeySize/8 bytes, same format as in RsaInfo.
+  const uint8_t *sig;
+  const uint8_t *msg;
+  size_t msg_len;
+} ValidateSignatureBatchItem;
+
+/**
+ * Verify several signatures made with the same public key. The key is parsed,
+ * checked and prepared once for all of them. Only CKB_VERIFY_RSA is
+ * supported.
+ *
+ * @param prefilled_data NULL or the arena from load_prefilled_data, see
+ * validate_signature.
+ * @param pubkey_buf RsaInfo without the signature part: common header, E and
+ * N. It's what the public key hash is calculated on.
+ * @param pubkey_len size of pubkey_buf: 8 + KeySize/8.
+ * @param items signatures and messages to verify.
+ * @param count number of items, at least 1.
+ * @param failed_index if not NULL, index of the failed item on failure.
+ * @return 0 if all signatures are valid; otherwise fail.
+ */
+int validate_signature_batch(void *prefilled_data, const uint8_t *pubkey_buf,
+                             size_t pubkey_len,
+                             const ValidateSignatureBatchItem *items,
+                             size_t count, size_t *failed_index);
+
+/**
+ * Prepare the prefilled_data of validate_signature, in one of two ways:
+ *
+ * 1. Initialize a caller-provided arena, e.g. on stack, which then caches
+ * the prepared public keys (R^2 mod N and the Montgomery constant). A lock
+ * verifying several signatures in one run pays the preparation once per
+ * key. The arena must be 8-byte aligned and at least the size returned when
+ * data is NULL.
+ * 2. Check a RsaPrecomputedKey loaded by the caller, e.g. from a cell dep,
+ * for CKB_VERIFY_RSA_PRECOMPUTED signatures, including its key_hash. It's
+ * recognized by RSA_PRECOMPUTED_KEY_MAGIC. The key isn't modified: it's in
+ * caller memory, so validate_signature checks it again anyway.
+ *
+ * @param data arena or RsaPrecomputedKey. When NULL, only the arena size is
+ * returned in len.
+ * @param len input: size of data in bytes. output: size of the arena.
+ * @return 0 succeed; otherwise fail.
  */
 int load_prefilled_data(void *data, size_t *len);
 
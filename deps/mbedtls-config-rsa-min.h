@@ -0,0 +1,92 @@
+/**
+ * \file mbedtls-config-rsa-min.h
+ *
+ * \brief Trimmed configuration for build/validate_signature_rsa_min and the
+ *        other size-optimized variants of the RSA library.
+ *
+ *  Derived from mbedtls-config-template.h, keeping only what the library
+ *  links: RSA (PKCS#1 v1.5 and v2.1), ECDSA on secp256r1 only, bignum, SHA-1
+ *  and SHA-2 with the generic message digest layer, the static buffer
+ *  allocator and the platform glue of ckb-c-stdlib. Everything else (TLS,
+ *  X.509, ciphers, other curves, ECDH, entropy, DRBG, PK parsing, self tests)
+ *  is turned off. It's selected with
+ *  -DMBEDTLS_CONFIG_FILE, see the Makefile.
+ *
+ *  The simulator (validate_signature_rsa_sim) generates keys and still needs
+ *  the full template: entropy, CTR_DRBG, AES and GENPRIME.
+ */
+/*
+ *  Copyright The Mbed TLS Contributors
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef MBEDTLS_CONFIG_H
+#define MBEDTLS_CONFIG_H
+
+#define NULL ((void*)0)
+
+/* System support, same as mbedtls-config-template.h */
+#define MBEDTLS_PLATFORM_MEMORY
+#define MBEDTLS_PLATFORM_NO_STD_FUNCTIONS
+#define MBEDTLS_PLATFORM_EXIT_ALT
+#define MBEDTLS_PLATFORM_PRINTF_ALT
+#define MBEDTLS_PLATFORM_SNPRINTF_ALT
+#define MBEDTLS_PLATFORM_VSNPRINTF_ALT
+
+/* RSA signature schemes */
+#define MBEDTLS_PKCS1_V15
+#define MBEDTLS_PKCS1_V21
+
+/* CKB_VERIFY_SECP256R1 */
+#define MBEDTLS_ECP_DP_SECP256R1_ENABLED
+#define MBEDTLS_ECP_NIST_OPTIM
+
+/* Modules */
+/* required by MBEDTLS_ECDSA_C */
+#define MBEDTLS_ASN1_PARSE_C
+#define MBEDTLS_ASN1_WRITE_C
+#define MBEDTLS_BIGNUM_C
+#define MBEDTLS_ECDSA_C
+#define MBEDTLS_ECP_C
+#define MBEDTLS_MD_C
+#define MBEDTLS_MEMORY_BUFFER_ALLOC_C
+/* required by MBEDTLS_RSA_C, DigestInfo OIDs of PKCS#1 v1.5 */
+#define MBEDTLS_OID_C
+#define MBEDTLS_PLATFORM_C
+#define MBEDTLS_RSA_C
+#define MBEDTLS_SHA1_C
+#define MBEDTLS_SHA256_C
+#define MBEDTLS_SHA512_C
+
+/* Module configuration */
+/* public exponents have at most 32 bits, mbedtls_mpi_exp_mod never picks a
+ * window above 3 for them; a smaller table shrinks its stack frame */
+#define MBEDTLS_MPI_WINDOW_SIZE 3
+/* 4096-bit keys at most */
+#define MBEDTLS_MPI_MAX_SIZE 512
+/* P-256 is the only curve */
+#define MBEDTLS_ECP_MAX_BITS 256
+/* messages and MGF1 are hashed by c/rsa_sha2.h, mbedtls' SHA-2 is only
+ * linked for the sizes in mbedtls_md_info_t: keep the rolled loops */
+#define MBEDTLS_SHA256_SMALLER
+#define MBEDTLS_SHA512_SMALLER
+
+#if defined(MBEDTLS_USER_CONFIG_FILE)
+#include MBEDTLS_USER_CONFIG_FILE
+#endif
+
+#include "mbedtls/check_config.h"
+
+#endif /* MBEDTLS_CONFIG_H */
@@ -0,0 +1,13 @@
+/**
+ * \file visibility-hidden.h
+ *
+ * \brief Force-included (-include) in every translation unit of
+ *        build/validate_signature_rsa_prelinked, see the Makefile.
+ *
+ *  -fvisibility=hidden only applies to definitions: a declaration like
+ *  `extern const mbedtls_md_info_t mbedtls_sha256_info;` is still assumed
+ *  to be preemptible and is reached through a GOT entry, i.e. one more
+ *  relocation for ckb_dlopen2. The pragma below hides declarations too. The
+ *  entry points keep their explicit visibility("default") attribute.
+ */
+#pragma GCC visibility push(hidden)
@@ -33,5 +33,25 @@ ckb-binary-patcher -i ${BIN} -o ${BIN}
 echo "copy the binary to build folder ..."
 cp ${BIN} ./build/debug/validate-signature-rsa
 
+# The same lock linked with build/libvalidate_signature_rsa.a, built by
+# `make validate_signature_rsa_static-via-docker` at the top of the repository.
+if [ -f ../../build/libvalidate_signature_rsa.a ]; then
+  echo "cargo build the statically linked contract ..."
+  cd contracts/validate-signature-rsa
+  cargo build --target riscv64imac-unknown-none-elf --features static-link
+  cd ../../
+  ckb-binary-patcher -i ${BIN} -o ${BIN}
+  cp ${BIN} ./build/debug/validate-signature-rsa-static
+fi
+
+# The same lock reading witnesses with load_witness_args instead of
+# message.rs, for test_rsa_message_builder.
+echo "cargo build the contract with load_witness_args ..."
+cd contracts/validate-signature-rsa
+cargo build --target riscv64imac-unknown-none-elf --features load-witness-args
+cd ../../
+ckb-binary-patcher -i ${BIN} -o ${BIN}
+cp ${BIN} ./build/debug/validate-signature-rsa-load-witness-args
+
 echo "build contract done!"
 echo "trying 'cargo test -p tests' to run tests."
@@ -1,6 +1,7 @@
 pub use blake2b_rs::{Blake2b, Blake2bBuilder};
 
 use std::{
+    env,
     fs::File,
     io::{BufWriter, Read, Write},
     path::Path,
@@ -10,11 +11,24 @@ const BUF_SIZE: usize = 8 * 1024;
 const CKB_HASH_PERSONALIZATION: &[u8] = b"ckb-default-hash";
 
 fn main() {
+    // static-link: the verifier comes from `make build/libvalidate_signature_rsa.a`
+    // at the top of the repository, there is no shared library to hash.
+    if env::var_os("CARGO_FEATURE_STATIC_LINK").is_some() {
+        let manifest_dir = env::var("CARGO_MANIFEST_DIR").expect("CARGO_MANIFEST_DIR");
+        let lib_dir = Path::new(&manifest_dir).join("../../../../build");
+        println!("cargo:rustc-link-search=native={}", lib_dir.display());
+        println!("cargo:rustc-link-lib=static=validate_signature_rsa");
+        println!("cargo:rerun-if-changed={}", lib_dir.join("libvalidate_signature_rsa.a").display());
+        return;
+    }
+
     let out_path = Path::new("src").join("code_hashes.rs");
     let mut out_file = BufWriter::new(File::create(&out_path).expect("create code_hashes.rs"));
 
     let name = "SHARED_LIB";
     let path = "../../dynamic-libray/validate_signature_rsa";
+    // the hash must follow the library copied there, see size-report.sh
+    println!("cargo:rerun-if-changed={}", path);
 
     let mut buf = [0u8; BUF_SIZE];
 
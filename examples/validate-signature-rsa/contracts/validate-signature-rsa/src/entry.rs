@@ -1,4 +1,3 @@
-use alloc::vec::Vec;
 // Import from `core` instead of from `std` since we are in no-std mode
 use core::result::Result;
 
@@ -9,11 +8,18 @@ use ckb_std::ckb_types::bytes::Bytes;
 // https://nervosnetwork.github.io/ckb-std/riscv64imac-unknown-none-elf/doc/ckb_std/index.html
 use ckb_std::ckb_types::prelude::*;
 use ckb_std::debug;
+#[cfg(not(feature = "static-link"))]
 use ckb_std::dynamic_loading_c_impl;
+#[cfg(feature = "load-witness-args")]
 use ckb_std::error::SysError;
 use ckb_std::high_level::*;
 
-use crate::{code_hashes, error::Error};
+use crate::error::Error;
+#[cfg(not(feature = "load-witness-args"))]
+use crate::message::{load_witness_lock, MIN_BUFFER_SIZE};
+use crate::message::MessageBuilder;
+#[cfg(not(feature = "static-link"))]
+use crate::code_hashes;
 
 const BLAKE2B_BLOCK_SIZE: usize = 32;
 const BLAKE2B160_BLOCK_SIZE: usize = 20;
@@ -38,41 +44,80 @@ fn get_key_size(key_size_enum: u8) -> usize {
     key_size
 }
 
-fn calculate_pub_key_hash(signature: &Bytes, key_size: usize) -> Vec<u8> {
-    let mut hash: Vec<u8> = Default::default();
-    hash.resize(BLAKE2B_BLOCK_SIZE, 0);
+fn calculate_pub_key_hash(signature: &[u8], key_size: usize) -> [u8; BLAKE2B160_BLOCK_SIZE] {
+    let mut hash = [0u8; BLAKE2B_BLOCK_SIZE];
 
     let mut blake2b = new_blake2b();
-    blake2b.update(&signature.slice(4..8));
-    blake2b.update(&signature.slice(8..(8 + key_size / 8)));
-    blake2b.finalize(hash.as_mut_slice());
-    hash.truncate(BLAKE2B160_BLOCK_SIZE);
-    hash
+    blake2b.update(&signature[4..8]);
+    blake2b.update(&signature[8..(8 + key_size / 8)]);
+    blake2b.finalize(&mut hash);
+    let mut pub_key_hash = [0u8; BLAKE2B160_BLOCK_SIZE];
+    pub_key_hash.copy_from_slice(&hash[..BLAKE2B160_BLOCK_SIZE]);
+    pub_key_hash
 }
 
-
 fn calculate_rsa_info_length(key_size_enum: u8) -> usize {
     8 + get_key_size(key_size_enum) / 4
 }
 
+// RsaInfo of a 4096-bit key
+#[cfg(not(feature = "load-witness-args"))]
+const MAX_RSA_INFO_LENGTH: usize = 8 + 4096 / 4;
+// Witnesses are read through this buffer, see message.rs. A lock longer than
+// it takes one more syscall per buffer.
+const WITNESS_BUFFER_SIZE: usize = 4096;
+
+#[cfg(not(feature = "static-link"))]
 type DlContextType = dynamic_loading_c_impl::CKBDLContext<[u8; 128 * 1024]>;
+// see ValidateSignatureContext in c/validate_signature_rsa.h
+type ValidateSignatureContext = [u64; 48];
 /*
-int validate_signature(void *prefilled_data, const uint8_t *signature_buffer,
-                       size_t signature_size, const uint8_t *msg_buf,
-                       size_t msg_size, uint8_t *output, size_t *output_len);
+int validate_signature_init(void *prefilled_data, ValidateSignatureContext *ctx,
+                            const uint8_t *signature_buffer,
+                            size_t signature_size);
+int validate_signature_update(ValidateSignatureContext *ctx,
+                              const uint8_t *msg_buf, size_t msg_size);
+int validate_signature_final(ValidateSignatureContext *ctx, uint8_t *output,
+                             size_t *output_len);
 */
-type DlFnType = unsafe extern "C" fn(fill: *const u8, signature: *const u8,
-                                     signature_size: usize, msg_buf: *const u8, msg_size: usize,
-                                     output: *const u8, output_len: *const usize) -> isize;
+type DlInitFnType = unsafe extern "C" fn(fill: *const u8, ctx: *mut ValidateSignatureContext,
+                                         signature: *const u8, signature_size: usize) -> isize;
+type DlUpdateFnType = unsafe extern "C" fn(ctx: *mut ValidateSignatureContext,
+                                           msg_buf: *const u8, msg_size: usize) -> isize;
+type DlFinalFnType = unsafe extern "C" fn(ctx: *mut ValidateSignatureContext,
+                                          output: *const u8, output_len: *const usize) -> isize;
+
+// Linked from build/libvalidate_signature_rsa.a: no ELF loading, relocation
+// or 128 KB context at run time.
+#[cfg(feature = "static-link")]
+extern "C" {
+    fn validate_signature_init(fill: *const u8, ctx: *mut ValidateSignatureContext,
+                               signature: *const u8, signature_size: usize) -> isize;
+    fn validate_signature_update(ctx: *mut ValidateSignatureContext,
+                                 msg_buf: *const u8, msg_size: usize) -> isize;
+    fn validate_signature_final(ctx: *mut ValidateSignatureContext,
+                                output: *const u8, output_len: *const usize) -> isize;
+}
 
 pub fn main() -> Result<(), Error> {
-    let validate_signature_fn: dynamic_loading_c_impl::Symbol<DlFnType>;
+    #[cfg(feature = "static-link")]
+    let (init_fn, update_fn, final_fn): (DlInitFnType, DlUpdateFnType, DlFinalFnType) =
+        (validate_signature_init, validate_signature_update, validate_signature_final);
+    #[cfg(not(feature = "static-link"))]
+    let init_fn: dynamic_loading_c_impl::Symbol<DlInitFnType>;
+    #[cfg(not(feature = "static-link"))]
+    let update_fn: dynamic_loading_c_impl::Symbol<DlUpdateFnType>;
+    #[cfg(not(feature = "static-link"))]
+    let final_fn: dynamic_loading_c_impl::Symbol<DlFinalFnType>;
+    #[cfg(not(feature = "static-link"))]
     unsafe {
         let mut ctx = DlContextType::new();
         let lib = ctx
             .load(&code_hashes::CODE_HASH_SHARED_LIB)
             .expect("load shared lib");
-        validate_signature_fn = lib.get(b"validate_signature").expect("get function symbol validate_signature from dyanmic library");
+        init_fn = lib.get(b"validate_signature_init").expect("get function symbol validate_signature_init from dyanmic library");
+        update_fn = lib.get(b"validate_signature_update").expect("get function symbol validate_signature_update from dyanmic library");
+        final_fn = lib.get(b"validate_signature_final").expect("get function symbol validate_signature_final from dyanmic library");
     }
 
     let script = load_script()?;
@@ -85,6 +130,15 @@ pub fn main() -> Result<(), Error> {
 
     let tx_hash = load_tx_hash()?;
 
+    // No allocation: the lock of the first witness is copied to the stack,
+    // with its WitnessArgs header when the witness has nothing else.
+    #[cfg(not(feature = "load-witness-args"))]
+    let mut signature_buf = [0u8; MAX_RSA_INFO_LENGTH + MIN_BUFFER_SIZE];
+    #[cfg(not(feature = "load-witness-args"))]
+    let signature = load_witness_lock(&mut signature_buf, 0, Source::GroupInput)?;
+    // The previous implementation, kept to compare cycles, see
+    // test_rsa_message_builder.
+    #[cfg(feature = "load-witness-args")]
     let signature: Bytes = load_witness_args(0, Source::GroupInput)?.lock()
         .to_opt()
         .ok_or(Error::InvalidArgs1)?
@@ -116,61 +170,69 @@ pub fn main() -> Result<(), Error> {
     if signature.len() != info_len {
         return Err(Error::InvalidArgs1);
     }
-    let mut blake2b = new_blake2b();
-    // hash, step 1
-    blake2b.update(&tx_hash);
-    // hash, step 2
-    blake2b.update(&signature_len.to_le_bytes());
-    let mut index = 1;
-    loop {
-        let result = load_witness_args(index, Source::Input);
-        match result {
-            Ok(args) => {
-                let buff: Bytes = args.lock().to_opt().ok_or(Error::InvalidArgs1)?.unpack();
-                let buff_size = buff.len();
-                // hash, step 3
-                blake2b.update(&buff_size.to_le_bytes());
-                blake2b.update(&buff);
-            }
-            Err(err) if err == SysError::IndexOutOfBound => break,
-            Err(_) => {
-                debug!("load_witness_args() failed");
-                return Err(Error::SyscallError);
+    // The message is streamed into the digest selected by md_type, no
+    // intermediate blake2b hash or message buffer.
+    let dummy = [0 as u8; 4];
+    let mut sig_ctx: ValidateSignatureContext = [0; 48];
+    let ret = unsafe { init_fn(&dummy as *const u8, &mut sig_ctx as *mut ValidateSignatureContext, signature.as_ptr(), signature_len) };
+    if ret != 0 {
+        debug!("validate_signature_init() failed: {}", ret);
+        return Err(Error::ValidateSignatureError);
+    }
+    let update = |data: &[u8]| -> Result<(), Error> {
+        let ret = unsafe { update_fn(&mut sig_ctx as *mut ValidateSignatureContext, data.as_ptr(), data.len()) };
+        if ret != 0 {
+            debug!("validate_signature_update() failed: {}", ret);
+            return Err(Error::ValidateSignatureError);
+        }
+        Ok(())
+    };
+    {
+        let mut witness_buf = [0u8; WITNESS_BUFFER_SIZE];
+        let mut message = MessageBuilder::new(&mut witness_buf, update);
+        // message, step 1
+        message.update(&tx_hash[..])?;
+        // message, step 2
+        message.update(&signature_len.to_le_bytes()[..])?;
+        // message, step 3
+        #[cfg(not(feature = "load-witness-args"))]
+        message.witness_locks(1, Source::Input)?;
+        #[cfg(feature = "load-witness-args")]
+        {
+            let mut index = 1;
+            loop {
+                let result = load_witness_args(index, Source::Input);
+                match result {
+                    Ok(args) => {
+                        let buff: Bytes = args.lock().to_opt().ok_or(Error::InvalidArgs1)?.unpack();
+                        let buff_size = buff.len();
+                        message.update(&buff_size.to_le_bytes()[..])?;
+                        message.update(&buff[..])?;
+                    }
+                    Err(err) if err == SysError::IndexOutOfBound => break,
+                    Err(_) => {
+                        debug!("load_witness_args() failed");
+                        return Err(Error::SyscallError);
+                    }
+                }
+                index += 1;
             }
         }
-        index += 1;
     }
-    let mut message = [0 as u8; BLAKE2B_BLOCK_SIZE];
-    blake2b.finalize(&mut message);
 
     // dummy, not used
     let dummy_len: usize = 4;
     let dummy_output = [0 as u8; 4];
-    let dummy = [0 as u8; 4];
 
-    unsafe {
-        let rsa_info = signature.as_ptr();
-        let ret = validate_signature_fn(&dummy as *const u8, rsa_info, signature_len, &message as *const u8, BLAKE2B_BLOCK_SIZE,
-                                        &dummy_output as *const u8, &dummy_len as *const usize);
-        if ret != 0 {
-            debug!("validate_signature() failed: {}", ret);
-            return Err(Error::ValidateSignatureError);
-        }
+    let ret = unsafe { final_fn(&mut sig_ctx as *mut ValidateSignatureContext, &dummy_output as *const u8, &dummy_len as *const usize) };
+    if ret != 0 {
+        debug!("validate_signature_final() failed: {}", ret);
+        return Err(Error::ValidateSignatureError);
     }
     let pub_key_hash = calculate_pub_key_hash(&signature, key_size);
-    let args_hash: Vec<u8> = args.into();
-    if pub_key_hash.len() != args_hash.len() {
-        debug!("pub_key_hash.len() != args_hash.len() ");
+    if &pub_key_hash[..] != &args[..] {
+        debug!("pub_key_hash != args_hash ");
         return Err(Error::ArgsMismatched);
-    } else {
-        let len = pub_key_hash.len();
-        for i in 0..len {
-            if pub_key_hash[i] != args_hash[i] {
-                debug!("pub_key_hash != args_hash ");
-                return Err(Error::ArgsMismatched);
-            }
-        }
     }
     return Ok(());
 }
-
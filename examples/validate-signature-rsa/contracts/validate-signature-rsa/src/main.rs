@@ -3,6 +3,7 @@
 //! `main.rs` is used to define rust lang items and modules.
 //! See `entry.rs` for the `main` function. 
 //! See `error.rs` for the `Error` type.
+//! See `message.rs` for the zero-allocation witness reader.
 
 #![no_std]
 #![no_main]
@@ -13,6 +14,8 @@
 // define modules
 mod entry;
 mod error;
+mod message;
+#[cfg(not(feature = "static-link"))]
 mod code_hashes;
 
 use ckb_std::{
@@ -0,0 +1,190 @@
+//! Zero-allocation access to the lock field of `WitnessArgs` witnesses.
+//!
+//! `load_witness_args` copies a whole witness into a `Vec` and verifies it
+//! with molecule before its lock can be read. Here witnesses are read with
+//! partial `load_witness` syscalls into a buffer owned by the caller, usually
+//! on the stack: the first load brings the `WitnessArgs` header and, for small
+//! witnesses, the whole lock field. Longer locks are read again from their
+//! offset, one buffer at a time, and handed over chunk by chunk.
+//!
+//! The layout checks are those of `WitnessArgs::from_slice`: exactly 3
+//! fields, each of them empty (`None`) or a well-formed `Bytes`.
+
+use core::result::Result;
+
+use ckb_std::ckb_constants::Source;
+use ckb_std::debug;
+use ckb_std::error::SysError;
+use ckb_std::syscalls::load_witness;
+
+use crate::error::Error;
+
+// total size and the offsets of lock, input_type and output_type
+const WITNESS_ARGS_HEADER_SIZE: usize = 16;
+// item count of a molecule Bytes
+const BYTES_HEADER_SIZE: usize = 4;
+
+/// Smallest buffer accepted by `MessageBuilder` and `load_witness_lock`.
+pub const MIN_BUFFER_SIZE: usize = WITNESS_ARGS_HEADER_SIZE + BYTES_HEADER_SIZE;
+
+fn read_u32(data: &[u8]) -> usize {
+    u32::from_le_bytes([data[0], data[1], data[2], data[3]]) as usize
+}
+
+// Loads witness bytes from `offset` into `buf`. Returns the number of bytes
+// written and the number of bytes the witness has from `offset`.
+fn load_part(buf: &mut [u8], offset: usize, index: usize, source: Source)
+             -> Result<(usize, usize), SysError> {
+    match load_witness(buf, offset, index, source) {
+        Ok(len) => Ok((len, len)),
+        Err(SysError::LengthNotEnough(len)) => Ok((buf.len(), len)),
+        Err(err) => Err(err),
+    }
+}
+
+/// Where the content of a lock field is, as byte offsets in its witness.
+pub struct WitnessLock {
+    pub offset: usize,
+    pub len: usize,
+    // bytes of the witness already in the buffer, from offset 0
+    loaded: usize,
+}
+
+// Item count of the Bytes at `offset`, from `buf` when it was loaded.
+fn bytes_header(buf: &[u8], loaded: usize, offset: usize, index: usize,
+                source: Source) -> Result<usize, SysError> {
+    if offset + BYTES_HEADER_SIZE <= loaded {
+        return Ok(read_u32(&buf[offset..]));
+    }
+    let mut header = [0u8; BYTES_HEADER_SIZE];
+    let (len, _) = load_part(&mut header, offset, index, source)?;
+    if len < BYTES_HEADER_SIZE {
+        return Err(SysError::Encoding);
+    }
+    Ok(read_u32(&header))
+}
+
+/// Reads the head of witness `index` of `source` into `buf` and locates its
+/// lock field. `Ok(None)` when the lock is absent.
+pub fn locate_lock(buf: &mut [u8], index: usize, source: Source)
+                   -> Result<Option<WitnessLock>, SysError> {
+    assert!(buf.len() >= MIN_BUFFER_SIZE);
+    let (loaded, total) = load_part(buf, 0, index, source)?;
+    if total < WITNESS_ARGS_HEADER_SIZE || read_u32(&buf[0..]) != total {
+        return Err(SysError::Encoding);
+    }
+    let offsets = [read_u32(&buf[4..]), read_u32(&buf[8..]),
+                   read_u32(&buf[12..]), total];
+    if offsets[0] != WITNESS_ARGS_HEADER_SIZE {
+        return Err(SysError::Encoding);
+    }
+    for i in 0..3 {
+        let (start, end) = (offsets[i], offsets[i + 1]);
+        if start > end || end > total {
+            return Err(SysError::Encoding);
+        }
+        if start == end {
+            continue;
+        }
+        if end - start < BYTES_HEADER_SIZE ||
+            bytes_header(buf, loaded, start, index, source)? !=
+                end - start - BYTES_HEADER_SIZE {
+            return Err(SysError::Encoding);
+        }
+    }
+    if offsets[0] == offsets[1] {
+        return Ok(None);
+    }
+    Ok(Some(WitnessLock {
+        offset: offsets[0] + BYTES_HEADER_SIZE,
+        len: offsets[1] - offsets[0] - BYTES_HEADER_SIZE,
+        loaded,
+    }))
+}
+
+/// Calls `f` on consecutive chunks of the lock located by `locate_lock` with
+/// the same `buf`. Only the part not loaded yet costs syscalls.
+pub fn for_each_lock_chunk<F>(buf: &mut [u8], lock: &WitnessLock, index: usize,
+                              source: Source, mut f: F) -> Result<(), Error>
+    where F: FnMut(&[u8]) -> Result<(), Error> {
+    let end = lock.offset + lock.len;
+    let mut done = lock.offset;
+    if lock.loaded > lock.offset {
+        done = core::cmp::min(lock.loaded, end);
+        f(&buf[lock.offset..done])?;
+    }
+    while done < end {
+        let size = core::cmp::min(end - done, buf.len());
+        let (len, _) = load_part(&mut buf[..size], done, index, source)?;
+        if len < size {
+            return Err(Error::Encoding);
+        }
+        f(&buf[..size])?;
+        done += size;
+    }
+    Ok(())
+}
+
+/// Copies the lock of witness `index` of `source` into `buf`, which must be
+/// able to hold it. `Error::InvalidArgs1` when it is absent or too long.
+pub fn load_witness_lock<'a>(buf: &'a mut [u8], index: usize, source: Source)
+                             -> Result<&'a [u8], Error> {
+    let lock = locate_lock(buf, index, source)?.ok_or(Error::InvalidArgs1)?;
+    if lock.offset + lock.len <= lock.loaded {
+        return Ok(&buf[lock.offset..lock.offset + lock.len]);
+    }
+    if lock.len > buf.len() {
+        return Err(Error::InvalidArgs1);
+    }
+    let (len, _) = load_part(&mut buf[..lock.len], lock.offset, index, source)?;
+    if len < lock.len {
+        return Err(Error::Encoding);
+    }
+    Ok(&buf[..lock.len])
+}
+
+/// Builds the signing message without allocating: every piece is passed to
+/// `update` (e.g. validate_signature_update) as it is read, witnesses go
+/// through `buf`. A bigger buffer means fewer syscalls for long locks.
+pub struct MessageBuilder<'a, F> where F: FnMut(&[u8]) -> Result<(), Error> {
+    buf: &'a mut [u8],
+    update: F,
+}
+
+impl<'a, F> MessageBuilder<'a, F> where F: FnMut(&[u8]) -> Result<(), Error> {
+    pub fn new(buf: &'a mut [u8], update: F) -> Self {
+        assert!(buf.len() >= MIN_BUFFER_SIZE);
+        MessageBuilder { buf, update }
+    }
+
+    pub fn update(&mut self, data: &[u8]) -> Result<(), Error> {
+        (self.update)(data)
+    }
+
+    /// Appends the length of the lock of witness `index` of `source`, as a
+    /// little endian usize, then the lock itself. `Ok(false)` when there is no
+    /// such witness, `Error::InvalidArgs1` when it has no lock.
+    pub fn witness_lock(&mut self, index: usize, source: Source) -> Result<bool, Error> {
+        let lock = match locate_lock(self.buf, index, source) {
+            Ok(Some(lock)) => lock,
+            Ok(None) => return Err(Error::InvalidArgs1),
+            Err(SysError::IndexOutOfBound) => return Ok(false),
+            Err(_) => {
+                debug!("load_witness() failed");
+                return Err(Error::SyscallError);
+            }
+        };
+        (self.update)(&lock.len.to_le_bytes()[..])?;
+        for_each_lock_chunk(self.buf, &lock, index, source, &mut self.update)?;
+        Ok(true)
+    }
+
+    /// `witness_lock` on every witness of `source` from `start` on.
+    pub fn witness_locks(&mut self, start: usize, source: Source) -> Result<(), Error> {
+        let mut index = start;
+        while self.witness_lock(index, source)? {
+            index += 1;
+        }
+        Ok(())
+    }
+}
@@ -37,22 +37,24 @@ fn sign_tx(
     let tx_hash = tx.hash();
 
     let mut signed_witnesses: Vec<packed::Bytes> = Vec::new();
-    let mut blake2b = new_blake2b();
-    let mut message = [0u8; 32];
-    // hash, step 1
-    blake2b.update(&tx_hash.raw_data());
+    // The lock streams the message straight into SHA-256, see
+    // validate_signature_update: openssl hashes the same bytes.
+    let mut message: Vec<u8> = Vec::new();
+    // message, step 1
+    message.extend_from_slice(&tx_hash.raw_data());
     // digest the first witness
     let witness = WitnessArgs::default();
-    // hash, step 2
-    blake2b.update(&signature_size.to_le_bytes());
+    // message, step 2
+    message.extend_from_slice(&signature_size.to_le_bytes());
     (1..witnesses_len).for_each(|n| {
         let witness = tx.witnesses().get(n).unwrap();
-        let witness_len = witness.raw_data().len() as u64;
-        // hash, step 3
-        blake2b.update(&witness_len.to_le_bytes());
-        blake2b.update(&witness.raw_data());
+        let witness_args = WitnessArgs::from_slice(&witness.raw_data()).unwrap();
+        let lock: Bytes = witness_args.lock().to_opt().unwrap().unpack();
+        let lock_len = lock.len() as u64;
+        // message, step 3: the lock field of the other witnesses
+        message.extend_from_slice(&lock_len.to_le_bytes());
+        message.extend_from_slice(&lock);
     });
-    blake2b.finalize(&mut message);
 
     // openssl
     let mut signer = Signer::new(MessageDigest::sha256(), &private_key).unwrap();
@@ -134,18 +136,67 @@ fn test_rsa_random_1024() {
 }
 
 fn test_rsa(private_key: PKey<Private> , public_key: PKey<Public> ) {
+    let cycles = run_rsa_tx("validate-signature-rsa", true, &private_key, &public_key);
+    println!("consume cycles: {}", cycles);
+}
+
+// The same lock built with `--features static-link`, see
+// build-without-capsule.sh. Only the dynamic build needs the shared library
+// as a cell dep.
+#[test]
+#[ignore]
+fn test_rsa_static_vs_dynamic() {
+    let (private_key, public_key) = generate_random_key(1024);
+    let dynamic_cycles = run_rsa_tx("validate-signature-rsa", true, &private_key, &public_key);
+    let static_cycles = run_rsa_tx("validate-signature-rsa-static", false, &private_key, &public_key);
+    println!("dynamic linking: {} cycles", dynamic_cycles);
+    println!("static linking: {} cycles", static_cycles);
+    println!("saved by static linking: {} cycles", dynamic_cycles as i64 - static_cycles as i64);
+}
+
+// Witnesses 1.. hold locks of `lock_sizes` bytes, each with an input of the
+// same lock.
+#[test]
+fn test_rsa_random_1024_witnesses() {
+    let (private_key, public_key) = generate_random_key(1024);
+    let cycles = run_rsa_tx_with_witnesses("validate-signature-rsa", true, &private_key,
+                                           &public_key, &[0, 100, 5000]);
+    println!("consume cycles: {}", cycles);
+}
+
+// The lock reads witnesses with message.rs, without allocating. Compare it
+// with the load_witness_args loop it replaced: the same lock built with
+// `--features load-witness-args`, see build-without-capsule.sh.
+#[test]
+#[ignore]
+fn test_rsa_message_builder() {
+    let (private_key, public_key) = generate_random_key(1024);
+    let cases: [&[usize]; 4] = [&[], &[100; 4], &[4096; 4], &[32 * 1024; 4]];
+    for lock_sizes in cases.iter() {
+        let builder_cycles = run_rsa_tx_with_witnesses(
+            "validate-signature-rsa", true, &private_key, &public_key, lock_sizes);
+        let alloc_cycles = run_rsa_tx_with_witnesses(
+            "validate-signature-rsa-load-witness-args", true, &private_key, &public_key,
+            lock_sizes);
+        println!("witness locks {:?}: message builder {} cycles, load_witness_args {} cycles",
+                 lock_sizes, builder_cycles, alloc_cycles);
+    }
+}
+
+fn run_rsa_tx(contract: &str, with_shared_lib: bool, private_key: &PKey<Private>,
+              public_key: &PKey<Public>) -> u64 {
+    run_rsa_tx_with_witnesses(contract, with_shared_lib, private_key, public_key, &[])
+}
+
+fn run_rsa_tx_with_witnesses(contract: &str, with_shared_lib: bool,
+                             private_key: &PKey<Private>, public_key: &PKey<Public>,
+                             lock_sizes: &[usize]) -> u64 {
     // deploy contract
     let mut context = Context::default();
-    let contract_bin: Bytes = Loader::default().load_binary("validate-signature-rsa");
+    let contract_bin: Bytes = Loader::default().load_binary(contract);
     let out_point = context.deploy_cell(contract_bin);
 
-    let rsa_bin: Bytes = fs::read("../dynamic-libray/validate_signature_rsa")
-        .expect("load ../dynamic-libray/validate_signature_rsa")
-        .into();
-    let rsa_out_point = context.deploy_cell(rsa_bin);
-    let rsa_dep = CellDep::new_builder().out_point(rsa_out_point).build();
-
-    let (_public_key_binary, public_key_hash) = calculate_pub_key_hash(&public_key);
+    let (_public_key_binary, public_key_hash) = calculate_pub_key_hash(public_key);
     // prepare scripts
     let lock_script = context
         .build_script(&out_point, public_key_hash.into())
@@ -163,6 +214,26 @@ fn test_rsa(private_key: PKey<Private> , public_key: PKey<Public> ) {
     let input = CellInput::new_builder()
         .previous_output(input_out_point)
         .build();
+    let mut inputs = vec![input];
+    let mut witnesses = vec![WitnessArgs::default().as_bytes().pack()];
+    for &size in lock_sizes {
+        let out_point = context.create_cell(
+            CellOutput::new_builder()
+                .capacity(1000u64.pack())
+                .lock(lock_script.clone())
+                .build(),
+            Bytes::new(),
+        );
+        inputs.push(CellInput::new_builder().previous_output(out_point).build());
+        let lock: Vec<u8> = (0..size).map(|i| i as u8).collect();
+        witnesses.push(
+            WitnessArgs::new_builder()
+                .lock(Some(Bytes::from(lock)).pack())
+                .build()
+                .as_bytes()
+                .pack(),
+        );
+    }
     let outputs = vec![
         CellOutput::new_builder()
             .capacity(500u64.pack())
@@ -177,20 +248,26 @@ fn test_rsa(private_key: PKey<Private> , public_key: PKey<Public> ) {
     let outputs_data = vec![Bytes::new(); 2];
 
     // build transaction
-    let tx = TransactionBuilder::default()
-        .input(input)
+    let mut builder = TransactionBuilder::default()
+        .inputs(inputs)
         .outputs(outputs)
+        .witnesses(witnesses)
         .outputs_data(outputs_data.pack())
-        .cell_dep(lock_script_dep)
-        .cell_dep(rsa_dep)
-        .build();
-    let tx = context.complete_tx(tx);
+        .cell_dep(lock_script_dep);
+    if with_shared_lib {
+        let rsa_bin: Bytes = fs::read("../dynamic-libray/validate_signature_rsa")
+            .expect("load ../dynamic-libray/validate_signature_rsa")
+            .into();
+        let rsa_out_point = context.deploy_cell(rsa_bin);
+        let rsa_dep = CellDep::new_builder().out_point(rsa_out_point).build();
+        builder = builder.cell_dep(rsa_dep);
+    }
+    let tx = context.complete_tx(builder.build());
 
     // sign
-    let tx = sign_tx(tx, &private_key, &public_key);
+    let tx = sign_tx(tx, private_key, public_key);
 
     // run
-    let cycles = context
-        .verify_tx(&tx, MAX_CYCLES).expect("pass verification");
-    println!("consume cycles: {}", cycles);
+    context
+        .verify_tx(&tx, MAX_CYCLES).expect("pass verification")
 }
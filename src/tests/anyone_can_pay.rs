@@ -162,6 +162,48 @@ fn test_split_cell() {
     );
 }
 
+#[test]
+fn test_split_cell_insufficient_pay() {
+    let mut data_loader = DummyDataLoader::new();
+    let privkey = Generator::random_privkey();
+    let pubkey = privkey.pubkey().expect("pubkey");
+    let pubkey_hash = blake160(&pubkey.serialize());
+
+    let script = build_anyone_can_pay_script(pubkey_hash.to_owned());
+    let tx = gen_tx(&mut data_loader, pubkey_hash.to_owned());
+    let output = tx.outputs().get(0).unwrap();
+    // the second output fails the amount check before it's seen as a duplicate
+    let tx = tx
+        .as_advanced_builder()
+        .set_witnesses(Vec::new())
+        .set_outputs(vec![
+            output
+                .clone()
+                .as_builder()
+                .lock(script.clone())
+                .capacity(44u64.pack())
+                .build(),
+            output
+                .as_builder()
+                .lock(script)
+                .capacity(41u64.pack())
+                .build(),
+        ])
+        .set_outputs_data(vec![
+            Bytes::from(Vec::new()).pack(),
+            Bytes::from(Vec::new()).pack(),
+        ])
+        .build();
+
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    let verifier = TransactionScriptsVerifier::new(&resolved_tx, &data_loader);
+    let verify_result = verifier.verify(MAX_CYCLES);
+    assert_error_eq!(
+        verify_result.unwrap_err(),
+        ScriptError::ValidationFailure(ERROR_OUTPUT_AMOUNT_NOT_ENOUGH),
+    );
+}
+
 #[test]
 fn test_merge_cell() {
     let mut data_loader = DummyDataLoader::new();
@@ -0,0 +1,608 @@
+//! Guided search for the anyone-can-pay transactions which cost the most
+//! cycles.
+//!
+//! A transaction is described by a `Shape`: how the lock is unlocked, the
+//! number of wallets in the group, the type hashes of their UDTs, cells of
+//! other locks among the outputs, witness sizes and the cell deps placed
+//! before the secp256k1 data. `run_shape` builds a valid transaction of that
+//! shape and returns the cycles reported by `TransactionScriptsVerifier`.
+//!
+//! `test_acp_cycle_explorer` hill-climbs from the smallest shape of every
+//! unlock mode: each step changes one parameter and keeps the new shape when
+//! it costs at least as many cycles. It prints every step and the worst shapes
+//! as lines of `fixtures/acp_worst_cases.txt`:
+//!
+//! ```text
+//! ACP_EXPLORE_STEPS=200 cargo test --release acp_cycle_explorer -- --ignored --nocapture
+//! ```
+//!
+//! `ACP_EXPLORE_SEED` replays a search, `ACP_EXPLORE_FIXTURES=<file>` appends
+//! the worst shapes to a file. `test_acp_worst_case_fixtures` runs the shapes
+//! of `fixtures/acp_worst_cases.txt`: they must pass and stay within 5% of the
+//! `cycles=` of their line, a line without it fails. Record the cycles of every
+//! line, after adding one or after a change which is meant to move them, with:
+//!
+//! ```text
+//! ACP_RECORD_FIXTURES=1 cargo test --release acp_worst_case_fixtures
+//! ```
+
+use super::{
+    blake160, build_resolved_tx, gen_tx_with_grouped_args, sign_tx, DummyDataLoader,
+    ALWAYS_SUCCESS, ANYONE_CAN_PAY, MAX_CYCLES,
+};
+use ckb_crypto::secp::Generator;
+use ckb_script::TransactionScriptsVerifier;
+use ckb_types::{
+    bytes::Bytes,
+    core::{Capacity, Cycle, DepType, ScriptHashType, TransactionView},
+    packed::{CellDep, CellOutput, OutPoint, Script, WitnessArgsBuilder},
+    prelude::*,
+};
+use lazy_static::lazy_static;
+use rand::{rngs::SmallRng, thread_rng, Rng, SeedableRng};
+use std::collections::HashMap;
+use std::env;
+use std::fs::{self, OpenOptions};
+use std::io::Write;
+use std::sync::Mutex;
+
+const DEFAULT_STEPS: usize = 16;
+// the lock fails with ERROR_TOO_MUCH_TYPE_HASH_INPUTS from 256 wallets
+const MAX_INPUTS: usize = 255;
+const MAX_FOREIGN_OUTPUTS: usize = 256;
+// the first witness is loaded in a 32 KB buffer (MAX_WITNESS_SIZE), keep
+// room for the WitnessArgs header and the signature
+const MAX_WITNESS_EXTRA: usize = 32 * 1024 - 128;
+const MAX_DUMMY_DEPS: usize = 256;
+// how many leading bytes the UDT type hashes share, every byte costs 256
+// times more script hashes to generate
+const MAX_TYPE_HASH_PREFIX: usize = 2;
+// allowed growth over the cycles recorded in a fixture
+const FIXTURE_TOLERANCE_PERCENT: u64 = 5;
+
+lazy_static! {
+    // (prefix length, wallet index) => UDT type script
+    static ref UDT_SCRIPTS: Mutex<HashMap<(usize, usize), Script>> = Mutex::new(HashMap::new());
+}
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Unlock {
+    Payment,
+    Signature,
+}
+
+#[derive(Clone, Debug, PartialEq)]
+pub struct Shape {
+    pub unlock: Unlock,
+    // wallets in the lock group, one output pays each of them
+    inputs: usize,
+    // the first wallet holds CKB only, the others a UDT each
+    ckb_only: bool,
+    type_hash_prefix: usize,
+    // outputs locked by another script, skipped by check_payment_unlock
+    foreign_outputs: usize,
+    // bytes in the extra field of every witness of the group
+    witness_extra: usize,
+    // cell deps in front of the secp256k1 data, see
+    // ckb_secp256k1_custom_verify_only_initialize
+    dummy_deps: usize,
+    // pairing hints in the first witness of a payment, see check_payment_hints
+    hints: bool,
+    // the hint of the last wallet points to a foreign output (or past the
+    // outputs): the hints fail after checking every other wallet, then the
+    // outputs are scanned
+    last_hint_wrong: bool,
+}
+
+impl Shape {
+    fn smallest(unlock: Unlock) -> Self {
+        Shape {
+            unlock,
+            inputs: 1,
+            ckb_only: false,
+            type_hash_prefix: 0,
+            foreign_outputs: 0,
+            witness_extra: 0,
+            dummy_deps: 0,
+            hints: false,
+            last_hint_wrong: false,
+        }
+    }
+
+    pub fn to_line(&self, cycles: Option<Cycle>) -> String {
+        let mut line = format!(
+            "unlock={} inputs={} ckb_only={} type_hash_prefix={} foreign_outputs={} \
+             witness_extra={} dummy_deps={} hints={} last_hint_wrong={}",
+            match self.unlock {
+                Unlock::Payment => "payment",
+                Unlock::Signature => "signature",
+            },
+            self.inputs,
+            self.ckb_only as u8,
+            self.type_hash_prefix,
+            self.foreign_outputs,
+            self.witness_extra,
+            self.dummy_deps,
+            self.hints as u8,
+            self.last_hint_wrong as u8
+        );
+        if let Some(cycles) = cycles {
+            line.push_str(&format!(" cycles={}", cycles));
+        }
+        line
+    }
+
+    pub fn from_line(line: &str) -> (Self, Option<Cycle>) {
+        let mut shape = Shape::smallest(Unlock::Payment);
+        let mut cycles = None;
+        for field in line.split_whitespace() {
+            let mut kv = field.splitn(2, '=');
+            let key = kv.next().unwrap();
+            let value = kv.next().expect(line);
+            let number = || value.parse::<usize>().expect(line);
+            match key {
+                "unlock" => {
+                    shape.unlock = match value {
+                        "payment" => Unlock::Payment,
+                        "signature" => Unlock::Signature,
+                        _ => panic!("unknown unlock in {}", line),
+                    }
+                }
+                "inputs" => shape.inputs = number(),
+                "ckb_only" => shape.ckb_only = number() != 0,
+                "type_hash_prefix" => shape.type_hash_prefix = number(),
+                "foreign_outputs" => shape.foreign_outputs = number(),
+                "witness_extra" => shape.witness_extra = number(),
+                "dummy_deps" => shape.dummy_deps = number(),
+                "hints" => shape.hints = number() != 0,
+                "last_hint_wrong" => shape.last_hint_wrong = number() != 0,
+                "cycles" => cycles = Some(value.parse().expect(line)),
+                _ => panic!("unknown field {} in {}", key, line),
+            }
+        }
+        (shape, cycles)
+    }
+}
+
+// Doubles or halves a count, or moves it by one, within [min, max].
+fn mutate_count<R: Rng>(rng: &mut R, value: usize, min: usize, max: usize) -> usize {
+    let next = match rng.gen_range(0, 4) {
+        0 => value.saturating_mul(2).max(value + 1),
+        1 => value / 2,
+        2 => value + 1,
+        _ => value.saturating_sub(1),
+    };
+    next.max(min).min(max)
+}
+
+fn mutate<R: Rng>(rng: &mut R, shape: &Shape) -> Shape {
+    let mut next = shape.clone();
+    match rng.gen_range(0, 8) {
+        0 => next.inputs = mutate_count(rng, shape.inputs, 1, MAX_INPUTS),
+        1 => next.ckb_only = !shape.ckb_only,
+        2 => {
+            next.type_hash_prefix =
+                mutate_count(rng, shape.type_hash_prefix, 0, MAX_TYPE_HASH_PREFIX)
+        }
+        3 => {
+            next.foreign_outputs = mutate_count(rng, shape.foreign_outputs, 0, MAX_FOREIGN_OUTPUTS)
+        }
+        4 => {
+            let step = rng.gen_range(1, 1024);
+            next.witness_extra = if rng.gen_bool(0.5) {
+                shape.witness_extra.saturating_mul(2).max(step)
+            } else {
+                shape.witness_extra.saturating_sub(step)
+            }
+            .min(MAX_WITNESS_EXTRA)
+        }
+        5 => next.dummy_deps = mutate_count(rng, shape.dummy_deps, 0, MAX_DUMMY_DEPS),
+        6 => next.hints = !shape.hints,
+        _ => next.last_hint_wrong = !shape.last_hint_wrong,
+    }
+    next
+}
+
+// UDT type script of wallet `index`. With a prefix, the script args are
+// searched until its hash starts like the hash of wallet 0, which makes the
+// type hash comparisons of check_payment_unlock read more bytes.
+fn udt_script(prefix: usize, index: usize) -> Script {
+    if let Some(script) = UDT_SCRIPTS.lock().unwrap().get(&(prefix, index)) {
+        return script.clone();
+    }
+    let data_hash = CellOutput::calc_data_hash(&ALWAYS_SUCCESS);
+    let build = |nonce: u32| {
+        let mut args = (index as u32).to_le_bytes().to_vec();
+        args.extend_from_slice(&nonce.to_le_bytes());
+        Script::new_builder()
+            .code_hash(data_hash.clone())
+            .hash_type(ScriptHashType::Data.into())
+            .args(Bytes::from(args).pack())
+            .build()
+    };
+    let script = if prefix == 0 || index == 0 {
+        build(0)
+    } else {
+        let target = udt_script(prefix, 0).calc_script_hash();
+        (0..)
+            .map(build)
+            .find(|script| {
+                script.calc_script_hash().as_slice()[..prefix] == target.as_slice()[..prefix]
+            })
+            .unwrap()
+    };
+    UDT_SCRIPTS
+        .lock()
+        .unwrap()
+        .insert((prefix, index), script.clone());
+    script
+}
+
+// Molecule BytesOpt: nothing for None, the item count and the bytes for Some.
+fn bytes_opt(data: Option<&[u8]>) -> Vec<u8> {
+    data.map(|data| {
+        let mut field = (data.len() as u32).to_le_bytes().to_vec();
+        field.extend_from_slice(data);
+        field
+    })
+    .unwrap_or_default()
+}
+
+/// A WitnessArgs without lock, with pairing hints (the output index of every
+/// wallet, as a little-endian u16) in input_type and `extra` zeros in
+/// output_type. Serialized by hand as a molecule table, to match the layout
+/// c/blockchain.mol gives anyone_can_pay.
+pub fn hint_witness(hints: &[usize], extra: usize) -> Bytes {
+    let hints: Vec<u8> = hints
+        .iter()
+        .flat_map(|hint| (*hint as u16).to_le_bytes().to_vec())
+        .collect();
+    let fields = [
+        bytes_opt(None),
+        bytes_opt(Some(&hints)),
+        bytes_opt(if extra > 0 {
+            Some(&vec![0u8; extra][..])
+        } else {
+            None
+        }),
+    ];
+    let mut offset = 16;
+    let mut header = Vec::new();
+    for field in fields.iter() {
+        header.extend_from_slice(&(offset as u32).to_le_bytes());
+        offset += field.len();
+    }
+    let mut witness = (offset as u32).to_le_bytes().to_vec();
+    witness.extend(header);
+    for field in fields.iter() {
+        witness.extend_from_slice(field);
+    }
+    Bytes::from(witness)
+}
+
+fn wallet_cell(template: &CellOutput, lock: Script, type_: Option<Script>) -> (CellOutput, Bytes) {
+    let builder = template
+        .clone()
+        .as_builder()
+        .lock(lock)
+        .capacity(Capacity::shannons(1_000).pack());
+    match type_ {
+        Some(type_) => (
+            builder.type_(Some(type_).pack()).build(),
+            Bytes::from(1_000u128.to_le_bytes().to_vec()),
+        ),
+        None => (builder.type_(None::<Script>.pack()).build(), Bytes::new()),
+    }
+}
+
+/// Builds a transaction of `shape` which passes, with the cells it needs.
+/// The anyone-can-pay lock group is the one of input 0.
+pub fn build_shape_tx(shape: &Shape, seed: u64) -> (DummyDataLoader, TransactionView) {
+    let mut rng = SmallRng::seed_from_u64(seed);
+    let mut generator = Generator::non_crypto_safe_prng(seed);
+    let privkey = generator.gen_privkey();
+    let pubkey = privkey.pubkey().expect("pubkey");
+    let args = blake160(&pubkey.serialize());
+    let data_hash = CellOutput::calc_data_hash(&ANYONE_CAN_PAY);
+    let script = Script::new_builder()
+        .args(args.pack())
+        .code_hash(data_hash)
+        .hash_type(ScriptHashType::Data.into())
+        .build();
+
+    let mut data_loader = DummyDataLoader::new();
+    let tx = gen_tx_with_grouped_args(&mut data_loader, vec![(args, shape.inputs)], &mut rng);
+    let template = tx.outputs().get(0).unwrap();
+
+    // every wallet is paid back exactly what it holds
+    let types: Vec<Option<Script>> = (0..shape.inputs)
+        .map(|i| {
+            if shape.ckb_only && i == 0 {
+                None
+            } else {
+                Some(udt_script(shape.type_hash_prefix, i))
+            }
+        })
+        .collect();
+    for (input, type_) in tx.inputs().into_iter().zip(types.iter()) {
+        let cell = wallet_cell(&template, script.clone(), type_.clone());
+        data_loader.cells.insert(input.previous_output(), cell);
+    }
+    let mut outputs: Vec<(CellOutput, Bytes)> = types
+        .iter()
+        .map(|type_| wallet_cell(&template, script.clone(), type_.clone()))
+        .collect();
+    outputs.extend((0..shape.foreign_outputs).map(|_| (template.clone(), Bytes::new())));
+    let (outputs, outputs_data): (Vec<_>, Vec<_>) = outputs
+        .into_iter()
+        .map(|(output, data)| (output, data.pack()))
+        .unzip();
+
+    let witnesses: Vec<_> = (0..shape.inputs)
+        .map(|i| {
+            if i == 0 && shape.hints && shape.unlock == Unlock::Payment {
+                // wallet i is paid by output i, the first foreign output
+                // follows the wallets
+                let mut hints: Vec<usize> = (0..shape.inputs).collect();
+                if shape.last_hint_wrong {
+                    hints[shape.inputs - 1] = shape.inputs;
+                }
+                return hint_witness(&hints, shape.witness_extra).pack();
+            }
+            WitnessArgsBuilder::default()
+                .extra(Bytes::from(vec![0u8; shape.witness_extra]).pack())
+                .build()
+                .as_bytes()
+                .pack()
+        })
+        .collect();
+
+    // the secp256k1 data is the last dep of gen_tx_with_grouped_args
+    let mut cell_deps: Vec<CellDep> = (0..shape.dummy_deps)
+        .map(|_| {
+            let mut tx_hash = [0u8; 32];
+            rng.fill(&mut tx_hash);
+            let out_point = OutPoint::new(tx_hash.pack(), 0);
+            data_loader.cells.insert(
+                out_point.clone(),
+                (template.clone(), Bytes::from(vec![0u8; 32])),
+            );
+            CellDep::new_builder()
+                .out_point(out_point)
+                .dep_type(DepType::Code.into())
+                .build()
+        })
+        .collect();
+    cell_deps.extend(tx.cell_deps().into_iter());
+
+    let tx = tx
+        .as_advanced_builder()
+        .set_outputs(outputs)
+        .set_outputs_data(outputs_data)
+        .set_witnesses(witnesses)
+        .set_cell_deps(cell_deps)
+        .build();
+    let tx = match shape.unlock {
+        Unlock::Payment => tx,
+        Unlock::Signature => sign_tx(tx, &privkey),
+    };
+    (data_loader, tx)
+}
+
+/// Replaces the anyone-can-pay binary of a transaction from `build_shape_tx`
+/// with `binary`: its dep cell and the code hash of every wallet lock. Only
+/// valid for payments, a signature covers the old locks.
+fn replace_lock_binary(
+    data_loader: &mut DummyDataLoader,
+    tx: &TransactionView,
+    binary: &Bytes,
+) -> TransactionView {
+    let old_hash = CellOutput::calc_data_hash(&ANYONE_CAN_PAY);
+    let new_hash = CellOutput::calc_data_hash(binary);
+    let replace = |output: CellOutput| {
+        let lock = output.lock();
+        if lock.code_hash() != old_hash {
+            return output;
+        }
+        let lock = lock.as_builder().code_hash(new_hash.clone()).build();
+        output.as_builder().lock(lock).build()
+    };
+    for (output, data) in data_loader.cells.values_mut() {
+        if data[..] == ANYONE_CAN_PAY[..] {
+            *output = output
+                .clone()
+                .as_builder()
+                .capacity(Capacity::bytes(binary.len()).unwrap().pack())
+                .build();
+            *data = binary.clone();
+        } else {
+            *output = replace(output.clone());
+        }
+    }
+    let outputs: Vec<CellOutput> = tx.outputs().into_iter().map(replace).collect();
+    tx.as_advanced_builder().set_outputs(outputs).build()
+}
+
+/// Builds a transaction of `shape`, verifies it and returns its cycles.
+fn run_shape(shape: &Shape, seed: u64) -> Result<Cycle, String> {
+    run_shape_with(shape, seed, None)
+}
+
+/// Like `run_shape`, with `binary` in place of the anyone-can-pay build of
+/// the tree when given.
+fn run_shape_with(shape: &Shape, seed: u64, binary: Option<&Bytes>) -> Result<Cycle, String> {
+    let (mut data_loader, tx) = build_shape_tx(shape, seed);
+    let tx = match binary {
+        Some(binary) => replace_lock_binary(&mut data_loader, &tx, binary),
+        None => tx,
+    };
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    TransactionScriptsVerifier::new(&resolved_tx, &data_loader)
+        .verify(MAX_CYCLES)
+        .map_err(|err| format!("{}: {}", shape.to_line(None), err))
+}
+
+fn explore(unlock: Unlock, seed: u64, steps: usize) -> (Shape, Cycle) {
+    let mut rng = SmallRng::seed_from_u64(seed);
+    let mut best = Shape::smallest(unlock);
+    let mut best_cycles = run_shape(&best, seed).expect("smallest shape");
+    println!("step 0: {}", best.to_line(Some(best_cycles)));
+    for step in 1..=steps {
+        let next = mutate(&mut rng, &best);
+        if next == best {
+            continue;
+        }
+        let cycles = run_shape(&next, seed.wrapping_add(step as u64)).expect("valid shape");
+        if cycles >= best_cycles {
+            best = next;
+            best_cycles = cycles;
+            println!("step {}: {}", step, best.to_line(Some(best_cycles)));
+        }
+    }
+    (best, best_cycles)
+}
+
+#[test]
+#[ignore]
+fn test_acp_cycle_explorer() {
+    let steps: usize = env::var("ACP_EXPLORE_STEPS")
+        .map(|steps| steps.parse().expect("ACP_EXPLORE_STEPS"))
+        .unwrap_or(DEFAULT_STEPS);
+    let seed: u64 = env::var("ACP_EXPLORE_SEED")
+        .map(|seed| seed.parse().expect("ACP_EXPLORE_SEED"))
+        .unwrap_or_else(|_| thread_rng().gen());
+    println!("seed {}", seed);
+    let worst: Vec<String> = [Unlock::Payment, Unlock::Signature]
+        .iter()
+        .map(|unlock| {
+            let (shape, cycles) = explore(*unlock, seed, steps);
+            shape.to_line(Some(cycles))
+        })
+        .collect();
+    println!("worst cases:");
+    for line in &worst {
+        println!("{}", line);
+    }
+    if let Ok(path) = env::var("ACP_EXPLORE_FIXTURES") {
+        let mut file = OpenOptions::new()
+            .create(true)
+            .append(true)
+            .open(&path)
+            .expect("ACP_EXPLORE_FIXTURES");
+        for line in &worst {
+            writeln!(file, "{}", line).expect("write fixture");
+        }
+    }
+}
+
+#[test]
+fn test_acp_payment_hints() {
+    for inputs in &[2, 16, 64] {
+        let mut shape = Shape::smallest(Unlock::Payment);
+        shape.inputs = *inputs;
+        shape.foreign_outputs = 16;
+        let scan = run_shape(&shape, 0).expect("payment without hints");
+        shape.hints = true;
+        let hinted = run_shape(&shape, 0).expect("payment with hints");
+        shape.last_hint_wrong = true;
+        let late_failing = run_shape(&shape, 0).expect("payment with a wrong last hint");
+        println!(
+            "{} wallets: {} cycles, {} with hints, {} with a wrong last hint",
+            inputs, scan, hinted, late_failing
+        );
+        assert!(hinted < scan, "{}", shape.to_line(Some(hinted)));
+        // the cost of wrong hints: a hinted pass and the scan
+        assert!(late_failing > scan, "{}", shape.to_line(Some(late_failing)));
+    }
+}
+
+// A single wallet is paired without the wallet table of
+// check_payment_wallets. `ACP_BASELINE_BINARY=<file>` names a build of
+// anyone_can_pay from before that change, the 1-in/1-out payment is then run
+// with both binaries to measure what it saves:
+//
+// ACP_BASELINE_BINARY=/tmp/anyone_can_pay.base cargo test --release \
+//     acp_single_wallet_payment -- --nocapture
+#[test]
+fn test_acp_single_wallet_payment() {
+    let mut shape = Shape::smallest(Unlock::Payment);
+    let single = run_shape(&shape, 0).expect("single wallet payment");
+    if let Ok(path) = env::var("ACP_BASELINE_BINARY") {
+        let baseline = Bytes::from(fs::read(&path).expect(&path));
+        let before = run_shape_with(&shape, 0, Some(&baseline)).expect("baseline payment");
+        println!(
+            "1 wallet: {} cycles with {}, {} cycles with build/anyone_can_pay",
+            before, path, single
+        );
+    }
+    shape.inputs = 2;
+    let table = run_shape(&shape, 0).expect("two wallets payment");
+    println!("1 wallet: {} cycles, 2 wallets: {} cycles", single, table);
+    assert!(single < table, "{}", shape.to_line(Some(table)));
+}
+
+#[test]
+fn test_acp_wrong_payment_hints() {
+    let mut shape = Shape::smallest(Unlock::Payment);
+    shape.inputs = 4;
+    let (data_loader, tx) = build_shape_tx(&shape, 0);
+    let verify = |hints: &[usize]| {
+        let mut witnesses: Vec<_> = tx.witnesses().into_iter().collect();
+        witnesses[0] = hint_witness(hints, 0).pack();
+        let tx = tx.as_advanced_builder().set_witnesses(witnesses).build();
+        let resolved_tx = build_resolved_tx(&data_loader, &tx);
+        TransactionScriptsVerifier::new(&resolved_tx, &data_loader).verify(MAX_CYCLES)
+    };
+    // the hints are only a shortcut: when they don't prove the pairing, the
+    // outputs are paired by scanning them
+    for hints in &[
+        vec![1, 0, 2, 3],
+        vec![0, 0, 2, 3],
+        vec![0, 1, 2],
+        vec![0, 1, 2, 3, 4],
+        vec![0, 1, 2, 1000],
+    ] {
+        verify(hints).expect("wrong hints fall back to the scan");
+    }
+}
+
+#[test]
+fn test_acp_worst_case_fixtures() {
+    let fixtures = include_str!("fixtures/acp_worst_cases.txt");
+    let record = env::var("ACP_RECORD_FIXTURES").is_ok();
+    let mut recorded_lines = Vec::new();
+    for line in fixtures.lines() {
+        let line = line.trim();
+        if line.is_empty() || line.starts_with('#') {
+            recorded_lines.push(line.to_string());
+            continue;
+        }
+        let (shape, recorded) = Shape::from_line(line);
+        let cycles = run_shape(&shape, 0).expect("fixture passes");
+        println!("{} => {} cycles", line, cycles);
+        recorded_lines.push(shape.to_line(Some(cycles)));
+        if record {
+            continue;
+        }
+        let recorded = recorded.unwrap_or_else(|| {
+            panic!(
+                "{}: no cycles=, record them with ACP_RECORD_FIXTURES=1",
+                line
+            )
+        });
+        assert!(
+            cycles <= recorded + recorded * FIXTURE_TOLERANCE_PERCENT / 100,
+            "{}: {} cycles",
+            line,
+            cycles
+        );
+    }
+    if record {
+        let path = concat!(
+            env!("CARGO_MANIFEST_DIR"),
+            "/src/tests/fixtures/acp_worst_cases.txt"
+        );
+        recorded_lines.push(String::new());
+        fs::write(path, recorded_lines.join("\n")).expect("write fixtures");
+    }
+}
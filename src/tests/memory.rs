@@ -0,0 +1,116 @@
+//! Memory high-water marks of anyone_can_pay in CKB-VM.
+//!
+//! A script gets `RISCV_MAX_MEMORY` (4 MB): the ELF image from the bottom, .bss
+//! included, and the stack from the top down. The scripts of this repository
+//! don't allocate from a heap (the mbedtls heap of the RSA library is an arena
+//! on the stack), so a run fits as long as the lowest stack pointer stays above
+//! the end of the image. anyone_can_pay keeps its buffers on the stack: the script and
+//! the first witness (32 KB each), the hint tables (check_payment_hints) and the
+//! wallet table (check_payment_wallets) of the payment unlock, the temporary
+//! witness buffer (32 KB) and the secp256k1 data (about 1 MB) of the signature
+//! unlock.
+//!
+//! `test_acp_memory_high_water` runs a small shape of both unlock modes and
+//! every shape of fixtures/acp_worst_cases.txt with `step_script`
+//! (profile.rs), tracking the lowest sp. It fails when a run takes more stack
+//! than the budget of its unlock mode, and prints the image end, the stack
+//! peak and the memory left for every shape:
+//!
+//! ```text
+//! cargo test --release acp_memory -- --nocapture
+//! ```
+//!
+//! Only anyone_can_pay is measured at run time. simple_udt keeps nothing larger
+//! than its script (32 KB) on the stack, and the RSA example lock is built
+//! outside this crate: for both, `make stack-usage-report` lists the frame sizes
+//! gcc computed for every function of anyone_can_pay and of the RSA library
+//! (-fstack-usage), but there's no threshold checked.
+
+use super::cycle_explorer::{build_shape_tx, Shape, Unlock};
+use super::profile::{read_le, step_script};
+use super::{build_resolved_tx, ANYONE_CAN_PAY};
+use ckb_vm::{registers::SP, CoreMachine, Register, RISCV_MAX_MEMORY};
+
+const PT_LOAD: u64 = 1;
+
+// MAX_WITNESS_SIZE and SCRIPT_SIZE of anyone_can_pay.c
+const WITNESS_SIZE: u64 = 32 * 1024;
+const SCRIPT_SIZE: u64 = 32 * 1024;
+// check_payment_wallets: MAX_TYPE_HASH entries of InputWallet (80 bytes)
+const WALLET_TABLE_SIZE: u64 = 256 * 80;
+// check_payment_hints: hinted (MAX_HINTED_OUTPUT bits), the type hashes of
+// MAX_TYPE_HASH inputs and TYPE_SLOTS bytes
+const HINT_TABLES_SIZE: u64 = 65536 / 8 + 256 * 32 + 512;
+// main, check_payment_unlock, check_output_wallets and the syscall wrappers,
+// a few hundred bytes each
+const OTHER_FRAMES_SIZE: u64 = 16 * 1024;
+// The first witness (main) and the script (read_args, which gcc may inline
+// into main), then either table: check_payment_hints returns before
+// check_payment_wallets is called.
+const PAYMENT_STACK_BUDGET: u64 =
+    WITNESS_SIZE + SCRIPT_SIZE + WALLET_TABLE_SIZE + OTHER_FRAMES_SIZE;
+// The first witness, the temporary witness buffer and the secp256k1 data
+// (CKB_SECP256K1_DATA_SIZE) with the context parsed from it.
+const SIGNATURE_STACK_BUDGET: u64 = 1280 * 1024;
+
+const SMALL_SHAPES: [&str; 2] = ["unlock=payment inputs=1", "unlock=signature inputs=1"];
+
+/// End of the highest loadable segment of an ELF file, .bss included.
+pub fn image_end(elf: &[u8]) -> u64 {
+    let phoff = read_le(elf, 0x20, 8) as usize;
+    let phentsize = read_le(elf, 0x36, 2) as usize;
+    let phnum = read_le(elf, 0x38, 2) as usize;
+    (0..phnum)
+        .map(|i| &elf[phoff + i * phentsize..phoff + (i + 1) * phentsize])
+        .filter(|ph| read_le(ph, 0, 4) == PT_LOAD)
+        .map(|ph| read_le(ph, 0x10, 8) + read_le(ph, 0x28, 8))
+        .max()
+        .expect("loadable segment")
+}
+
+/// Bytes between the top of the VM memory and the lowest sp of a run of the
+/// anyone_can_pay group of `shape`.
+fn stack_peak(shape: &Shape) -> u64 {
+    let (data_loader, tx) = build_shape_tx(shape, 0);
+    let rtx = build_resolved_tx(&data_loader, &tx);
+    let script = rtx.resolved_inputs[0].cell_output.lock();
+    let mut lowest = RISCV_MAX_MEMORY as u64;
+    let (exit_code, _) = step_script(&rtx, script, &ANYONE_CAN_PAY, |machine, _, _| {
+        lowest = lowest.min(machine.registers()[SP].to_u64());
+    })
+    .expect("run anyone_can_pay");
+    assert_eq!(exit_code, 0, "{}", shape.to_line(None));
+    RISCV_MAX_MEMORY as u64 - lowest
+}
+
+#[test]
+fn test_acp_memory_high_water() {
+    let image = image_end(&ANYONE_CAN_PAY);
+    let fixtures = include_str!("fixtures/acp_worst_cases.txt");
+    let lines = SMALL_SHAPES.iter().cloned().chain(
+        fixtures
+            .lines()
+            .map(str::trim)
+            .filter(|line| !line.is_empty() && !line.starts_with('#')),
+    );
+    // the budget takes the larger of the two payment tables
+    assert!(HINT_TABLES_SIZE <= WALLET_TABLE_SIZE);
+    println!("{:>10} {:>10} {:>10} shape", "image", "stack", "free");
+    for line in lines {
+        let (shape, _) = Shape::from_line(line);
+        let stack = stack_peak(&shape);
+        let budget = match shape.unlock {
+            Unlock::Payment => PAYMENT_STACK_BUDGET,
+            Unlock::Signature => SIGNATURE_STACK_BUDGET,
+        };
+        let free = (RISCV_MAX_MEMORY as u64).saturating_sub(image + stack);
+        println!("{:>10} {:>10} {:>10} {}", image, stack, free, line);
+        assert!(
+            stack <= budget,
+            "{}: {} bytes of stack, budget {}",
+            line,
+            stack,
+            budget
+        );
+    }
+}
@@ -1,4 +1,8 @@
 mod anyone_can_pay;
+mod cycle_explorer;
+mod memory;
+mod payment_stress;
+mod profile;
 mod secp256k1_compatibility;
 
 use ckb_crypto::secp::Privkey;
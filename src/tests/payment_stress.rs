@@ -0,0 +1,496 @@
+//! Randomised stress run for the anyone-can-pay pairing rules.
+//!
+//! Every case is derived from a single `u64` seed: the lock args, the input
+//! wallets, the outputs and (sometimes) pairing hints or a signature are
+//! generated from it, the expected result is computed by
+//! `expected_payment_result`, a model of `check_payment_unlock`, and the
+//! transaction is verified by `TransactionScriptsVerifier`. Cases are spread
+//! over all cores with rayon.
+//!
+//! Hints are correct, shuffled or adversarial. They only make a payment
+//! cheaper, the expected result never depends on them.
+//!
+//! The default run is small enough for `cargo test`. Scale it up with:
+//!
+//! ```text
+//! ACP_STRESS_CASES=20000 cargo test --release payment_stress -- --nocapture
+//! ```
+//!
+//! A failing case prints its seed, set `ACP_STRESS_SEED` to replay it.
+
+use super::cycle_explorer::hint_witness;
+use super::{
+    blake160, build_resolved_tx, gen_tx_with_grouped_args, sign_tx, DummyDataLoader,
+    ALWAYS_SUCCESS, ANYONE_CAN_PAY, ERROR_DUPLICATED_INPUTS, ERROR_DUPLICATED_OUTPUTS,
+    ERROR_NO_PAIR, ERROR_OUTPUT_AMOUNT_NOT_ENOUGH, ERROR_PUBKEY_BLAKE160_HASH, MAX_CYCLES,
+};
+use ckb_crypto::secp::Generator;
+use ckb_script::{ScriptError, TransactionScriptsVerifier};
+use ckb_types::{
+    bytes::Bytes,
+    core::ScriptHashType,
+    packed::{CellOutput, Script},
+    prelude::*,
+};
+use rand::{rngs::SmallRng, seq::SliceRandom, thread_rng, Rng, SeedableRng};
+use rayon::prelude::*;
+use std::env;
+
+const DEFAULT_CASES: u64 = 256;
+const MAX_INPUTS: usize = 4;
+// number of distinct UDT type scripts, small on purpose to get type hash
+// collisions between wallets
+const UDT_TYPES: u8 = 3;
+// exponents used for the optional minimum amount args, 255 means "never"
+const MIN_AMOUNT_EXPONENTS: [u8; 5] = [0, 1, 2, 3, 255];
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+struct Wallet {
+    // None for CKB only wallets
+    udt_type: Option<u8>,
+    ckb_amount: u64,
+    udt_amount: u128,
+}
+
+#[derive(Debug)]
+struct PaymentCase {
+    min_ckb_exp: Option<u8>,
+    min_udt_exp: Option<u8>,
+    inputs: Vec<Wallet>,
+    // None stands for a cell which is not locked by the anyone-can-pay lock
+    outputs: Vec<Option<Wallet>>,
+}
+
+#[derive(Debug)]
+enum Unlock {
+    // pairing hints in the first witness, see check_payment_hints
+    Payment { hints: Option<Vec<usize>> },
+    Signature { by_owner: bool },
+}
+
+fn build_udt_script(udt_type: u8) -> Script {
+    let data_hash = CellOutput::calc_data_hash(&ALWAYS_SUCCESS);
+    Script::new_builder()
+        .code_hash(data_hash)
+        .hash_type(ScriptHashType::Data.into())
+        .args(Bytes::from(vec![udt_type]).pack())
+        .build()
+}
+
+fn build_anyone_can_pay_script(args: Bytes) -> Script {
+    let data_hash = CellOutput::calc_data_hash(&ANYONE_CAN_PAY);
+    Script::new_builder()
+        .args(args.pack())
+        .code_hash(data_hash)
+        .hash_type(ScriptHashType::Data.into())
+        .build()
+}
+
+fn pow10_u64(exp: u8) -> u64 {
+    if exp > 19 {
+        std::u64::MAX
+    } else {
+        10u64.pow(exp.into())
+    }
+}
+
+fn pow10_u128(exp: u8) -> u128 {
+    if exp > 38 {
+        std::u128::MAX
+    } else {
+        10u128.pow(exp.into())
+    }
+}
+
+/// Mirror of `check_payment_unlock` in c/anyone_can_pay.c, including the
+/// order in which errors are reported.
+fn expected_payment_result(case: &PaymentCase) -> Result<(), i8> {
+    let min_ckb = case.min_ckb_exp.map(pow10_u64).unwrap_or(0);
+    let min_udt = case.min_udt_exp.map(pow10_u128).unwrap_or(0);
+    let mut output_cnt = vec![0usize; case.inputs.len()];
+
+    for output in case.outputs.iter().flatten() {
+        let mut found_inputs = 0;
+        for (j, input) in case.inputs.iter().enumerate() {
+            if input.udt_type != output.udt_type {
+                continue;
+            }
+            let meet_ckb = input
+                .ckb_amount
+                .checked_add(min_ckb)
+                .map(|min| output.ckb_amount >= min)
+                .unwrap_or(false);
+            let meet_udt = input
+                .udt_amount
+                .checked_add(min_udt)
+                .map(|min| output.udt_amount >= min)
+                .unwrap_or(false);
+            if !(meet_ckb || meet_udt) {
+                return Err(ERROR_OUTPUT_AMOUNT_NOT_ENOUGH);
+            }
+            if (!meet_ckb && output.ckb_amount != input.ckb_amount)
+                || (!meet_udt && output.udt_amount != input.udt_amount)
+            {
+                return Err(ERROR_OUTPUT_AMOUNT_NOT_ENOUGH);
+            }
+            found_inputs += 1;
+            output_cnt[j] += 1;
+            if found_inputs > 1 {
+                return Err(ERROR_DUPLICATED_INPUTS);
+            }
+            if output_cnt[j] > 1 {
+                return Err(ERROR_DUPLICATED_OUTPUTS);
+            }
+        }
+        if found_inputs == 0 {
+            return Err(ERROR_NO_PAIR);
+        }
+    }
+
+    if output_cnt.iter().any(|cnt| *cnt == 0) {
+        return Err(ERROR_NO_PAIR);
+    }
+    Ok(())
+}
+
+fn gen_wallet<R: Rng>(rng: &mut R) -> Wallet {
+    let udt_type = if rng.gen_bool(0.5) {
+        Some(rng.gen_range(0, UDT_TYPES))
+    } else {
+        None
+    };
+    Wallet {
+        udt_type,
+        ckb_amount: rng.gen_range(61, 100_000),
+        udt_amount: if udt_type.is_some() {
+            rng.gen_range(0, 100_000)
+        } else {
+            0
+        },
+    }
+}
+
+fn gen_amount_delta<R: Rng, T>(rng: &mut R, amount: T, step: T) -> T
+where
+    T: Copy + std::ops::Add<Output = T> + std::ops::Sub<Output = T> + PartialOrd + From<u8>,
+{
+    match rng.gen_range(0, 4) {
+        // keep the old amount
+        0 => amount,
+        // pay less, if possible
+        1 if amount >= T::from(1) => amount - T::from(1),
+        // pay the minimum
+        2 => amount + step,
+        _ => amount + step + T::from(1),
+    }
+}
+
+fn gen_paid_output<R: Rng>(rng: &mut R, case: &PaymentCase, input: &Wallet) -> Wallet {
+    // keep the steps small enough to never overflow, overflow is covered by
+    // the 255 exponent
+    let ckb_step = case.min_ckb_exp.map(pow10_u64).unwrap_or(0).min(1_000);
+    let udt_step = case.min_udt_exp.map(pow10_u128).unwrap_or(0).min(1_000);
+    let mut output = *input;
+    output.ckb_amount = gen_amount_delta(rng, input.ckb_amount, ckb_step);
+    if input.udt_type.is_some() {
+        output.udt_amount = gen_amount_delta(rng, input.udt_amount, udt_step);
+    }
+    output
+}
+
+fn gen_payment_case<R: Rng>(rng: &mut R) -> PaymentCase {
+    let min_ckb_exp = if rng.gen_bool(0.5) {
+        Some(*MIN_AMOUNT_EXPONENTS.choose(rng).unwrap())
+    } else {
+        None
+    };
+    // the UDT exponent can only be set together with the CKB exponent
+    let min_udt_exp = if min_ckb_exp.is_some() && rng.gen_bool(0.5) {
+        Some(*MIN_AMOUNT_EXPONENTS.choose(rng).unwrap())
+    } else {
+        None
+    };
+    let inputs_cnt = rng.gen_range(1, MAX_INPUTS + 1);
+    let mut case = PaymentCase {
+        min_ckb_exp,
+        min_udt_exp,
+        inputs: (0..inputs_cnt).map(|_| gen_wallet(rng)).collect(),
+        outputs: Vec::new(),
+    };
+
+    let mut outputs = Vec::new();
+    for input in &case.inputs {
+        // most inputs are paired, some are left out to hit ERROR_NO_PAIR
+        if rng.gen_bool(0.9) {
+            outputs.push(Some(gen_paid_output(rng, &case, input)));
+        }
+        if rng.gen_bool(0.05) {
+            outputs.push(Some(gen_paid_output(rng, &case, input)));
+        }
+    }
+    if rng.gen_bool(0.05) {
+        outputs.push(Some(gen_wallet(rng)));
+    }
+    for _ in 0..rng.gen_range(0, 3) {
+        outputs.push(None);
+    }
+    outputs.shuffle(rng);
+    case.outputs = outputs;
+    case
+}
+
+/// The output paying every input, as a wallet builder hints it: the first
+/// output of the same type which isn't hinted yet, or an index past the
+/// outputs when there is none.
+fn pairing_hints(case: &PaymentCase) -> Vec<usize> {
+    let mut hinted = vec![false; case.outputs.len()];
+    case.inputs
+        .iter()
+        .map(|input| {
+            let paired = (0..case.outputs.len()).find(|&k| {
+                !hinted[k]
+                    && case.outputs[k].map_or(false, |output| output.udt_type == input.udt_type)
+            });
+            match paired {
+                Some(k) => {
+                    hinted[k] = true;
+                    k
+                }
+                None => case.outputs.len(),
+            }
+        })
+        .collect()
+}
+
+fn gen_hints<R: Rng>(rng: &mut R, case: &PaymentCase) -> Option<Vec<usize>> {
+    let mut hints = pairing_hints(case);
+    let len = hints.len();
+    let outputs = case.outputs.len();
+    match rng.gen_range(0, 4) {
+        0 => return None,
+        1 => {}
+        2 => hints.shuffle(rng),
+        // adversarial: one change a wallet builder wouldn't make
+        _ => match rng.gen_range(0, 5) {
+            0 => hints[rng.gen_range(0, len)] = rng.gen_range(0, outputs + 2),
+            1 => hints[rng.gen_range(0, len)] = hints[rng.gen_range(0, len)],
+            2 => {
+                hints.pop();
+            }
+            3 => hints.push(rng.gen_range(0, outputs + 2)),
+            _ => hints[rng.gen_range(0, len)] = 0xffff,
+        },
+    }
+    Some(hints)
+}
+
+fn lock_args(pubkey_hash: &Bytes, case: &PaymentCase) -> Bytes {
+    let mut args = pubkey_hash.to_vec();
+    if let Some(exp) = case.min_ckb_exp {
+        args.push(exp);
+    }
+    if let Some(exp) = case.min_udt_exp {
+        args.push(exp);
+    }
+    Bytes::from(args)
+}
+
+fn build_wallet_cell(output: CellOutput, lock: Script, wallet: &Wallet) -> (CellOutput, Bytes) {
+    let builder = output
+        .as_builder()
+        .lock(lock)
+        .capacity(wallet.ckb_amount.pack());
+    match wallet.udt_type {
+        Some(udt_type) => (
+            builder
+                .type_(Some(build_udt_script(udt_type)).pack())
+                .build(),
+            Bytes::from(wallet.udt_amount.to_le_bytes().to_vec()),
+        ),
+        None => (builder.type_(None::<Script>.pack()).build(), Bytes::new()),
+    }
+}
+
+fn expected_error_message(code: i8) -> String {
+    Into::<ckb_error::Error>::into(ScriptError::ValidationFailure(code)).to_string()
+}
+
+/// Builds the transaction of `case`, verifies it and compares the result with
+/// the expected one.
+fn verify_case(seed: u64, case: &PaymentCase, unlock: &Unlock) -> Result<(), String> {
+    let mut rng = SmallRng::seed_from_u64(seed);
+    let mut generator = Generator::non_crypto_safe_prng(seed);
+    let privkey = generator.gen_privkey();
+    let pubkey = privkey.pubkey().expect("pubkey");
+    let pubkey_hash = blake160(&pubkey.serialize());
+
+    let args = lock_args(&pubkey_hash, case);
+    let script = build_anyone_can_pay_script(args.clone());
+    let mut data_loader = DummyDataLoader::new();
+    let tx = gen_tx_with_grouped_args(&mut data_loader, vec![(args, case.inputs.len())], &mut rng);
+
+    // turn the generated inputs into wallets
+    for (input, wallet) in tx.inputs().into_iter().zip(case.inputs.iter()) {
+        let (prev_output, _) = data_loader
+            .cells
+            .remove(&input.previous_output())
+            .expect("input cell");
+        let lock = prev_output.lock();
+        let cell = build_wallet_cell(prev_output, lock, wallet);
+        data_loader.cells.insert(input.previous_output(), cell);
+    }
+
+    // the generated tx has one output locked by nobody, use it as template
+    let template = tx.outputs().get(0).unwrap();
+    let (outputs, outputs_data): (Vec<_>, Vec<_>) = case
+        .outputs
+        .iter()
+        .map(|output| match output {
+            Some(wallet) => build_wallet_cell(template.clone(), script.clone(), wallet),
+            None => (template.clone(), Bytes::new()),
+        })
+        .map(|(output, data)| (output, data.pack()))
+        .unzip();
+    let tx = tx
+        .as_advanced_builder()
+        .set_outputs(outputs)
+        .set_outputs_data(outputs_data)
+        .build();
+
+    let (tx, expected) = match unlock {
+        Unlock::Payment { hints } => {
+            let witnesses = match hints {
+                Some(hints) => vec![hint_witness(hints, 0).pack()],
+                None => Vec::new(),
+            };
+            (
+                tx.as_advanced_builder().set_witnesses(witnesses).build(),
+                expected_payment_result(case),
+            )
+        }
+        Unlock::Signature { by_owner: true } => (sign_tx(tx, &privkey), Ok(())),
+        Unlock::Signature { by_owner: false } => (
+            sign_tx(tx, &generator.gen_privkey()),
+            Err(ERROR_PUBKEY_BLAKE160_HASH),
+        ),
+    };
+
+    let resolved_tx = build_resolved_tx(&data_loader, &tx);
+    let verify_result =
+        TransactionScriptsVerifier::new(&resolved_tx, &data_loader).verify(MAX_CYCLES);
+    let matched = match (&verify_result, expected) {
+        (Ok(_), Ok(())) => true,
+        (Err(err), Err(code)) => err.to_string() == expected_error_message(code),
+        _ => false,
+    };
+    if matched {
+        Ok(())
+    } else {
+        Err(format!(
+            "seed {}: {:?} {:?}, expect {:?}, got {:?}",
+            seed, unlock, case, expected, verify_result
+        ))
+    }
+}
+
+fn run_case(seed: u64) -> Result<(), String> {
+    let mut rng = SmallRng::seed_from_u64(seed);
+    let case = gen_payment_case(&mut rng);
+    let unlock = if rng.gen_bool(0.1) {
+        Unlock::Signature {
+            by_owner: rng.gen_bool(0.5),
+        }
+    } else {
+        Unlock::Payment {
+            hints: gen_hints(&mut rng, &case),
+        }
+    };
+    verify_case(seed, &case, &unlock)
+}
+
+#[test]
+fn test_payment_stress() {
+    let cases: u64 = env::var("ACP_STRESS_CASES")
+        .map(|cases| cases.parse().expect("ACP_STRESS_CASES"))
+        .unwrap_or(DEFAULT_CASES);
+    let failures: Vec<String> = match env::var("ACP_STRESS_SEED") {
+        // replay a single case
+        Ok(seed) => run_case(seed.parse().expect("ACP_STRESS_SEED"))
+            .err()
+            .into_iter()
+            .collect(),
+        Err(_) => {
+            let base_seed: u64 = thread_rng().gen();
+            (0..cases)
+                .into_par_iter()
+                .filter_map(|i| run_case(base_seed.wrapping_add(i)).err())
+                .collect()
+        }
+    };
+    for failure in &failures {
+        eprintln!("{}", failure);
+    }
+    assert!(failures.is_empty(), "{} cases failed", failures.len());
+}
+
+fn udt_wallet(udt_type: u8, ckb_amount: u64, udt_amount: u128) -> Wallet {
+    Wallet {
+        udt_type: Some(udt_type),
+        ckb_amount,
+        udt_amount,
+    }
+}
+
+// Hints which don't prove the pairing fall back to the scan, which reports
+// the same error as without hints.
+#[test]
+fn test_payment_wrong_hints_errors() {
+    let wallet = udt_wallet(0, 1_000, 1_000);
+    let paid = udt_wallet(0, 1_000, 2_000);
+    let cases = [
+        // the hinted output pays less than the wallet holds
+        (
+            vec![wallet],
+            vec![Some(udt_wallet(0, 999, 1_000))],
+            vec![0],
+            ERROR_OUTPUT_AMOUNT_NOT_ENOUGH,
+        ),
+        // an output of the wallet lock which no hint points to, of a type no
+        // wallet has
+        (
+            vec![wallet],
+            vec![Some(paid), Some(udt_wallet(1, 1_000, 1_000))],
+            vec![0],
+            ERROR_NO_PAIR,
+        ),
+        // the same, of the type of the hinted wallet
+        (
+            vec![wallet],
+            vec![Some(paid), Some(paid)],
+            vec![0],
+            ERROR_DUPLICATED_OUTPUTS,
+        ),
+        // two wallets of the same type, each hinted to its own output
+        (
+            vec![wallet, wallet],
+            vec![Some(paid), Some(paid)],
+            vec![0, 1],
+            ERROR_DUPLICATED_INPUTS,
+        ),
+    ];
+    for (i, (inputs, outputs, hints, error)) in cases.iter().enumerate() {
+        let case = PaymentCase {
+            min_ckb_exp: None,
+            min_udt_exp: None,
+            inputs: inputs.clone(),
+            outputs: outputs.clone(),
+        };
+        assert_eq!(expected_payment_result(&case), Err(*error), "case {}", i);
+        for hints in &[None, Some(hints.clone())] {
+            let unlock = Unlock::Payment {
+                hints: hints.clone(),
+            };
+            verify_case(i as u64, &case, &unlock).unwrap();
+        }
+    }
+}
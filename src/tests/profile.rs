@@ -0,0 +1,588 @@
+//! Folded-stack profiles of a script, for flamegraph.pl or inferno.
+//!
+//! The script runs in a CKB-VM interpreter stepped one instruction at a time,
+//! with the syscalls it needs implemented over a `ResolvedTransaction`
+//! (`ProfileSyscalls`: no header deps, no `load_cell_data_as_code`). Addresses
+//! are mapped to functions with the symbol table of the `build/*.debug` file
+//! written by the Makefile next to every script. Calls and returns are
+//! followed through the return address register, so every instruction is
+//! counted on the stack of functions it ran in; the syscalls an instruction
+//! made get their own `[syscall ...]` frame.
+//!
+//! The unit is instructions, not cycles: this VM counts one per instruction,
+//! while CKB charges some (loads, stores, branches, multiplications, divisions)
+//! more. The real cycles of the group, from `TransactionScriptsVerifier`, are
+//! printed with the profile, as are the bytes every kind of syscall copied.
+//!
+//! ```text
+//! cargo test --release profile_anyone_can_pay -- --ignored --nocapture
+//! flamegraph.pl build/anyone_can_pay.folded > anyone_can_pay.svg
+//! ```
+//!
+//! `CKB_PROFILE_SHAPE` picks the transaction, as a line of
+//! `fixtures/acp_worst_cases.txt` (see cycle_explorer.rs), and
+//! `CKB_PROFILE_OUT` the output file.
+
+use super::cycle_explorer::{build_shape_tx, Shape};
+use super::{build_resolved_tx, ANYONE_CAN_PAY, MAX_CYCLES};
+use ckb_script::TransactionScriptsVerifier;
+use ckb_types::{
+    bytes::Bytes,
+    core::{cell::ResolvedTransaction, Capacity},
+    packed::{Byte32, CellOutput, Script},
+    prelude::*,
+};
+use ckb_vm::{
+    decoder::build_imac_decoder,
+    machine::DefaultMachine,
+    registers::{A0, A1, A2, A3, A4, A5, A7, RA},
+    CoreMachine, DefaultCoreMachine, DefaultMachineBuilder, Error as VMError, Memory, Register,
+    SparseMemory, SupportMachine, Syscalls, WXorXMemory,
+};
+use std::cell::RefCell;
+use std::collections::HashMap;
+use std::env;
+use std::fs;
+use std::rc::Rc;
+
+const DEFAULT_SHAPE: &str = "unlock=signature inputs=4 witness_extra=1024";
+
+const SYS_LOAD_TRANSACTION: u64 = 2051;
+const SYS_LOAD_SCRIPT: u64 = 2052;
+const SYS_LOAD_TX_HASH: u64 = 2061;
+const SYS_LOAD_SCRIPT_HASH: u64 = 2062;
+const SYS_LOAD_CELL: u64 = 2071;
+const SYS_LOAD_INPUT: u64 = 2073;
+const SYS_LOAD_WITNESS: u64 = 2074;
+const SYS_LOAD_CELL_BY_FIELD: u64 = 2081;
+const SYS_LOAD_INPUT_BY_FIELD: u64 = 2083;
+const SYS_LOAD_CELL_DATA: u64 = 2092;
+const SYS_DEBUG: u64 = 2177;
+
+const SOURCE_INPUT: u64 = 1;
+const SOURCE_OUTPUT: u64 = 2;
+const SOURCE_CELL_DEP: u64 = 3;
+const SOURCE_GROUP_INPUT: u64 = 0x0100000000000001;
+const SOURCE_GROUP_OUTPUT: u64 = 0x0100000000000002;
+
+const CKB_SUCCESS: u8 = 0;
+const CKB_INDEX_OUT_OF_BOUND: u8 = 1;
+const CKB_ITEM_MISSING: u8 = 2;
+
+const STT_FUNC: u8 = 2;
+const SHT_SYMTAB: u32 = 2;
+
+/// Function symbols of an ELF file, sorted by address.
+pub struct Symbols {
+    // start, end (exclusive, 0 when the symbol has no size), name
+    functions: Vec<(u64, u64, String)>,
+}
+
+pub fn read_le(data: &[u8], offset: usize, size: usize) -> u64 {
+    data[offset..offset + size]
+        .iter()
+        .rev()
+        .fold(0, |value, byte| (value << 8) | u64::from(*byte))
+}
+
+impl Symbols {
+    /// Reads .symtab, which `objcopy --only-keep-debug` keeps.
+    pub fn load(path: &str) -> Self {
+        let elf = fs::read(path).unwrap_or_else(|err| panic!("read {}: {}", path, err));
+        assert_eq!(&elf[0..4], b"\x7fELF", "{} is not an ELF file", path);
+        let shoff = read_le(&elf, 0x28, 8) as usize;
+        let shentsize = read_le(&elf, 0x3a, 2) as usize;
+        let shnum = read_le(&elf, 0x3c, 2) as usize;
+        let section = |i: usize| &elf[shoff + i * shentsize..shoff + (i + 1) * shentsize];
+        let mut functions = Vec::new();
+        for i in 0..shnum {
+            let sh = section(i);
+            if read_le(sh, 4, 4) as u32 != SHT_SYMTAB {
+                continue;
+            }
+            let offset = read_le(sh, 0x18, 8) as usize;
+            let size = read_le(sh, 0x20, 8) as usize;
+            let entsize = read_le(sh, 0x38, 8) as usize;
+            let strtab = section(read_le(sh, 0x28, 4) as usize);
+            let strtab_offset = read_le(strtab, 0x18, 8) as usize;
+            for sym in elf[offset..offset + size].chunks(entsize) {
+                let value = read_le(sym, 8, 8);
+                if sym[4] & 0xf != STT_FUNC || value == 0 {
+                    continue;
+                }
+                let name_offset = strtab_offset + read_le(sym, 0, 4) as usize;
+                let name_len = elf[name_offset..].iter().position(|b| *b == 0).unwrap();
+                let name = String::from_utf8_lossy(&elf[name_offset..name_offset + name_len]);
+                functions.push((value, value + read_le(sym, 16, 8), name.into_owned()));
+            }
+        }
+        assert!(!functions.is_empty(), "no function symbols in {}", path);
+        functions.sort();
+        Symbols { functions }
+    }
+
+    /// Index of the function containing `pc`, `None` outside of any.
+    fn lookup(&self, pc: u64) -> Option<usize> {
+        let i = match self.functions.binary_search_by_key(&pc, |f| f.0) {
+            Ok(i) => i,
+            Err(0) => return None,
+            Err(i) => i - 1,
+        };
+        let (start, end, _) = &self.functions[i];
+        if *end > *start && pc >= *end {
+            None
+        } else {
+            Some(i)
+        }
+    }
+}
+
+#[derive(Default)]
+struct SyscallStats {
+    // syscall made by the last instruction
+    last: Option<&'static str>,
+    // name => (calls, bytes copied to the script)
+    totals: HashMap<&'static str, (u64, u64)>,
+}
+
+/// The syscalls of ckb-script needed by the scripts of this repository, over a
+/// resolved transaction, for the script group of `script_hash`.
+struct ProfileSyscalls<'a> {
+    rtx: &'a ResolvedTransaction,
+    script: Script,
+    script_hash: Byte32,
+    group_inputs: Vec<usize>,
+    group_outputs: Vec<usize>,
+    stats: Rc<RefCell<SyscallStats>>,
+}
+
+impl<'a> ProfileSyscalls<'a> {
+    fn new(rtx: &'a ResolvedTransaction, script: Script, stats: Rc<RefCell<SyscallStats>>) -> Self {
+        let script_hash = script.calc_script_hash();
+        let in_group = |output: &CellOutput| {
+            output.lock().calc_script_hash() == script_hash
+                || output
+                    .type_()
+                    .to_opt()
+                    .map(|type_| type_.calc_script_hash() == script_hash)
+                    .unwrap_or(false)
+        };
+        let group_inputs = rtx
+            .resolved_inputs
+            .iter()
+            .enumerate()
+            .filter(|(_, cell)| in_group(&cell.cell_output))
+            .map(|(i, _)| i)
+            .collect();
+        let group_outputs = rtx
+            .transaction
+            .outputs()
+            .into_iter()
+            .enumerate()
+            .filter(|(_, output)| in_group(output))
+            .map(|(i, _)| i)
+            .collect();
+        ProfileSyscalls {
+            rtx,
+            script,
+            script_hash,
+            group_inputs,
+            group_outputs,
+            stats,
+        }
+    }
+
+    fn witness(&self, index: usize, source: u64) -> Option<Bytes> {
+        let index = match source {
+            SOURCE_INPUT | SOURCE_OUTPUT => index,
+            SOURCE_GROUP_INPUT => *self.group_inputs.get(index)?,
+            SOURCE_GROUP_OUTPUT => *self.group_outputs.get(index)?,
+            _ => return None,
+        };
+        self.rtx
+            .transaction
+            .witnesses()
+            .get(index)
+            .map(|witness| witness.raw_data())
+    }
+
+    // output and data of a cell
+    fn cell(&self, index: usize, source: u64) -> Option<(CellOutput, Bytes)> {
+        let meta = |cells: &[ckb_types::core::cell::CellMeta], i: usize| {
+            cells.get(i).map(|cell| {
+                let data = cell
+                    .mem_cell_data
+                    .as_ref()
+                    .map(|(data, _)| data.clone())
+                    .expect("cell data");
+                (cell.cell_output.clone(), data)
+            })
+        };
+        let output = |i: usize| {
+            let tx = &self.rtx.transaction;
+            tx.outputs()
+                .get(i)
+                .map(|output| (output, tx.outputs_data().get(i).unwrap().raw_data()))
+        };
+        match source {
+            SOURCE_INPUT => meta(&self.rtx.resolved_inputs, index),
+            SOURCE_OUTPUT => output(index),
+            SOURCE_CELL_DEP => meta(&self.rtx.resolved_cell_deps, index),
+            SOURCE_GROUP_INPUT => meta(&self.rtx.resolved_inputs, *self.group_inputs.get(index)?),
+            SOURCE_GROUP_OUTPUT => output(*self.group_outputs.get(index)?),
+            _ => None,
+        }
+    }
+
+    fn input(&self, index: usize, source: u64) -> Option<ckb_types::packed::CellInput> {
+        let index = match source {
+            SOURCE_INPUT => index,
+            SOURCE_GROUP_INPUT => *self.group_inputs.get(index)?,
+            _ => return None,
+        };
+        self.rtx.transaction.inputs().get(index)
+    }
+
+    // The data a load syscall asks for: Ok(data), or Err(error code).
+    fn load(&self, code: u64, index: usize, source: u64, field: u64) -> Result<Bytes, u8> {
+        let data = match code {
+            SYS_LOAD_TRANSACTION => Some(self.rtx.transaction.data().as_bytes()),
+            SYS_LOAD_SCRIPT => Some(self.script.as_bytes()),
+            SYS_LOAD_TX_HASH => Some(self.rtx.transaction.hash().as_bytes()),
+            SYS_LOAD_SCRIPT_HASH => Some(self.script_hash.as_bytes()),
+            SYS_LOAD_WITNESS => self.witness(index, source),
+            SYS_LOAD_INPUT => self.input(index, source).map(|input| input.as_bytes()),
+            SYS_LOAD_INPUT_BY_FIELD => {
+                let input = self.input(index, source).ok_or(CKB_INDEX_OUT_OF_BOUND)?;
+                Some(match field {
+                    0 => input.previous_output().as_bytes(),
+                    1 => input.since().as_bytes(),
+                    _ => return Err(CKB_ITEM_MISSING),
+                })
+            }
+            SYS_LOAD_CELL => self
+                .cell(index, source)
+                .map(|(output, _)| output.as_bytes()),
+            SYS_LOAD_CELL_DATA => self.cell(index, source).map(|(_, data)| data),
+            SYS_LOAD_CELL_BY_FIELD => {
+                let (output, data) = self.cell(index, source).ok_or(CKB_INDEX_OUT_OF_BOUND)?;
+                Some(match field {
+                    0 => output.capacity().as_bytes(),
+                    1 => CellOutput::calc_data_hash(&data).as_bytes(),
+                    2 => output.lock().as_bytes(),
+                    3 => output.lock().calc_script_hash().as_bytes(),
+                    4 => output.type_().to_opt().ok_or(CKB_ITEM_MISSING)?.as_bytes(),
+                    5 => output
+                        .type_()
+                        .to_opt()
+                        .ok_or(CKB_ITEM_MISSING)?
+                        .calc_script_hash()
+                        .as_bytes(),
+                    6 => {
+                        let capacity = Capacity::bytes(data.len()).expect("data capacity");
+                        let occupied = output.occupied_capacity(capacity).expect("capacity");
+                        Bytes::from(occupied.as_u64().to_le_bytes().to_vec())
+                    }
+                    _ => return Err(CKB_ITEM_MISSING),
+                })
+            }
+            _ => unreachable!(),
+        };
+        data.ok_or(CKB_INDEX_OUT_OF_BOUND)
+    }
+}
+
+fn syscall_name(code: u64) -> &'static str {
+    match code {
+        SYS_LOAD_TRANSACTION => "load_transaction",
+        SYS_LOAD_SCRIPT => "load_script",
+        SYS_LOAD_TX_HASH => "load_tx_hash",
+        SYS_LOAD_SCRIPT_HASH => "load_script_hash",
+        SYS_LOAD_CELL => "load_cell",
+        SYS_LOAD_INPUT => "load_input",
+        SYS_LOAD_WITNESS => "load_witness",
+        SYS_LOAD_CELL_BY_FIELD => "load_cell_by_field",
+        SYS_LOAD_INPUT_BY_FIELD => "load_input_by_field",
+        SYS_LOAD_CELL_DATA => "load_cell_data",
+        _ => "debug",
+    }
+}
+
+impl<'a, Mac: SupportMachine> Syscalls<Mac> for ProfileSyscalls<'a> {
+    fn initialize(&mut self, _machine: &mut Mac) -> Result<(), VMError> {
+        Ok(())
+    }
+
+    fn ecall(&mut self, machine: &mut Mac) -> Result<bool, VMError> {
+        let code = machine.registers()[A7].to_u64();
+        let name = match code {
+            SYS_LOAD_TRANSACTION
+            | SYS_LOAD_SCRIPT
+            | SYS_LOAD_TX_HASH
+            | SYS_LOAD_SCRIPT_HASH
+            | SYS_LOAD_CELL
+            | SYS_LOAD_INPUT
+            | SYS_LOAD_WITNESS
+            | SYS_LOAD_CELL_BY_FIELD
+            | SYS_LOAD_INPUT_BY_FIELD
+            | SYS_LOAD_CELL_DATA
+            | SYS_DEBUG => syscall_name(code),
+            _ => return Ok(false),
+        };
+        let mut copied = 0;
+        if code == SYS_DEBUG {
+            let mut addr = machine.registers()[A0].to_u64();
+            let mut message = Vec::new();
+            loop {
+                let byte = machine
+                    .memory_mut()
+                    .load8(&Mac::REG::from_u64(addr))?
+                    .to_u8();
+                if byte == 0 {
+                    break;
+                }
+                message.push(byte);
+                addr += 1;
+            }
+            println!("script debug: {}", String::from_utf8_lossy(&message));
+        } else {
+            let addr = machine.registers()[A0].to_u64();
+            let size_addr = machine.registers()[A1].clone();
+            let offset = machine.registers()[A2].to_u64() as usize;
+            let index = machine.registers()[A3].to_u64() as usize;
+            let source = machine.registers()[A4].to_u64();
+            let field = machine.registers()[A5].to_u64();
+            let ret = match self.load(code, index, source, field) {
+                Ok(data) => {
+                    let size = machine.memory_mut().load64(&size_addr)?.to_u64() as usize;
+                    let offset = offset.min(data.len());
+                    let full = data.len() - offset;
+                    let real = size.min(full);
+                    machine
+                        .memory_mut()
+                        .store_bytes(addr, &data[offset..offset + real])?;
+                    machine
+                        .memory_mut()
+                        .store64(&size_addr, &Mac::REG::from_u64(full as u64))?;
+                    copied = real as u64;
+                    CKB_SUCCESS
+                }
+                Err(ret) => ret,
+            };
+            machine.set_register(A0, Mac::REG::from_u8(ret));
+        }
+        let mut stats = self.stats.borrow_mut();
+        stats.last = Some(name);
+        let total = stats.totals.entry(name).or_insert((0, 0));
+        total.0 += 1;
+        total.1 += copied;
+        Ok(true)
+    }
+}
+
+/// Instructions per call stack, as a trie of (caller path, function).
+pub struct Profile {
+    names: Vec<String>,
+    // parent node and name of every node, node 0 is the root
+    nodes: Vec<(usize, usize)>,
+    children: HashMap<(usize, usize), usize>,
+    counts: Vec<u64>,
+    pub instructions: u64,
+    pub syscalls: HashMap<&'static str, (u64, u64)>,
+}
+
+impl Profile {
+    fn new(symbols: &Symbols) -> Self {
+        Profile {
+            names: symbols.functions.iter().map(|f| f.2.clone()).collect(),
+            nodes: vec![(0, 0)],
+            children: HashMap::new(),
+            counts: vec![0],
+            instructions: 0,
+            syscalls: HashMap::new(),
+        }
+    }
+
+    fn name(&mut self, name: &str) -> usize {
+        match self.names.iter().position(|n| n == name) {
+            Some(i) => i,
+            None => {
+                self.names.push(name.to_string());
+                self.names.len() - 1
+            }
+        }
+    }
+
+    fn child(&mut self, parent: usize, name: usize) -> usize {
+        let next = self.nodes.len();
+        let node = *self.children.entry((parent, name)).or_insert(next);
+        if node == next {
+            self.nodes.push((parent, name));
+            self.counts.push(0);
+        }
+        node
+    }
+
+    /// One line per stack: frames from the entry point, separated by ';',
+    /// then the instruction count.
+    pub fn folded(&self) -> String {
+        let mut lines = Vec::new();
+        for (node, count) in self.counts.iter().enumerate() {
+            if *count == 0 {
+                continue;
+            }
+            let mut frames = Vec::new();
+            let mut n = node;
+            while n != 0 {
+                frames.push(self.names[self.nodes[n].1].as_str());
+                n = self.nodes[n].0;
+            }
+            frames.reverse();
+            lines.push(format!("{} {}", frames.join(";"), count));
+        }
+        lines.sort();
+        lines.join("\n") + "\n"
+    }
+
+    /// Instructions spent in each function itself, largest first.
+    pub fn self_counts(&self) -> Vec<(&str, u64)> {
+        let mut totals: HashMap<&str, u64> = HashMap::new();
+        for (node, count) in self.counts.iter().enumerate().skip(1) {
+            *totals.entry(&self.names[self.nodes[node].1]).or_insert(0) += count;
+        }
+        let mut totals: Vec<_> = totals.into_iter().collect();
+        totals.sort_by(|a, b| b.1.cmp(&a.1));
+        totals
+    }
+}
+
+pub type Machine<'a> =
+    DefaultMachine<'a, DefaultCoreMachine<u64, WXorXMemory<u64, SparseMemory<u64>>>>;
+
+/// Runs `program` as `script` over `rtx` one instruction at a time. `step` is
+/// called after every instruction with the machine, the pc the instruction
+/// was at and the syscall it made. Returns the exit code and the calls and
+/// bytes copied of every syscall.
+pub fn step_script<F>(
+    rtx: &ResolvedTransaction,
+    script: Script,
+    program: &Bytes,
+    mut step: F,
+) -> Result<(i8, HashMap<&'static str, (u64, u64)>), VMError>
+where
+    F: FnMut(&Machine, u64, Option<&'static str>),
+{
+    let stats = Rc::new(RefCell::new(SyscallStats::default()));
+    let core = DefaultCoreMachine::<u64, WXorXMemory<u64, SparseMemory<u64>>>::new_with_max_cycles(
+        MAX_CYCLES,
+    );
+    let mut machine = DefaultMachineBuilder::new(core)
+        .instruction_cycle_func(Box::new(|_| 1))
+        .syscall(Box::new(ProfileSyscalls::new(
+            rtx,
+            script,
+            Rc::clone(&stats),
+        )))
+        .build();
+    machine.load_program(program, &[Bytes::from("verify")])?;
+
+    let mut decoder = build_imac_decoder::<u64>();
+    machine.set_running(true);
+    while machine.running() {
+        let pc = machine.pc().to_u64();
+        machine.step(&mut decoder)?;
+        let syscall = stats.borrow_mut().last.take();
+        step(&machine, pc, syscall);
+    }
+    let totals = stats.borrow().totals.clone();
+    Ok((machine.exit_code(), totals))
+}
+
+/// Runs `program` as `script` over `rtx` and profiles it.
+pub fn profile_script(
+    rtx: &ResolvedTransaction,
+    script: Script,
+    program: &Bytes,
+    symbols: &Symbols,
+) -> Result<(i8, Profile), VMError> {
+    let mut profile = Profile::new(symbols);
+    let unknown = profile.name("[unknown]");
+    // return address and caller path of every active call
+    let mut calls: Vec<(u64, usize)> = Vec::new();
+    let mut path = 0;
+    let (exit_code, syscalls) = step_script(rtx, script, program, |machine, pc, syscall| {
+        profile.instructions += 1;
+        let function = symbols.lookup(pc).unwrap_or(unknown);
+        let mut node = profile.child(path, function);
+        if let Some(name) = syscall {
+            let name = profile.name(&format!("[syscall {}]", name));
+            node = profile.child(node, name);
+        }
+        profile.counts[node] += 1;
+
+        let next = machine.pc().to_u64();
+        if next == pc + 2 || next == pc + 4 {
+            return;
+        }
+        // A jump which leaves the return address right after itself is a
+        // call, a jump to the return address of an active call returns from
+        // it. Anything else (branches, tail calls) stays in the same frame.
+        let ra = machine.registers()[RA].to_u64();
+        if ra == pc + 2 || ra == pc + 4 {
+            calls.push((ra, path));
+            path = profile.child(path, function);
+        } else if let Some(depth) = calls.iter().rposition(|(ret, _)| *ret == next) {
+            path = calls[depth].1;
+            calls.truncate(depth);
+        }
+    })?;
+    profile.syscalls = syscalls;
+    Ok((exit_code, profile))
+}
+
+#[test]
+#[ignore]
+fn test_profile_anyone_can_pay() {
+    let line = env::var("CKB_PROFILE_SHAPE").unwrap_or_else(|_| DEFAULT_SHAPE.to_string());
+    let out = env::var("CKB_PROFILE_OUT").unwrap_or_else(|_| {
+        concat!(env!("CARGO_MANIFEST_DIR"), "/build/anyone_can_pay.folded").to_string()
+    });
+    let symbols = Symbols::load(concat!(
+        env!("CARGO_MANIFEST_DIR"),
+        "/build/anyone_can_pay.debug"
+    ));
+    let (shape, _) = Shape::from_line(&line);
+    let (data_loader, tx) = build_shape_tx(&shape, 0);
+    let rtx = build_resolved_tx(&data_loader, &tx);
+    let cycles = TransactionScriptsVerifier::new(&rtx, &data_loader)
+        .verify(MAX_CYCLES)
+        .expect("pass verification");
+
+    let script = rtx.resolved_inputs[0].cell_output.lock();
+    let (exit_code, profile) =
+        profile_script(&rtx, script, &ANYONE_CAN_PAY, &symbols).expect("profile");
+    assert_eq!(exit_code, 0);
+    fs::write(&out, profile.folded()).expect("write folded stacks");
+
+    println!("{}", shape.to_line(None));
+    println!(
+        "transaction: {} cycles, anyone_can_pay group: {} instructions",
+        cycles, profile.instructions
+    );
+    println!("self instructions:");
+    for (name, count) in profile.self_counts().iter().take(20) {
+        println!(
+            "{:>6.2}% {:>12} {}",
+            *count as f64 * 100.0 / profile.instructions as f64,
+            count,
+            name
+        );
+    }
+    println!("syscalls (calls, bytes):");
+    let mut syscalls: Vec<_> = profile.syscalls.iter().collect();
+    syscalls.sort();
+    for (name, (calls, bytes)) in syscalls {
+        println!("{:>24} {:>8} {:>10}", name, calls, bytes);
+    }
+    println!("folded stacks: {}", out);
+}
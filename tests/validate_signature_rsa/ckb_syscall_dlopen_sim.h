@@ -5,6 +5,9 @@
 #include <stdio.h>
 
 static FILE* g_file = NULL;
+// what ckb_dlopen2 asked for, see dlopen_sim.c
+static uint64_t g_load_calls = 0;
+static uint64_t g_load_bytes = 0;
 
 int dlopen_init_riscv_binary(const char* path) {
   g_file = fopen(path, "rb");
@@ -19,6 +22,8 @@ int ckb_load_cell_data(void* addr, uint64_t* len, size_t offset, size_t index,
   if (err != 0) return err;
   size_t read_bytes = fread(addr, 1, *len, g_file);
   *len = read_bytes;
+  g_load_calls++;
+  g_load_bytes += read_bytes;
   if (read_bytes == 0) {
     err = ferror(g_file);
     if (err != 0) return err;
@@ -50,10 +50,69 @@ int ckb_dlopen2(const uint8_t *dep_cell_hash, uint8_t hash_type,
 
 #include "ckb_dlfcn.h"
 
+// Relocations and dynamic symbols of an ELF file: the work ckb_dlopen2 and
+// ckb_dlsym do on top of loading the segments. Read from the section headers,
+// which strip keeps.
+typedef struct DlopenElfStats {
+  uint64_t relocs;
+  uint64_t relative_relocs;
+  uint64_t dynsyms;
+} DlopenElfStats;
+
+#define DLOPEN_SIM_SHT_RELA 4
+#define DLOPEN_SIM_SHT_DYNSYM 11
+#define DLOPEN_SIM_R_RISCV_RELATIVE 3
+
+static uint64_t read_le(const uint8_t *p, size_t n) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; i++) {
+    v |= ((uint64_t)p[i]) << (8 * i);
+  }
+  return v;
+}
+
+static int elf_stats(const uint8_t *elf, size_t size, DlopenElfStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (size < 64 || memcmp(elf, "\177ELF", 4) != 0) {
+    return 1;
+  }
+  uint64_t shoff = read_le(elf + 0x28, 8);
+  uint64_t shentsize = read_le(elf + 0x3a, 2);
+  uint64_t shnum = read_le(elf + 0x3c, 2);
+  if (shentsize < 64 || shoff > size || shnum > (size - shoff) / shentsize) {
+    return 2;
+  }
+  for (uint64_t i = 0; i < shnum; i++) {
+    const uint8_t *sh = elf + shoff + i * shentsize;
+    uint32_t type = (uint32_t)read_le(sh + 4, 4);
+    uint64_t offset = read_le(sh + 0x18, 8);
+    uint64_t sh_size = read_le(sh + 0x20, 8);
+    uint64_t entsize = read_le(sh + 0x38, 8);
+    if (entsize == 0 || offset > size || sh_size > size - offset) continue;
+    if (type == DLOPEN_SIM_SHT_DYNSYM) {
+      stats->dynsyms += sh_size / entsize;
+    } else if (type == DLOPEN_SIM_SHT_RELA) {
+      for (uint64_t j = 0; j < sh_size / entsize; j++) {
+        uint64_t info = read_le(elf + offset + j * entsize + 8, 8);
+        stats->relocs++;
+        if ((info & 0xffffffff) == DLOPEN_SIM_R_RISCV_RELATIVE) {
+          stats->relative_relocs++;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// Prints, as CSV, the work ckb_dlopen2 does for the library: bytes and
+// syscalls of the load, relocations and dynamic symbols. It only counts, it
+// doesn't time anything: the VM cycles of a load grow with these, and are
+// measured with the example lock, see size-report.sh.
 int main(int argc, const char *argv[]) {
   int err = 0;
   if (argc != 2) {
     printf("usage: dlopen_sim <file path to RISCV-binary>\n");
+    return 1;
   }
   err = dlopen_init_riscv_binary(argv[1]);
   if (err != 0) {
@@ -66,11 +125,27 @@ int main(int argc, const char *argv[]) {
   uint8_t code_buff[code_size];
   void *handle = NULL;
   size_t consumed_size = 0;
+  DlopenElfStats stats;
+  size_t file_size = fread(code_buff, 1, code_size, g_file);
+  CHECK2(file_size > 0 && file_size < code_size, 3);
+  CHECK(elf_stats(code_buff, file_size, &stats));
+
+  g_load_calls = 0;
+  g_load_bytes = 0;
   err = ckb_dlopen2(hash, hash_type, code_buff, code_size, &handle,
                     &consumed_size);
   CHECK(err);
   CHECK2(handle != NULL, 1);
   CHECK2(consumed_size > 0 && consumed_size < code_size, 2);
+  CHECK2(ckb_dlsym(handle, "validate_signature") != NULL, 4);
+  printf(
+      "binary,file,consumed,load_syscalls,load_bytes,relocs,relative_relocs,"
+      "dynsyms\n");
+  printf("%s,%zu,%zu,%llu,%llu,%llu,%llu,%llu\n", argv[1], file_size,
+         consumed_size, (unsigned long long)g_load_calls,
+         (unsigned long long)g_load_bytes, (unsigned long long)stats.relocs,
+         (unsigned long long)stats.relative_relocs,
+         (unsigned long long)stats.dynsyms);
   err = 0;
 exit:
   return err;
@@ -11,6 +11,46 @@ function run () {
   $ASM64 ../../build/validate_signature_rsa_sim ckbvm "$1" "$2"
 }
 
+# bash run-in-vm.sh bench
+# Cycles of validate_signature over RSA and Rabin-Williams, key sizes,
+# paddings, digests and message lengths, as CSV. The vectors come from the native simulator (see run.sh) and
+# the runner must implement the current cycles syscall, e.g. ckb-debugger:
+# BENCH_RUNNER=... bash run-in-vm.sh bench
+if [ "$1" == "bench" ]; then
+  BENCH_RUNNER=${BENCH_RUNNER:-$ASM64}
+  NATIVE=build.simulator/validate_signature_rsa
+  if [ ! -f $NATIVE ]; then
+    bash run.sh > /dev/null
+  fi
+  make -C ../.. validate_signature_rsa_sim-via-docker
+  echo "mode,algorithm_id,key_size,padding,md_type,msg_len,value"
+  $NATIVE -bench-vectors | while read sig msg; do
+    $BENCH_RUNNER ../../build/validate_signature_rsa_sim ckbvm -bench_rsa $sig $msg | grep -o "cycles,.*"
+  done
+  exit 0
+fi
+
+# bash run-in-vm.sh corpus [corpus.bin]
+# Runs a corpus of the native simulator (-gen-corpus) in CKB-VM, in batches of
+# records, and sums the cycles. Same runner requirements as bench.
+if [ "$1" == "corpus" ]; then
+  BENCH_RUNNER=${BENCH_RUNNER:-$ASM64}
+  NATIVE=build.simulator/validate_signature_rsa
+  CORPUS=${2:-build.simulator/corpus.bin}
+  if [ ! -f $NATIVE ]; then
+    bash run.sh > /dev/null
+  fi
+  if [ ! -f $CORPUS ]; then
+    $NATIVE -gen-corpus > $CORPUS
+  fi
+  make -C ../.. validate_signature_rsa_sim-via-docker
+  $NATIVE -corpus-hex < $CORPUS | while read batch; do
+    $BENCH_RUNNER ../../build/validate_signature_rsa_sim ckbvm -corpus $batch | grep -o "corpus_cycles,.*"
+  done | awk -F, '{ n += $2; bad += $3; cycles += $4 }
+    END { print "records,mismatches,cycles"; print n "," bad "," cycles; exit (bad != 0) }'
+  exit 0
+fi
+
 make -C ../.. validate_signature_rsa_sim-via-docker
 
 run -iso97962_test2
@@ -0,0 +1,37 @@
+set -e
+cd "$(dirname "${BASH_SOURCE[0]}")"
+
+# Size and cycle report of the RSA library variants, see
+# validate_signature_rsa-size-report in the top Makefile.
+# Cycles come from the example lock (examples/validate-signature-rsa), which
+# loads the library with ckb_dlopen2. The lock pins the code hash of the
+# library when it's built, so it's rebuilt for every variant with
+# build-without-capsule.sh (see its requirements), and once more with the
+# original library at the end.
+
+VARIANTS="validate_signature_rsa validate_signature_rsa_min validate_signature_rsa_os validate_signature_rsa_lto validate_signature_rsa_prelinked"
+DLOPEN_SIM=build.simulator/dlopen_sim
+EXAMPLE=../../examples/validate-signature-rsa
+DYLIB=$EXAMPLE/dynamic-libray/validate_signature_rsa
+
+make -C ../.. validate_signature_rsa-size-report-via-docker
+
+if [ ! -f $DLOPEN_SIM ]; then
+  bash run.sh > /dev/null
+fi
+for v in $VARIANTS; do
+  $DLOPEN_SIM ../../build/$v
+done | awk 'NR == 1 || !/^binary,/'
+
+if [ -f $DYLIB ]; then
+  cp $DYLIB $DYLIB.orig
+fi
+trap 'if [ -f $DYLIB.orig ]; then mv $DYLIB.orig $DYLIB; bash $EXAMPLE/build-without-capsule.sh > /dev/null; fi' EXIT
+
+printf "%-36s %12s\n" binary cycles
+for v in $VARIANTS; do
+  cp ../../build/$v $DYLIB
+  bash $EXAMPLE/build-without-capsule.sh > /dev/null
+  cycles=$(cd $EXAMPLE && cargo test -p tests rsa_tests::test_rsa_random_1024 -- --exact --nocapture 2>&1 | grep "consume cycles" | awk '{ print $3 }')
+  printf "%-36s %12s\n" build/$v "${cycles:-failed}"
+done
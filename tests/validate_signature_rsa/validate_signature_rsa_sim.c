@@ -13,8 +13,11 @@
 #include <stdlib.h>
 
 #include "mbedtls/ctr_drbg.h"
+#include "mbedtls/ecdsa.h"
 #include "mbedtls/entropy.h"
 #include "mbedtls/md.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/sha512.h"
 #include "validate_signature_rsa.c"
 
 #define EXPONENT 65537
@@ -351,136 +354,1801 @@ int test_validate_signature(uint8_t key_size_enum, uint8_t md_type,
                            output, &output_len);
   CHECK(err);
 
+  // streaming interface, message fed in 3 pieces
+  ValidateSignatureContext ctx;
+  err = validate_signature_init(NULL, &ctx, sig_buff, sig_buff_size);
+  CHECK(err);
+  err = validate_signature_update(&ctx, msg, 5);
+  CHECK(err);
+  err = validate_signature_update(&ctx, msg + 5, 0);
+  CHECK(err);
+  err = validate_signature_update(&ctx, msg + 5, sizeof(msg) - 5);
+  CHECK(err);
+  err = validate_signature_final(&ctx, output, &output_len);
+  CHECK(err);
+#ifdef CKB_COVERAGE
+  // finalized context is rejected
+  CHECK2(validate_signature_update(&ctx, msg, sizeof(msg)) ==
+             ERROR_RSA_INVALID_PARAM1,
+         -1);
+#endif
+
+  err = 0;
+exit:
+  if (err == 0) {
+    mbedtls_printf(
+        "test_validate_signature() passed: key size = %d, md_type = %d, "
+        "padding = "
+        "%d\n",
+        key_size, md_type, padding);
+  } else {
+    mbedtls_printf(
+        "test_validate_signature() failed: key size = %d, md_type = %d, "
+        "padding = "
+        "%d\n",
+        key_size, md_type, padding);
+  }
+  return err;
+}
+
+void reset_rsa_info(RsaInfo* info) {
+  info->algorithm_id = CKB_VERIFY_RSA;
+  info->key_size = CKB_KEYSIZE_1024;
+  info->padding = CKB_PKCS_15;
+  info->md_type = CKB_MD_SHA256;
+}
+
+int validate_signature_error_cases_test(void) {
+  int err = 0;
+
+  uint8_t padding = CKB_PKCS_15;
+  uint8_t key_size_enum = CKB_KEYSIZE_1024;
+  uint8_t md_type = CKB_MD_SHA256;
+  uint32_t key_size = get_key_size(key_size_enum);
+  uint8_t msg[32] = {1, 2, 3, 4};
+  uint32_t sig_buff_size = calculate_rsa_info_length(key_size);
+  uint8_t sig_buff[sig_buff_size];
+  RsaInfo* info = (RsaInfo*)sig_buff;
+  info->algorithm_id = CKB_VERIFY_RSA;
+  info->key_size = key_size_enum;
+  info->padding = padding;
+  info->md_type = md_type;
+
+  size_t len = 0;
+  load_prefilled_data(NULL, &len);
+  mbedtls_hardware_poll(0, 0, 0, 0);
+
+  reset_rsa_info(info);
+  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
+                           NULL, NULL);
+  CHECK2(err == ERROR_RSA_VERIFY_FAILED, -1);
+
+  reset_rsa_info(info);
+  info->algorithm_id = 100;
+  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
+                           NULL, NULL);
+  CHECK2(err == ERROR_RSA_INVALID_ID, -1);
+
+  reset_rsa_info(info);
+  err = validate_signature(NULL, NULL, sig_buff_size, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_RSA_INVALID_PARAM1, -1);
+
+  reset_rsa_info(info);
+  info->md_type = 100;
+  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
+                           NULL, NULL);
+  CHECK2(err == ERROR_INVALID_MD_TYPE, -1);
+
+  reset_rsa_info(info);
+  info->padding = 100;
+  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
+                           NULL, NULL);
+  CHECK2(err == ERROR_INVALID_PADDING, -1);
+
+  reset_rsa_info(info);
+  info->key_size = 100;
+  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
+                           NULL, NULL);
+  CHECK2(err == ERROR_RSA_INVALID_KEY_SIZE, -1);
+
+  reset_rsa_info(info);
+  err = validate_signature(NULL, NULL, sig_buff_size, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_RSA_INVALID_PARAM1, -1);
+
+  reset_rsa_info(info);
+  err = validate_signature(NULL, sig_buff, sig_buff_size, NULL, sizeof(msg),
+                           NULL, NULL);
+  CHECK2(err == ERROR_RSA_INVALID_PARAM1, -1);
+
+  reset_rsa_info(info);
+  err = validate_signature(NULL, sig_buff, 0, msg, sizeof(msg), NULL, NULL);
+  CHECK2(err == ERROR_RSA_INVALID_PARAM2, -1);
+
+  err = 0;
+exit:
+  if (err == 0) {
+    mbedtls_printf("validate_signature_error_cases_test() passed.\n");
+  } else {
+    mbedtls_printf("validate_signature_error_cases_test() failed.\n");
+  }
+  return err;
+}
+
+// cover all test cases
+int validate_signature_all_test(void) {
+  int err = 0;
+  uint8_t md_type_set[] = {CKB_MD_SHA224, CKB_MD_SHA256, CKB_MD_SHA384,
+                           CKB_MD_SHA512};
+  uint8_t key_size_set[] = {CKB_KEYSIZE_1024, CKB_KEYSIZE_2048,
+                            CKB_KEYSIZE_4096};
+  //  uint8_t key_size_set[] = {CKB_KEYSIZE_1024};
+  uint8_t padding_set[] = {CKB_PKCS_15, CKB_PKCS_21};
+  for (int i = 0; i < count_of(key_size_set); i++) {
+    for (int j = 0; j < count_of(md_type_set); j++) {
+      for (int k = 0; k < count_of(padding_set); k++) {
+        err = test_validate_signature(key_size_set[i], md_type_set[j],
+                                      padding_set[k]);
+        CHECK(err);
+      }
+    }
+  }
+  err = 0;
+exit:
+  if (err == 0) {
+    mbedtls_printf("validate_signature_all_test() passed.\n");
+  } else {
+    mbedtls_printf("validate_signature_all_test() failed.\n");
+  }
+  return err;
+}
+
+int test_validate_signature_batch(uint8_t key_size_enum, uint8_t md_type,
+                                  uint8_t padding) {
+  int err = 0;
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  uint32_t key_size = get_key_size(key_size_enum);
+  uint32_t byte_size = key_size / 8;
+  uint32_t pubkey_size = calculate_rsa_info_length(key_size) - byte_size;
+  uint8_t pubkey_buff[calculate_rsa_info_length(key_size)];
+  RsaInfo* info = (RsaInfo*)pubkey_buff;
+  mbedtls_rsa_context rsa;
+
+  info->algorithm_id = CKB_VERIFY_RSA;
+  info->key_size = key_size_enum;
+  info->padding = padding;
+  info->md_type = md_type;
+
+  err = gen_rsa_key(key_size, &rsa, info);
+  CHECK(err);
+  export_public_key(&rsa, info);
+
+  uint8_t msgs[4][40];
+  uint8_t sigs[4][512];
+  ValidateSignatureBatchItem items[4];
+  size_t count = count_of(items);
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < sizeof(msgs[i]); j++) {
+      msgs[i][j] = (uint8_t)(i * 31 + j);
+    }
+    err = rsa_sign(&rsa, msgs[i], 10 * i, sigs[i], info);
+    CHECK(err);
+    items[i].sig = sigs[i];
+    items[i].msg = msgs[i];
+    items[i].msg_len = 10 * i;
+  }
+
+  size_t failed_index = 0;
+  err = validate_signature_batch(NULL, pubkey_buff, pubkey_size, items, count,
+                                 &failed_index);
+  CHECK(err);
+
+#ifdef CKB_COVERAGE
+  // the wrong one is reported
+  msgs[2][0] ^= 1;
+  CHECK2(validate_signature_batch(NULL, pubkey_buff, pubkey_size, items, count,
+                                  &failed_index) == ERROR_RSA_VERIFY_FAILED,
+         -1);
+  CHECK2(failed_index == 2, -1);
+  msgs[2][0] ^= 1;
+  // the public key is not followed by a signature
+  CHECK2(validate_signature_batch(NULL, pubkey_buff, pubkey_size + byte_size,
+                                  items, count,
+                                  &failed_index) == ERROR_RSA_INVALID_PARAM2,
+         -1);
+#endif
+
+  err = 0;
+exit:
+  mbedtls_rsa_free(&rsa);
+  if (err == 0) {
+    mbedtls_printf(
+        "test_validate_signature_batch() passed: key size = %d, padding = "
+        "%d\n",
+        key_size, padding);
+  } else {
+    mbedtls_printf(
+        "test_validate_signature_batch() failed: key size = %d, padding = "
+        "%d\n",
+        key_size, padding);
+  }
+  return err;
+}
+
+// the stack-only MdContext must give the same digests as mbedtls_md
+int md_context_test(void) {
+  int err = 0;
+  mbedtls_md_type_t md_type_set[] = {MBEDTLS_MD_SHA1, MBEDTLS_MD_SHA224,
+                                     MBEDTLS_MD_SHA256, MBEDTLS_MD_SHA384,
+                                     MBEDTLS_MD_SHA512};
+  uint8_t msg[300];
+  for (int i = 0; i < sizeof(msg); i++) {
+    msg[i] = (uint8_t)(i * 7 + 3);
+  }
+  size_t msg_len_set[] = {0, 1, 55, 56, 64, 111, 112, 128, 300};
+
+  for (int i = 0; i < count_of(md_type_set); i++) {
+    const mbedtls_md_info_t* md_info =
+        mbedtls_md_info_from_type(md_type_set[i]);
+    for (int j = 0; j < count_of(msg_len_set); j++) {
+      size_t msg_len = msg_len_set[j];
+      uint8_t expected[MBEDTLS_MD_MAX_SIZE];
+      uint8_t hash[MBEDTLS_MD_MAX_SIZE];
+      err = mbedtls_md(md_info, msg, msg_len, expected);
+      CHECK(err);
+
+      err = md_string(md_info, msg, msg_len, hash);
+      CHECK(err);
+      CHECK2(memcmp(expected, hash, md_info->size) == 0, -1);
+
+      // feed it in uneven pieces
+      MdContext ctx;
+      err = md_starts(&ctx, md_type_set[i]);
+      CHECK(err);
+      size_t pos = 0;
+      for (size_t piece = 1; pos < msg_len; piece += 13) {
+        size_t n = piece > msg_len - pos ? msg_len - pos : piece;
+        err = md_update(&ctx, msg + pos, n);
+        CHECK(err);
+        pos += n;
+      }
+      err = md_finish(&ctx, hash);
+      CHECK(err);
+      CHECK2(memcmp(expected, hash, md_info->size) == 0, -1);
+    }
+  }
+
+  err = 0;
+exit:
+  if (err == 0) {
+    mbedtls_printf("md_context_test() passed.\n");
+  } else {
+    mbedtls_printf("md_context_test() failed.\n");
+  }
+  return err;
+}
+
+// rsa_sha2.h must be bit-exact with the portable mbedtls code
+int sha2_kernel_test(void) {
+  int err = 0;
+  static uint8_t msg[4099];
+  for (int i = 0; i < sizeof(msg); i++) {
+    msg[i] = (uint8_t)rand();
+  }
+
+  for (size_t len = 0; len <= sizeof(msg); len += (len < 260 ? 1 : 97)) {
+    uint8_t expected[64];
+    uint8_t hash[64];
+    for (int is_short = 0; is_short < 2; is_short++) {
+      RsaSha256Context ctx256;
+      err = mbedtls_sha256_ret(msg, len, expected, is_short);
+      CHECK(err);
+      rsa_sha256_starts(&ctx256, is_short);
+      rsa_sha256_update(&ctx256, msg, len);
+      rsa_sha256_finish(&ctx256, hash);
+      CHECK2(memcmp(expected, hash, is_short ? 28 : 32) == 0, -1);
+
+      RsaSha512Context ctx512;
+      err = mbedtls_sha512_ret(msg, len, expected, is_short);
+      CHECK(err);
+      // split at an odd position, across the block boundary
+      size_t split = len / 3;
+      rsa_sha512_starts(&ctx512, is_short);
+      rsa_sha512_update(&ctx512, msg, split);
+      rsa_sha512_update(&ctx512, msg + split, len - split);
+      rsa_sha512_finish(&ctx512, hash);
+      CHECK2(memcmp(expected, hash, is_short ? 48 : 64) == 0, -1);
+    }
+  }
+
+  err = 0;
+exit:
+  if (err == 0) {
+    mbedtls_printf("sha2_kernel_test() passed.\n");
+  } else {
+    mbedtls_printf("sha2_kernel_test() failed.\n");
+  }
+  return err;
+}
+
+// rsa_mont_exp_public must be bit-exact with mbedtls_rsa_public
+int rsa_public_fast_test(void) {
+  int err = 0;
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  uint8_t key_size_set[] = {CKB_KEYSIZE_1024, CKB_KEYSIZE_2048,
+                            CKB_KEYSIZE_4096};
+  for (int i = 0; i < count_of(key_size_set); i++) {
+    uint32_t key_size = get_key_size(key_size_set[i]);
+    uint32_t byte_size = key_size / 8;
+    uint8_t info_buff[calculate_rsa_info_length(key_size)];
+    RsaInfo* info = (RsaInfo*)info_buff;
+    info->algorithm_id = CKB_VERIFY_RSA;
+    info->key_size = key_size_set[i];
+    info->padding = CKB_PKCS_15;
+    info->md_type = CKB_MD_SHA256;
+
+    mbedtls_rsa_context rsa;
+    err = gen_rsa_key(key_size, &rsa, info);
+    CHECK(err);
+    export_public_key(&rsa, info);
+
+    RsaMontContext mont;
+    err = rsa_mont_init(&mont, info->N, byte_size);
+    CHECK(err);
+
+    for (int j = 0; j < 20; j++) {
+      uint8_t input[byte_size];
+      uint8_t expected[byte_size];
+      uint8_t output[byte_size];
+      for (uint32_t k = 0; k < byte_size; k++) {
+        input[k] = (uint8_t)rand();
+      }
+      // keep it below N
+      input[0] = (uint8_t)(j % 0x40);
+      if (j == 1) {
+        memset(input, 0, byte_size);
+        input[byte_size - 1] = 1;
+      }
+      err = mbedtls_rsa_public(&rsa, input, expected);
+      CHECK(err);
+      err = rsa_mont_exp_public(&mont, input, EXPONENT, output);
+      CHECK(err);
+      CHECK2(memcmp(expected, output, byte_size) == 0, -1);
+    }
+    // out of range input is rejected, as mbedtls does
+    uint8_t input[byte_size];
+    uint8_t output[byte_size];
+    memset(input, 0xFF, byte_size);
+    CHECK2(rsa_mont_exp_public(&mont, input, EXPONENT, output) ==
+               RSA_MONT_ERROR_INPUT_TOO_LARGE,
+           -1);
+    mbedtls_rsa_free(&rsa);
+  }
+
+  err = 0;
+exit:
+  if (err == 0) {
+    mbedtls_printf("rsa_public_fast_test() passed.\n");
+  } else {
+    mbedtls_printf("rsa_public_fast_test() failed.\n");
+  }
+  return err;
+}
+
+// The product kernels of rsa_montgomery.h (Comba, Karatsuba for 4096 bits)
+// and the Montgomery multiplication built on them, bit-exact against
+// mbedtls_mpi_mul_mpi. Limbs are compared as little endian bytes.
+int rsa_mul_kernel_test(void) {
+  int err = 0;
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  mbedtls_mpi A, B, P, N;
+  mbedtls_mpi_init(&A);
+  mbedtls_mpi_init(&B);
+  mbedtls_mpi_init(&P);
+  mbedtls_mpi_init(&N);
+
+  uint32_t key_size_set[] = {1024, 2048, 4096};
+  for (int i = 0; i < count_of(key_size_set); i++) {
+    uint32_t n = key_size_set[i] / RSA_LIMB_BITS;
+    uint32_t byte_size = n * RSA_LIMB_BYTES;
+    void (*mul)(rsa_limb_t*, const rsa_limb_t*, const rsa_limb_t*) =
+        n == 1024 / RSA_LIMB_BITS   ? rsa_mul_1024
+        : n == 2048 / RSA_LIMB_BITS ? rsa_mul_2048
+                                    : rsa_mul_4096;
+    uint8_t n_le[4096 / 8];
+    rsa_limb_t a[RSA_MAX_LIMBS];
+    rsa_limb_t b[RSA_MAX_LIMBS];
+    rsa_limb_t r[RSA_MAX_LIMBS];
+    rsa_limb_t product[2 * RSA_MAX_LIMBS];
+    uint8_t expected[2 * 4096 / 8];
+    RsaMontContext mont;
+
+    for (uint32_t k = 0; k < byte_size; k++) {
+      n_le[k] = (uint8_t)rand();
+    }
+    n_le[0] |= 1;
+    n_le[byte_size - 1] |= 0x80;
+    CHECK2(rsa_mont_init(&mont, n_le, byte_size) == RSA_MONT_SUCCESS, -1);
+    err = mbedtls_mpi_read_binary_le(&N, n_le, byte_size);
+    CHECK(err);
+
+    for (int j = 0; j < 20; j++) {
+      for (uint32_t k = 0; k < n; k++) {
+        a[k] = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand();
+        b[k] = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand();
+      }
+      // the longest carry chains, in the sums of Karatsuba too
+      if (j == 1 || j == 2) {
+        memset(a, 0xFF, byte_size);
+        memset(b, 0xFF, byte_size);
+      }
+      if (j == 2) {
+        memset(a + n / 2, 0, byte_size / 2);
+        memset(b, 0, byte_size / 2);
+      }
+
+      mul(product, a, b);
+      err = mbedtls_mpi_read_binary_le(&A, (const uint8_t*)a, byte_size);
+      CHECK(err);
+      err = mbedtls_mpi_read_binary_le(&B, (const uint8_t*)b, byte_size);
+      CHECK(err);
+      err = mbedtls_mpi_mul_mpi(&P, &A, &B);
+      CHECK(err);
+      err = mbedtls_mpi_write_binary_le(&P, expected, 2 * byte_size);
+      CHECK(err);
+      CHECK2(memcmp(expected, product, 2 * byte_size) == 0, -1);
+
+      // a * b / R, then times R^2 / R: a * b mod N
+      err = mbedtls_mpi_mod_mpi(&A, &A, &N);
+      CHECK(err);
+      err = mbedtls_mpi_mod_mpi(&B, &B, &N);
+      CHECK(err);
+      err = mbedtls_mpi_write_binary_le(&A, (uint8_t*)a, byte_size);
+      CHECK(err);
+      err = mbedtls_mpi_write_binary_le(&B, (uint8_t*)b, byte_size);
+      CHECK(err);
+      rsa_mont_mul(&mont, r, a, b);
+      // same result as the CIOS multiplication
+      rsa_mont_mul_any(&mont, product, a, b);
+      CHECK2(memcmp(r, product, byte_size) == 0, -1);
+      rsa_mont_mul(&mont, r, r, mont.RR);
+      err = mbedtls_mpi_mul_mpi(&P, &A, &B);
+      CHECK(err);
+      err = mbedtls_mpi_mod_mpi(&P, &P, &N);
+      CHECK(err);
+      err = mbedtls_mpi_write_binary_le(&P, expected, byte_size);
+      CHECK(err);
+      CHECK2(memcmp(expected, r, byte_size) == 0, -1);
+    }
+  }
+
+  err = 0;
+exit:
+  mbedtls_mpi_free(&A);
+  mbedtls_mpi_free(&B);
+  mbedtls_mpi_free(&P);
+  mbedtls_mpi_free(&N);
+  if (err == 0) {
+    mbedtls_printf("rsa_mul_kernel_test() passed.\n");
+  } else {
+    mbedtls_printf("rsa_mul_kernel_test() failed.\n");
+  }
+  return err;
+}
+
+// rsa_pss_verify_mont must accept what mbedtls signs and reject what
+// mbedtls_rsa_rsassa_pss_verify rejects
+int rsa_pss_verify_test(void) {
+  int err = 0;
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  uint8_t key_size_set[] = {CKB_KEYSIZE_1024, CKB_KEYSIZE_2048,
+                            CKB_KEYSIZE_4096};
+  uint8_t md_type_set[] = {CKB_MD_SHA1, CKB_MD_SHA224, CKB_MD_SHA256,
+                           CKB_MD_SHA384, CKB_MD_SHA512};
+  for (int i = 0; i < count_of(key_size_set); i++) {
+    uint32_t key_size = get_key_size(key_size_set[i]);
+    uint32_t byte_size = key_size / 8;
+    uint8_t info_buff[calculate_rsa_info_length(key_size)];
+    RsaInfo* info = (RsaInfo*)info_buff;
+    info->algorithm_id = CKB_VERIFY_RSA;
+    info->key_size = key_size_set[i];
+    info->padding = CKB_PKCS_21;
+    info->md_type = CKB_MD_SHA256;
+
+    mbedtls_rsa_context rsa;
+    err = gen_rsa_key(key_size, &rsa, info);
+    CHECK(err);
+    export_public_key(&rsa, info);
+
+    RsaMontContext mont;
+    err = rsa_mont_init(&mont, info->N, byte_size);
+    CHECK(err);
+
+    for (int j = 0; j < count_of(md_type_set); j++) {
+      uint8_t msg[64] = {(uint8_t)i, (uint8_t)j};
+      uint8_t sig[byte_size];
+      mbedtls_md_type_t md_type = convert_md_type(md_type_set[j]);
+      const mbedtls_md_info_t* md_info = mbedtls_md_info_from_type(md_type);
+      uint8_t hash[MBEDTLS_MD_MAX_SIZE];
+
+      info->md_type = md_type_set[j];
+      mbedtls_rsa_set_padding(&rsa, MBEDTLS_RSA_PKCS_V21, md_type);
+      err = rsa_sign(&rsa, msg, sizeof(msg), sig, info);
+      CHECK(err);
+      err = md_string(md_info, msg, sizeof(msg), hash);
+      CHECK(err);
+      err = rsa_pss_verify_mont(&mont, EXPONENT, sig, md_type, hash,
+                                md_info->size);
+      CHECK(err);
+
+#ifdef CKB_COVERAGE
+      hash[0] ^= 1;
+      CHECK2(rsa_pss_verify_mont(&mont, EXPONENT, sig, md_type, hash,
+                                 md_info->size) == ERROR_RSA_VERIFY_FAILED,
+             -1);
+      hash[0] ^= 1;
+      for (uint32_t k = 0; k < byte_size; k += byte_size / 8) {
+        sig[k] ^= 0x10;
+        int expected = mbedtls_rsa_pkcs1_verify(&rsa, NULL, NULL,
+                                                MBEDTLS_RSA_PUBLIC, md_type,
+                                                md_info->size, hash, sig);
+        CHECK2(expected != 0, -1);
+        CHECK2(rsa_pss_verify_mont(&mont, EXPONENT, sig, md_type, hash,
+                                   md_info->size) != 0,
+               -1);
+        sig[k] ^= 0x10;
+      }
+#endif
+    }
+    mbedtls_rsa_free(&rsa);
+  }
+
+  err = 0;
+exit:
+  if (err == 0) {
+    mbedtls_printf("rsa_pss_verify_test() passed.\n");
+  } else {
+    mbedtls_printf("rsa_pss_verify_test() failed.\n");
+  }
+  return err;
+}
+
+// Sign msg with a new key. The mbedtls objects are freed before returning:
+// validate_signature replaces the heap of mbedtls with its own arena.
+int secp256r1_sign(const uint8_t* msg, size_t msg_len, Secp256r1Info* info) {
+  int err = 0;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  mbedtls_ecdsa_context ecdsa;
+  mbedtls_mpi r;
+  mbedtls_mpi s;
+  const char* pers = "secp256r1_genkey";
+  uint8_t hash[32];
+  uint8_t point[65];
+  size_t point_len = 0;
+
+  mbedtls_ctr_drbg_init(&ctr_drbg);
+  mbedtls_entropy_init(&entropy);
+  mbedtls_ecdsa_init(&ecdsa);
+  mbedtls_mpi_init(&r);
+  mbedtls_mpi_init(&s);
+
+  err = mbedtls_entropy_add_source(&entropy, fake_random_entropy_poll, NULL, 32,
+                                   MBEDTLS_ENTROPY_SOURCE_STRONG);
+  CHECK(err);
+  err = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy,
+                              (const unsigned char*)pers, strlen(pers));
+  CHECK(err);
+  err = mbedtls_ecdsa_genkey(&ecdsa, MBEDTLS_ECP_DP_SECP256R1,
+                             mbedtls_ctr_drbg_random, &ctr_drbg);
+  CHECK(err);
+
+  info->algorithm_id = CKB_VERIFY_SECP256R1;
+  info->key_size = CKB_KEYSIZE_P256;
+  info->padding = 0;
+  info->md_type = CKB_MD_SHA256;
+  err = mbedtls_ecp_point_write_binary(&ecdsa.grp, &ecdsa.Q,
+                                       MBEDTLS_ECP_PF_UNCOMPRESSED, &point_len,
+                                       point, sizeof(point));
+  CHECK(err);
+  CHECK2(point_len == sizeof(point) && point[0] == 0x04, -1);
+  memcpy(info->pubkey, point + 1, sizeof(info->pubkey));
+
+  err = md_string(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), msg, msg_len,
+                  hash);
+  CHECK(err);
+  err = mbedtls_ecdsa_sign(&ecdsa.grp, &r, &s, &ecdsa.d, hash, sizeof(hash),
+                           mbedtls_ctr_drbg_random, &ctr_drbg);
+  CHECK(err);
+  err = mbedtls_mpi_write_binary(&r, info->sig, 32);
+  CHECK(err);
+  err = mbedtls_mpi_write_binary(&s, info->sig + 32, 32);
+  CHECK(err);
+
+  err = 0;
+exit:
+  mbedtls_mpi_free(&s);
+  mbedtls_mpi_free(&r);
+  mbedtls_ecdsa_free(&ecdsa);
+  mbedtls_ctr_drbg_free(&ctr_drbg);
+  mbedtls_entropy_free(&entropy);
+  return err;
+}
+
+int test_validate_signature_secp256r1(void) {
+  int err = 0;
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  uint8_t msg[37] = {1, 2, 3, 4};
+  Secp256r1Info info;
+  err = secp256r1_sign(msg, sizeof(msg), &info);
+  CHECK(err);
+
+  err = validate_signature(NULL, (uint8_t*)&info, sizeof(info), msg,
+                           sizeof(msg), NULL, NULL);
+  CHECK(err);
+
+#if defined(MBEDTLS_MEMORY_DEBUG)
+  // SECP256R1_ARENA_SIZE is the peak plus the margin, at least. The peak
+  // counts the block headers but not fragmentation, which the margin covers.
+  mbedtls_printf("secp256r1 arena: peak %d bytes, %d with the margin\n",
+                 (int)g_signature_arena_peak,
+                 (int)(g_signature_arena_peak +
+                       g_signature_arena_peak *
+                           SECP256R1_ARENA_MARGIN_PERCENT / 100));
+  CHECK2(g_signature_arena_peak > 0, -1);
+  CHECK2(g_signature_arena_peak +
+                 g_signature_arena_peak * SECP256R1_ARENA_MARGIN_PERCENT /
+                     100 <=
+             SECP256R1_ARENA_SIZE,
+         -1);
+#endif
+
+#ifdef CKB_COVERAGE
+  msg[0] ^= 1;
+  err = validate_signature(NULL, (uint8_t*)&info, sizeof(info), msg,
+                           sizeof(msg), NULL, NULL);
+  CHECK2(err == ERROR_SECP256R1_VERIFY_FAILED, -1);
+  msg[0] ^= 1;
+
+  // not on the curve
+  info.pubkey[63] ^= 1;
+  err = validate_signature(NULL, (uint8_t*)&info, sizeof(info), msg,
+                           sizeof(msg), NULL, NULL);
+  CHECK2(err == ERROR_SECP256R1_INVALID_PUBKEY, -1);
+  info.pubkey[63] ^= 1;
+
+  // s = 0
+  uint8_t saved[32];
+  memcpy(saved, info.sig + 32, 32);
+  memset(info.sig + 32, 0, 32);
+  err = validate_signature(NULL, (uint8_t*)&info, sizeof(info), msg,
+                           sizeof(msg), NULL, NULL);
+  CHECK2(err == ERROR_SECP256R1_VERIFY_FAILED, -1);
+  memcpy(info.sig + 32, saved, 32);
+
+  info.md_type = CKB_MD_SHA512;
+  err = validate_signature(NULL, (uint8_t*)&info, sizeof(info), msg,
+                           sizeof(msg), NULL, NULL);
+  CHECK2(err == ERROR_INVALID_MD_TYPE, -1);
+  info.md_type = CKB_MD_SHA256;
+
+  info.key_size = CKB_KEYSIZE_1024;
+  err = validate_signature(NULL, (uint8_t*)&info, sizeof(info), msg,
+                           sizeof(msg), NULL, NULL);
+  CHECK2(err == ERROR_RSA_INVALID_KEY_SIZE, -1);
+  info.key_size = CKB_KEYSIZE_P256;
+
+  err = validate_signature(NULL, (uint8_t*)&info, sizeof(info) - 1, msg,
+                           sizeof(msg), NULL, NULL);
+  CHECK2(err == ERROR_RSA_INVALID_PARAM2, -1);
+
+  err = validate_signature(NULL, (uint8_t*)&info, sizeof(info), msg,
+                           sizeof(msg), NULL, NULL);
+  CHECK(err);
+#endif
+
+  err = 0;
+exit:
+  if (err == 0) {
+    mbedtls_printf("test_validate_signature_secp256r1() passed.\n");
+  } else {
+    mbedtls_printf("test_validate_signature_secp256r1() failed.\n");
+  }
+  return err;
+}
+
+// the RsaPrecomputedKey is built off-chain, when the key cell is created
+int build_precomputed_key(const RsaInfo* info, RsaPrecomputedKey* key) {
+  int err = 0;
+  uint32_t key_size = get_key_size(info->key_size);
+  uint32_t byte_size = key_size / 8;
+  RsaMontContext mont;
+
+  err = rsa_mont_init(&mont, info->N, byte_size);
+  CHECK(err);
+
+  memset(key, 0, calculate_precomputed_key_length(key_size));
+  key->magic = RSA_PRECOMPUTED_KEY_MAGIC;
+  key->algorithm_id = CKB_VERIFY_RSA;
+  key->key_size = info->key_size;
+  key->padding = info->padding;
+  key->md_type = info->md_type;
+  key->E = info->E;
+  key->mm = mont.mm;
+  memcpy(key->N, info->N, byte_size);
+  uint8_t* rr = get_precomputed_rr(key);
+  for (uint32_t i = 0; i < mont.limbs; i++) {
+    for (uint32_t j = 0; j < RSA_LIMB_BYTES; j++) {
+      rr[i * RSA_LIMB_BYTES + j] = (uint8_t)(mont.RR[i] >> (8 * j));
+    }
+  }
+  rsa_precomputed_key_hash(key, key->key_hash);
+
+  err = 0;
+exit:
+  return err;
+}
+
+// A lock finds its key cell among the cell deps by the hash in its args: the
+// first one with this key_hash. The library makes sure key_hash is the hash of
+// the key in the cell.
+int lock_find_precomputed_key(const uint8_t* args, uint8_t* const* cells,
+                              const size_t* cell_lens, size_t count,
+                              RsaPrecomputedKey** found) {
+  for (size_t i = 0; i < count; i++) {
+    RsaPrecomputedKey* key = (RsaPrecomputedKey*)cells[i];
+    size_t len = cell_lens[i];
+    if (len < offsetof(RsaPrecomputedKey, N) ||
+        key->magic != RSA_PRECOMPUTED_KEY_MAGIC ||
+        memcmp(key->key_hash, args, RSA_KEY_HASH_SIZE) != 0) {
+      continue;
+    }
+    int err = load_prefilled_data(key, &len);
+    if (err != 0) {
+      return err;
+    }
+    *found = key;
+    return 0;
+  }
+  return ERROR_RSA_INVALID_PRECOMPUTED_KEY;
+}
+
+int test_validate_signature_precomputed(uint8_t key_size_enum, uint8_t md_type,
+                                        uint8_t padding) {
+  int err = 0;
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  uint32_t key_size = get_key_size(key_size_enum);
+  uint8_t msg[32] = {1, 2, 3, 4};
+  uint8_t info_buff[calculate_rsa_info_length(key_size)];
+  RsaInfo* info = (RsaInfo*)info_buff;
+  info->algorithm_id = CKB_VERIFY_RSA;
+  info->key_size = key_size_enum;
+  info->padding = padding;
+  info->md_type = md_type;
+
+  size_t key_len = calculate_precomputed_key_length(key_size);
+  uint8_t key_buff[key_len];
+  RsaPrecomputedKey* key = (RsaPrecomputedKey*)key_buff;
+  // a key cell claiming the same key_hash, for another N
+  uint64_t forged_buff[(key_len + 7) / 8];
+  uint8_t* forged = (uint8_t*)forged_buff;
+  size_t sig_len = offsetof(RsaSignatureOnly, sig) + key_size / 8;
+  uint8_t sig_buff[sig_len];
+  RsaSignatureOnly* sig = (RsaSignatureOnly*)sig_buff;
+
+  mbedtls_rsa_context rsa;
+  err = gen_rsa_key(key_size, &rsa, info);
+  CHECK(err);
+  export_public_key(&rsa, info);
+  err = build_precomputed_key(info, key);
+  CHECK(err);
+
+  sig->algorithm_id = CKB_VERIFY_RSA_PRECOMPUTED;
+  sig->key_size = key_size_enum;
+  sig->padding = padding;
+  sig->md_type = md_type;
+  err = rsa_sign(&rsa, msg, sizeof(msg), sig->sig, info);
+  CHECK(err);
+
+  size_t len = key_len;
+  err = load_prefilled_data(key, &len);
+  CHECK(err);
+  // loading twice is fine
+  err = load_prefilled_data(key, &len);
+  CHECK(err);
+
+  err = validate_signature(key, sig_buff, sig_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK(err);
+
+  // the args of the lock: blake160(common header + E + N) of the RsaInfo
+  uint8_t args[32];
+  blake2b_state blake2b_ctx;
+  blake2b_init(&blake2b_ctx, sizeof(args));
+  blake2b_update(&blake2b_ctx, info_buff, offsetof(RsaInfo, N) + key_size / 8);
+  blake2b_final(&blake2b_ctx, args, sizeof(args));
+  uint8_t* cells[3];
+  size_t cell_lens[3];
+  RsaPrecomputedKey* found = NULL;
+  uint8_t not_a_key[64] = {0};
+  memcpy(forged, key_buff, key_len);
+  ((RsaPrecomputedKey*)forged)->N[0] ^= 2;
+
+  cells[0] = not_a_key;
+  cell_lens[0] = sizeof(not_a_key);
+  cells[1] = key_buff;
+  cell_lens[1] = key_len;
+  err = lock_find_precomputed_key(args, cells, cell_lens, 2, &found);
+  CHECK(err);
+  CHECK2(found == key, -1);
+  err = validate_signature(found, sig_buff, sig_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK(err);
+
+  cells[1] = forged;
+  cells[2] = key_buff;
+  cell_lens[2] = key_len;
+  err = lock_find_precomputed_key(args, cells, cell_lens, 3, &found);
+  CHECK2(err == ERROR_RSA_INVALID_PRECOMPUTED_KEY, -1);
+
+  args[0] ^= 1;
+  err = lock_find_precomputed_key(args, cells, cell_lens, 3, &found);
+  CHECK2(err == ERROR_RSA_INVALID_PRECOMPUTED_KEY, -1);
+
+  // key_hash not matching the key
+  key->key_hash[0] ^= 1;
+  err = load_prefilled_data(key, &len);
+  CHECK2(err == ERROR_RSA_INVALID_PRECOMPUTED_KEY, -1);
+  key->key_hash[0] ^= 1;
+  err = load_prefilled_data(key, &len);
+  CHECK(err);
+
+  // the key changed after load_prefilled_data is checked again
+  key->key_hash[0] ^= 1;
+  err = validate_signature(key, sig_buff, sig_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_RSA_INVALID_PRECOMPUTED_KEY, -1);
+  key->key_hash[0] ^= 1;
+  get_precomputed_rr(key)[0] ^= 1;
+  err = validate_signature(key, sig_buff, sig_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_RSA_INVALID_PRECOMPUTED_KEY, -1);
+  get_precomputed_rr(key)[0] ^= 1;
+
+#ifdef CKB_COVERAGE
+  msg[0] ^= 1;
+  err = validate_signature(key, sig_buff, sig_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_RSA_VERIFY_FAILED, -1);
+  msg[0] ^= 1;
+
+  // R^2 mod N not belonging to N
+  get_precomputed_rr(key)[0] ^= 1;
+  err = load_prefilled_data(key, &len);
+  CHECK2(err == ERROR_RSA_INVALID_PRECOMPUTED_KEY, -1);
+  get_precomputed_rr(key)[0] ^= 1;
+
+  key->mm += 2;
+  err = load_prefilled_data(key, &len);
+  CHECK2(err == ERROR_RSA_INVALID_PRECOMPUTED_KEY, -1);
+  key->mm -= 2;
+
+  len = key_len - 1;
+  err = load_prefilled_data(key, &len);
+  CHECK2(err == ERROR_RSA_INVALID_PARAM2, -1);
+  len = key_len;
+  err = load_prefilled_data(key, &len);
+  CHECK(err);
+
+  sig->md_type = md_type == CKB_MD_SHA256 ? CKB_MD_SHA512 : CKB_MD_SHA256;
+  err = validate_signature(key, sig_buff, sig_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_WRONG_PUBKEY, -1);
+  sig->md_type = md_type;
+#endif
+
+  err = 0;
+exit:
+  mbedtls_rsa_free(&rsa);
+  if (err == 0) {
+    mbedtls_printf(
+        "test_validate_signature_precomputed() passed. key size = %d, "
+        "padding = %d\n",
+        key_size, padding);
+  } else {
+    mbedtls_printf(
+        "test_validate_signature_precomputed() failed. key size = %d, "
+        "padding = %d\n",
+        key_size, padding);
+  }
+  return err;
+}
+
+int test_validate_signature_prefilled(void) {
+  int err = 0;
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+  mbedtls_rsa_context rsa[2];
+  mbedtls_rsa_init(&rsa[0], MBEDTLS_RSA_PKCS_V15, 0);
+  mbedtls_rsa_init(&rsa[1], MBEDTLS_RSA_PKCS_V15, 0);
+
+  size_t cache_len = 0;
+  err = load_prefilled_data(NULL, &cache_len);
+  CHECK(err);
+  CHECK2(cache_len == sizeof(RsaPrefilledCache), -1);
+  uint64_t cache_buff[sizeof(RsaPrefilledCache) / sizeof(uint64_t) + 1];
+  size_t len = sizeof(cache_buff);
+  err = load_prefilled_data(cache_buff, &len);
+  CHECK(err);
+  CHECK2(len == cache_len, -1);
+  RsaPrefilledCache* cache = (RsaPrefilledCache*)cache_buff;
+
+  uint32_t key_size = 1024;
+  uint32_t info_len = calculate_rsa_info_length(key_size);
+  uint8_t msg[32] = {1, 2, 3, 4};
+  uint8_t info_buff[2][sizeof(RsaInfo)];
+  for (int i = 0; i < 2; i++) {
+    RsaInfo* info = (RsaInfo*)info_buff[i];
+    info->algorithm_id = CKB_VERIFY_RSA;
+    info->key_size = CKB_KEYSIZE_1024;
+    info->padding = CKB_PKCS_15;
+    info->md_type = CKB_MD_SHA256;
+    err = gen_rsa_key(key_size, &rsa[i], info);
+    CHECK(err);
+    export_public_key(&rsa[i], info);
+  }
+
+  // the same keys again, only the first two calls prepare them
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 2; i++) {
+      RsaInfo* info = (RsaInfo*)info_buff[i];
+      msg[0] = (uint8_t)round;
+      err = rsa_sign(&rsa[i], msg, sizeof(msg), get_rsa_signature(info), info);
+      CHECK(err);
+      err = validate_signature(cache, info_buff[i], info_len, msg, sizeof(msg),
+                               NULL, NULL);
+      CHECK(err);
+      CHECK2(cache->next == 2, -1);
+    }
+  }
+  CHECK2(cache->keys[2].limbs == 0, -1);
+
+  // streaming goes through the cache too
+  ValidateSignatureContext ctx;
+  err = validate_signature_init(cache, &ctx, info_buff[1], info_len);
+  CHECK(err);
+  err = validate_signature_update(&ctx, msg, sizeof(msg));
+  CHECK(err);
+  err = validate_signature_final(&ctx, NULL, NULL);
+  CHECK(err);
+  CHECK2(cache->next == 2, -1);
+
+#ifdef CKB_COVERAGE
+  // a cached key doesn't make a wrong signature valid
+  msg[0] ^= 1;
+  err = validate_signature(cache, info_buff[0], info_len, msg, sizeof(msg),
+                           NULL, NULL);
+  CHECK2(err == ERROR_RSA_VERIFY_FAILED, -1);
+
+  len = cache_len - 1;
+  err = load_prefilled_data(cache_buff, &len);
+  CHECK2(err == ERROR_RSA_INVALID_PARAM2, -1);
+#endif
+
+  err = 0;
+exit:
+  mbedtls_rsa_free(&rsa[0]);
+  mbedtls_rsa_free(&rsa[1]);
+  if (err == 0) {
+    mbedtls_printf("test_validate_signature_prefilled() passed.\n");
+  } else {
+    mbedtls_printf("test_validate_signature_prefilled() failed.\n");
+  }
+  return err;
+}
+
+// A Rabin-Williams key of CKB_VERIFY_RABIN_WILLIAMS: N = P * Q with
+// P = 3 mod 8 and Q = 7 mod 8.
+typedef struct RwKey {
+  mbedtls_mpi P;
+  mbedtls_mpi Q;
+  mbedtls_mpi N;
+} RwKey;
+
+void rw_key_init(RwKey* key) {
+  mbedtls_mpi_init(&key->P);
+  mbedtls_mpi_init(&key->Q);
+  mbedtls_mpi_init(&key->N);
+}
+
+void rw_key_free(RwKey* key) {
+  mbedtls_mpi_free(&key->P);
+  mbedtls_mpi_free(&key->Q);
+  mbedtls_mpi_free(&key->N);
+}
+
+// a prime of `bits` bits, equal to `residue` mod 8
+int rw_gen_prime(mbedtls_mpi* X, uint32_t bits, mbedtls_mpi_uint residue,
+                 mbedtls_ctr_drbg_context* ctr_drbg) {
+  int err = 0;
+  mbedtls_mpi_uint r = 0;
+  do {
+    err = mbedtls_mpi_gen_prime(X, bits, 0, mbedtls_ctr_drbg_random, ctr_drbg);
+    CHECK(err);
+    err = mbedtls_mpi_mod_int(&r, X, 8);
+    CHECK(err);
+  } while (r != residue);
+exit:
+  return err;
+}
+
+// Generate a key and export its public part to info: E = 2 and N.
+int gen_rw_key(uint32_t key_size, RwKey* key, RsaInfo* info) {
+  int err = 0;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  const char* pers = "rw_genkey";
+
+  mbedtls_ctr_drbg_init(&ctr_drbg);
+  mbedtls_entropy_init(&entropy);
+
+  err = mbedtls_entropy_add_source(&entropy, fake_random_entropy_poll, NULL, 32,
+                                   MBEDTLS_ENTROPY_SOURCE_STRONG);
+  CHECK(err);
+  err = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy,
+                              (const unsigned char*)pers, strlen(pers));
+  CHECK(err);
+
+  err = rw_gen_prime(&key->P, key_size / 2, 3, &ctr_drbg);
+  CHECK(err);
+  err = rw_gen_prime(&key->Q, key_size / 2, 7, &ctr_drbg);
+  CHECK(err);
+  err = mbedtls_mpi_mul_mpi(&key->N, &key->P, &key->Q);
+  CHECK(err);
+
+  err = mbedtls_mpi_write_binary_le(&key->N, info->N, key_size / 8);
+  CHECK(err);
+  info->E = 2;
+
+  err = 0;
+exit:
+  mbedtls_ctr_drbg_free(&ctr_drbg);
+  mbedtls_entropy_free(&entropy);
+  return err;
+}
+
+// EMSA-PKCS1-v1_5 encoding, the one checked by pkcs1_v15_check_encoding
+int pkcs1_v15_encode(uint8_t* em, size_t em_len, mbedtls_md_type_t md_type,
+                     const uint8_t* hash, size_t hash_size) {
+  const uint8_t* prefix = NULL;
+  size_t prefix_len = 0;
+  if (md_type == MBEDTLS_MD_SHA224) {
+    prefix = SHA224_DIGEST_INFO;
+    prefix_len = sizeof(SHA224_DIGEST_INFO);
+  } else if (md_type == MBEDTLS_MD_SHA256) {
+    prefix = SHA256_DIGEST_INFO;
+    prefix_len = sizeof(SHA256_DIGEST_INFO);
+  } else if (md_type == MBEDTLS_MD_SHA384) {
+    prefix = SHA384_DIGEST_INFO;
+    prefix_len = sizeof(SHA384_DIGEST_INFO);
+  } else if (md_type == MBEDTLS_MD_SHA512) {
+    prefix = SHA512_DIGEST_INFO;
+    prefix_len = sizeof(SHA512_DIGEST_INFO);
+  } else {
+    return ERROR_INVALID_MD_TYPE;
+  }
+  size_t ps_end = em_len - prefix_len - hash_size - 1;
+  em[0] = 0x00;
+  em[1] = 0x01;
+  memset(em + 2, 0xFF, ps_end - 2);
+  em[ps_end] = 0x00;
+  memcpy(em + ps_end + 1, prefix, prefix_len);
+  memcpy(em + ps_end + 1 + prefix_len, hash, hash_size);
+  return CKB_SUCCESS;
+}
+
+// Euler's criterion: T is a non-zero square mod the odd prime P
+bool rw_is_square(const mbedtls_mpi* T, const mbedtls_mpi* P) {
+  mbedtls_mpi exp, r;
+  mbedtls_mpi_init(&exp);
+  mbedtls_mpi_init(&r);
+  int ret = mbedtls_mpi_sub_int(&exp, P, 1);
+  ret |= mbedtls_mpi_shift_r(&exp, 1);
+  ret |= mbedtls_mpi_exp_mod(&r, T, &exp, P, NULL);
+  bool square = ret == 0 && mbedtls_mpi_cmp_int(&r, 1) == 0;
+  mbedtls_mpi_free(&exp);
+  mbedtls_mpi_free(&r);
+  return square;
+}
+
+// R = T^((P + 1) / 4) mod P, a square root of T when P = 3 mod 4
+int rw_sqrt_mod(mbedtls_mpi* R, const mbedtls_mpi* T, const mbedtls_mpi* P) {
+  mbedtls_mpi exp;
+  mbedtls_mpi_init(&exp);
+  int ret = mbedtls_mpi_add_int(&exp, P, 1);
+  ret |= mbedtls_mpi_shift_r(&exp, 2);
+  ret |= mbedtls_mpi_exp_mod(R, T, &exp, P, NULL);
+  mbedtls_mpi_free(&exp);
+  return ret;
+}
+
+/**
+ * Sign msg into the signature of info, see CKB_VERIFY_RABIN_WILLIAMS.
+ * The root is deterministic: the CRT combination of the roots mod P and mod Q,
+ * or N minus it when that's smaller.
+ * @param tweak output, bit 0 set when e = -1, bit 1 when f = 2.
+ */
+int rw_sign(const RwKey* key, const uint8_t* msg_buf, uint32_t msg_size,
+            RsaInfo* info, int* tweak) {
+  int err = 0;
+  uint32_t byte_size = get_key_size(info->key_size) / 8;
+  mbedtls_md_type_t md_type = convert_md_type(info->md_type);
+  const mbedtls_md_info_t* md_info = mbedtls_md_info_from_type(md_type);
+  uint8_t hash_buf[MBEDTLS_MD_MAX_SIZE];
+  uint8_t em[byte_size];
+  mbedtls_mpi H, T, S, SP, SQ, QINV;
+  mbedtls_mpi_init(&H);
+  mbedtls_mpi_init(&T);
+  mbedtls_mpi_init(&S);
+  mbedtls_mpi_init(&SP);
+  mbedtls_mpi_init(&SQ);
+  mbedtls_mpi_init(&QINV);
+
+  err = md_string(md_info, msg_buf, msg_size, hash_buf);
+  CHECK(err);
+  err = pkcs1_v15_encode(em, byte_size, md_type, hash_buf, md_info->size);
+  CHECK(err);
+  err = mbedtls_mpi_read_binary(&H, em, byte_size);
+  CHECK(err);
+
+  // T = EM / (e * f): 1 / -1 is -1 and 1 / 2 is (N + 1) / 2
+  for (*tweak = 0; *tweak < 4; (*tweak)++) {
+    err = mbedtls_mpi_copy(&T, &H);
+    CHECK(err);
+    if (*tweak & 1) {
+      err = mbedtls_mpi_sub_mpi(&T, &key->N, &T);
+      CHECK(err);
+    }
+    if (*tweak & 2) {
+      err = mbedtls_mpi_add_int(&S, &key->N, 1);
+      CHECK(err);
+      err = mbedtls_mpi_shift_r(&S, 1);
+      CHECK(err);
+      err = mbedtls_mpi_mul_mpi(&T, &T, &S);
+      CHECK(err);
+      err = mbedtls_mpi_mod_mpi(&T, &T, &key->N);
+      CHECK(err);
+    }
+    if (rw_is_square(&T, &key->P) && rw_is_square(&T, &key->Q)) {
+      break;
+    }
+  }
+  CHECK2(*tweak < 4, -1);
+
+  // S = SQ + Q * ((SP - SQ) / Q mod P)
+  err = rw_sqrt_mod(&SP, &T, &key->P);
+  CHECK(err);
+  err = rw_sqrt_mod(&SQ, &T, &key->Q);
+  CHECK(err);
+  err = mbedtls_mpi_inv_mod(&QINV, &key->Q, &key->P);
+  CHECK(err);
+  err = mbedtls_mpi_sub_mpi(&S, &SP, &SQ);
+  CHECK(err);
+  err = mbedtls_mpi_mul_mpi(&S, &S, &QINV);
+  CHECK(err);
+  err = mbedtls_mpi_mod_mpi(&S, &S, &key->P);
+  CHECK(err);
+  err = mbedtls_mpi_mul_mpi(&S, &S, &key->Q);
+  CHECK(err);
+  err = mbedtls_mpi_add_mpi(&S, &S, &SQ);
+  CHECK(err);
+  // the smaller of S and N - S
+  err = mbedtls_mpi_sub_mpi(&T, &key->N, &S);
+  CHECK(err);
+  if (mbedtls_mpi_cmp_mpi(&T, &S) < 0) {
+    err = mbedtls_mpi_copy(&S, &T);
+    CHECK(err);
+  }
+  err = mbedtls_mpi_write_binary(&S, get_rsa_signature(info), byte_size);
+  CHECK(err);
+
+  err = CKB_SUCCESS;
+exit:
+  mbedtls_mpi_free(&H);
+  mbedtls_mpi_free(&T);
+  mbedtls_mpi_free(&S);
+  mbedtls_mpi_free(&SP);
+  mbedtls_mpi_free(&SQ);
+  mbedtls_mpi_free(&QINV);
+  return err;
+}
+
+// Sign messages until each of the four tweaks was used once.
+int test_validate_signature_rabin_williams(uint8_t key_size_enum,
+                                           uint8_t md_type) {
+  int err = 0;
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  uint32_t key_size = get_key_size(key_size_enum);
+  uint32_t info_len = calculate_rsa_info_length(key_size);
+  uint8_t info_buff[info_len];
+  RsaInfo* info = (RsaInfo*)info_buff;
+  info->algorithm_id = CKB_VERIFY_RABIN_WILLIAMS;
+  info->key_size = key_size_enum;
+  info->padding = CKB_PKCS_15;
+  info->md_type = md_type;
+  uint8_t msg[32] = {1, 2, 3, 4};
+  int tweak = 0;
+  int tweaks_seen = 0;
+  RwKey key;
+  rw_key_init(&key);
+
+  err = gen_rw_key(key_size, &key, info);
+  CHECK(err);
+
+  // each tweak is taken by about a quarter of the messages
+  for (int i = 0; i < 64 && tweaks_seen != 0xF; i++) {
+    msg[0] = (uint8_t)i;
+    err = rw_sign(&key, msg, sizeof(msg), info, &tweak);
+    CHECK(err);
+    tweaks_seen |= 1 << tweak;
+    err = validate_signature(NULL, info_buff, info_len, msg, sizeof(msg), NULL,
+                             NULL);
+    CHECK(err);
+  }
+  CHECK2(tweaks_seen == 0xF, -1);
+
+#ifdef CKB_COVERAGE
+  msg[1] ^= 1;
+  err = validate_signature(NULL, info_buff, info_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_RSA_VERIFY_FAILED, -1);
+  msg[1] ^= 1;
+
+  // N - s, the other root of the same square
+  uint8_t* sig = get_rsa_signature(info);
+  uint8_t saved_sig[4096 / 8];
+  memcpy(saved_sig, sig, key_size / 8);
+  mbedtls_mpi S;
+  mbedtls_mpi_init(&S);
+  err = mbedtls_mpi_read_binary(&S, sig, key_size / 8);
+  err |= mbedtls_mpi_sub_mpi(&S, &key.N, &S);
+  err |= mbedtls_mpi_write_binary(&S, sig, key_size / 8);
+  mbedtls_mpi_free(&S);
+  CHECK(err);
+  err = validate_signature(NULL, info_buff, info_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_RSA_VERIFY_FAILED, -1);
+  memcpy(sig, saved_sig, key_size / 8);
+
+  info->padding = CKB_PKCS_21;
+  err = validate_signature(NULL, info_buff, info_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_INVALID_PADDING, -1);
+  info->padding = CKB_PKCS_15;
+
+  info->E = 3;
+  err = validate_signature(NULL, info_buff, info_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_WRONG_PUBKEY, -1);
+  info->E = 2;
+
+  // N = 7 mod 8
+  info->N[0] ^= 2;
+  err = validate_signature(NULL, info_buff, info_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_WRONG_PUBKEY, -1);
+  info->N[0] ^= 2;
+
+  // E = 2 isn't a valid CKB_VERIFY_RSA key
+  info->algorithm_id = CKB_VERIFY_RSA;
+  err = validate_signature(NULL, info_buff, info_len, msg, sizeof(msg), NULL,
+                           NULL);
+  CHECK2(err == ERROR_WRONG_PUBKEY, -1);
+  info->algorithm_id = CKB_VERIFY_RABIN_WILLIAMS;
+#endif
+
+  err = 0;
+exit:
+  rw_key_free(&key);
+  if (err == 0) {
+    mbedtls_printf(
+        "test_validate_signature_rabin_williams() passed. key size = %d, "
+        "md_type = %d\n",
+        key_size, md_type);
+  } else {
+    mbedtls_printf(
+        "test_validate_signature_rabin_williams() failed. key size = %d, "
+        "md_type = %d\n",
+        key_size, md_type);
+  }
+  return err;
+}
+
+// RsaInfo of the largest key, sizeof(RsaInfo) only fits 1024-bit keys
+#define MAX_RSA_INFO_LENGTH (8 + 4096 / 4)
+
+// Corpus of pre-generated signatures, see corpus_generate. The file is a
+// CorpusHeader followed by `count` records:
+// ---------------------------------------------------
+// |CorpusRecord| signature (sig_len) | msg (msg_len)|
+// ---------------------------------------------------
+// Integers are in little endian, as in RsaInfo.
+#define CORPUS_MAGIC 0x50524f43  // "CORP"
+#define CORPUS_MAX_MSG 2048
+// one line of `-corpus-hex`, i.e. one command line argument in CKB-VM
+#define CORPUS_BATCH_SIZE (32 * 1024)
+
+typedef struct CorpusHeader {
+  uint32_t magic;
+  uint32_t count;
+} CorpusHeader;
+
+typedef struct CorpusRecord {
+  uint32_t sig_len;
+  uint32_t msg_len;
+  // return value of validate_signature
+  int32_t expected;
+} CorpusRecord;
+
+// Records expected to fail hit ASSERT in the library, unless it's disabled.
+bool corpus_is_skipped(const CorpusRecord* rec) {
+#if defined(CKB_COVERAGE) || defined(CKB_RUN_IN_VM)
+  (void)rec;
+  return false;
+#else
+  return rec->expected != 0;
+#endif
+}
+
+// 0 when validate_signature returns the expected result
+int corpus_check(const CorpusRecord* rec, const uint8_t* sig,
+                 const uint8_t* msg) {
+  int ret = validate_signature(NULL, sig, rec->sig_len, msg, rec->msg_len,
+                               NULL, NULL);
+  return ret == rec->expected ? 0 : -1;
+}
+
+#if !defined(CKB_RUN_IN_VM)
+long clock(void);
+
+// Native timing only, it doesn't reflect the cycles in CKB-VM. Part of
+// `-bench`: rows of the public operation alone, by mbedtls, by the Montgomery
+// code and squaring (CKB_VERIFY_RABIN_WILLIAMS), with the columns which don't
+// apply left empty.
+int rsa_public_fast_bench(void) {
+  int err = 0;
+  const int rounds = 100;
+  mbedtls_rsa_context rsa;
+  mbedtls_rsa_init(&rsa, MBEDTLS_RSA_PKCS_V15, 0);
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  uint8_t key_size_set[] = {CKB_KEYSIZE_1024, CKB_KEYSIZE_2048,
+                            CKB_KEYSIZE_4096};
+  for (int i = 0; i < count_of(key_size_set); i++) {
+    uint32_t key_size = get_key_size(key_size_set[i]);
+    uint32_t byte_size = key_size / 8;
+    uint8_t info_buff[calculate_rsa_info_length(key_size)];
+    RsaInfo* info = (RsaInfo*)info_buff;
+    info->algorithm_id = CKB_VERIFY_RSA;
+    info->key_size = key_size_set[i];
+    info->padding = CKB_PKCS_15;
+    info->md_type = CKB_MD_SHA256;
+
+    mbedtls_rsa_free(&rsa);
+    err = gen_rsa_key(key_size, &rsa, info);
+    CHECK(err);
+    export_public_key(&rsa, info);
+
+    uint8_t input[byte_size];
+    uint8_t output[byte_size];
+    memset(input, 0x5A, byte_size);
+
+    long start = clock();
+    for (int j = 0; j < rounds; j++) {
+      err = mbedtls_rsa_public(&rsa, input, output);
+      CHECK(err);
+    }
+    long mbedtls_time = clock() - start;
+
+    start = clock();
+    for (int j = 0; j < rounds; j++) {
+      RsaMontContext mont;
+      err = rsa_mont_init(&mont, info->N, byte_size);
+      CHECK(err);
+      err = rsa_mont_exp_public(&mont, input, EXPONENT, output);
+      CHECK(err);
+    }
+    long fast_time = clock() - start;
+
+    // the public operation of CKB_VERIFY_RABIN_WILLIAMS
+    start = clock();
+    for (int j = 0; j < rounds; j++) {
+      RsaMontContext mont;
+      rsa_limb_t x[RSA_MAX_LIMBS];
+      err = rsa_mont_init(&mont, info->N, byte_size);
+      CHECK(err);
+      rsa_limbs_read_be(x, mont.limbs, input);
+      rsa_mont_square(&mont, x);
+      rsa_limbs_write_be(x, mont.limbs, output);
+    }
+    long square_time = clock() - start;
+
+    mbedtls_printf("public_mbedtls_us,%d,%d,,,,%ld\n", CKB_VERIFY_RSA,
+                   (int)key_size, mbedtls_time / rounds);
+    mbedtls_printf("public_mont_us,%d,%d,,,,%ld\n", CKB_VERIFY_RSA,
+                   (int)key_size, fast_time / rounds);
+    mbedtls_printf("public_square_us,%d,%d,,,,%ld\n",
+                   CKB_VERIFY_RABIN_WILLIAMS, (int)key_size,
+                   square_time / rounds);
+  }
+
   err = 0;
 exit:
-  if (err == 0) {
-    mbedtls_printf(
-        "test_validate_signature() passed: key size = %d, md_type = %d, "
-        "padding = "
-        "%d\n",
-        key_size, md_type, padding);
-  } else {
-    mbedtls_printf(
-        "test_validate_signature() failed: key size = %d, md_type = %d, "
-        "padding = "
-        "%d\n",
-        key_size, md_type, padding);
-  }
+  mbedtls_rsa_free(&rsa);
   return err;
 }
 
-void reset_rsa_info(RsaInfo* info) {
-  info->algorithm_id = CKB_VERIFY_RSA;
-  info->key_size = CKB_KEYSIZE_1024;
-  info->padding = CKB_PKCS_15;
-  info->md_type = CKB_MD_SHA256;
+// The sweep of the benchmarks: every key size, padding and digest, with
+// messages of these lengths.
+static const uint8_t BENCH_KEY_SIZES[] = {CKB_KEYSIZE_1024, CKB_KEYSIZE_2048,
+                                          CKB_KEYSIZE_4096};
+static const uint8_t BENCH_PADDINGS[] = {CKB_PKCS_15, CKB_PKCS_21};
+static const uint8_t BENCH_MD_TYPES[] = {CKB_MD_SHA224, CKB_MD_SHA256,
+                                         CKB_MD_SHA384, CKB_MD_SHA512};
+// the longest one must fit in ckbvm_main's msg_buf
+static const uint32_t BENCH_MSG_LENS[] = {32, 256, 2048};
+
+static void print_hex(const uint8_t* buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    mbedtls_printf("%02X", buf[i]);
+  }
 }
 
-int validate_signature_error_cases_test(void) {
+// One row of rsa_bench for the signature in info_buff, or its vector.
+static int bench_signature(const uint8_t* info_buff, uint32_t info_len,
+                           const uint8_t* msg, uint32_t msg_len,
+                           bool vectors_only) {
   int err = 0;
+  const int rounds = 20;
+  const RsaInfo* info = (const RsaInfo*)info_buff;
+
+  if (vectors_only) {
+    print_hex(info_buff, info_len);
+    mbedtls_printf(" ");
+    print_hex(msg, msg_len);
+    mbedtls_printf("\n");
+    return 0;
+  }
+  long start = clock();
+  for (int r = 0; r < rounds; r++) {
+    err = validate_signature(NULL, info_buff, info_len, msg, msg_len, NULL,
+                             NULL);
+    CHECK(err);
+  }
+  // CLOCKS_PER_SEC is 1000000 on POSIX systems
+  long elapsed = (clock() - start) / rounds;
+  mbedtls_printf("native_us,%d,%d,%d,%d,%d,%ld\n", info->algorithm_id,
+                 (int)get_key_size(info->key_size), info->padding,
+                 info->md_type, (int)msg_len, elapsed);
 
-  uint8_t padding = CKB_PKCS_15;
-  uint8_t key_size_enum = CKB_KEYSIZE_1024;
-  uint8_t md_type = CKB_MD_SHA256;
-  uint32_t key_size = get_key_size(key_size_enum);
-  uint8_t msg[32] = {1, 2, 3, 4};
-  uint32_t sig_buff_size = calculate_rsa_info_length(key_size);
-  uint8_t sig_buff[sig_buff_size];
-  RsaInfo* info = (RsaInfo*)sig_buff;
-  info->algorithm_id = CKB_VERIFY_RSA;
-  info->key_size = key_size_enum;
-  info->padding = padding;
-  info->md_type = md_type;
+exit:
+  return err;
+}
 
-  size_t len = 0;
-  load_prefilled_data(NULL, &len);
-  mbedtls_hardware_poll(0, 0, 0, 0);
+// validate_signature_rsa -bench
+//   native time of validate_signature over the sweep, then of the public
+//   operation alone (rsa_public_fast_bench), as CSV
+// validate_signature_rsa -bench-vectors
+//   the signatures and messages of the sweep, one "sig_hex msg_hex" per
+//   line, used by `run-in-vm.sh bench` to count cycles in CKB-VM
+// CKB_VERIFY_RABIN_WILLIAMS rows follow the CKB_VERIFY_RSA ones of the same
+// key size, with PKCS#1 v1.5 only.
+int rsa_bench(bool vectors_only) {
+  int err = 0;
+  static uint8_t msg[2048];
+  uint8_t info_buff[MAX_RSA_INFO_LENGTH];
+  RsaInfo* info = (RsaInfo*)info_buff;
+  int tweak = 0;
+  mbedtls_rsa_context rsa;
+  mbedtls_rsa_init(&rsa, MBEDTLS_RSA_PKCS_V15, 0);
+  RwKey rw;
+  rw_key_init(&rw);
 
-  reset_rsa_info(info);
-  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
-                           NULL, NULL);
-  CHECK2(err == ERROR_RSA_VERIFY_FAILED, -1);
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
 
-  reset_rsa_info(info);
-  info->algorithm_id = 100;
-  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
-                           NULL, NULL);
-  CHECK2(err == ERROR_RSA_INVALID_ID, -1);
+  for (int i = 0; i < sizeof(msg); i++) {
+    msg[i] = (uint8_t)rand();
+  }
+  if (!vectors_only) {
+    mbedtls_printf(
+        "mode,algorithm_id,key_size,padding,md_type,msg_len,value\n");
+  }
 
-  reset_rsa_info(info);
-  err = validate_signature(NULL, NULL, sig_buff_size, msg, sizeof(msg), NULL,
-                           NULL);
-  CHECK2(err == ERROR_RSA_INVALID_PARAM1, -1);
+  for (int i = 0; i < count_of(BENCH_KEY_SIZES); i++) {
+    uint32_t key_size = get_key_size(BENCH_KEY_SIZES[i]);
+    uint32_t info_len = calculate_rsa_info_length(key_size);
+    info->algorithm_id = CKB_VERIFY_RSA;
+    info->key_size = BENCH_KEY_SIZES[i];
+    info->padding = CKB_PKCS_15;
+    info->md_type = CKB_MD_SHA256;
+    mbedtls_rsa_free(&rsa);
+    err = gen_rsa_key(key_size, &rsa, info);
+    CHECK(err);
+    export_public_key(&rsa, info);
+
+    for (int j = 0; j < count_of(BENCH_PADDINGS); j++) {
+      for (int k = 0; k < count_of(BENCH_MD_TYPES); k++) {
+        info->padding = BENCH_PADDINGS[j];
+        info->md_type = BENCH_MD_TYPES[k];
+        // one key for both paddings
+        mbedtls_rsa_set_padding(&rsa, convert_padding(info->padding),
+                                convert_md_type(info->md_type));
+        for (int l = 0; l < count_of(BENCH_MSG_LENS); l++) {
+          uint32_t msg_len = BENCH_MSG_LENS[l];
+          err = rsa_sign(&rsa, msg, msg_len, get_rsa_signature(info), info);
+          CHECK(err);
+          err = bench_signature(info_buff, info_len, msg, msg_len,
+                                vectors_only);
+          CHECK(err);
+        }
+      }
+    }
 
-  reset_rsa_info(info);
-  info->md_type = 100;
-  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
-                           NULL, NULL);
-  CHECK2(err == ERROR_INVALID_MD_TYPE, -1);
+    info->algorithm_id = CKB_VERIFY_RABIN_WILLIAMS;
+    info->padding = CKB_PKCS_15;
+    rw_key_free(&rw);
+    rw_key_init(&rw);
+    err = gen_rw_key(key_size, &rw, info);
+    CHECK(err);
+    for (int k = 0; k < count_of(BENCH_MD_TYPES); k++) {
+      info->md_type = BENCH_MD_TYPES[k];
+      for (int l = 0; l < count_of(BENCH_MSG_LENS); l++) {
+        uint32_t msg_len = BENCH_MSG_LENS[l];
+        err = rw_sign(&rw, msg, msg_len, info, &tweak);
+        CHECK(err);
+        err = bench_signature(info_buff, info_len, msg, msg_len, vectors_only);
+        CHECK(err);
+      }
+    }
+  }
 
-  reset_rsa_info(info);
-  info->padding = 100;
-  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
-                           NULL, NULL);
-  CHECK2(err == ERROR_INVALID_PADDING, -1);
+  err = 0;
+exit:
+  mbedtls_rsa_free(&rsa);
+  rw_key_free(&rw);
+  return err;
+}
 
-  reset_rsa_info(info);
-  info->key_size = 100;
-  err = validate_signature(NULL, sig_buff, sig_buff_size, msg, sizeof(msg),
-                           NULL, NULL);
-  CHECK2(err == ERROR_RSA_INVALID_KEY_SIZE, -1);
+// The corpus goes through stdin and stdout. getchar and putchar are declared
+// the same way by the host libc and ckb-c-stdlib.
+int getchar(void);
+int putchar(int c);
 
-  reset_rsa_info(info);
-  err = validate_signature(NULL, NULL, sig_buff_size, msg, sizeof(msg), NULL,
-                           NULL);
-  CHECK2(err == ERROR_RSA_INVALID_PARAM1, -1);
+void corpus_write(const void* buf, size_t len) {
+  const uint8_t* p = (const uint8_t*)buf;
+  for (size_t i = 0; i < len; i++) {
+    putchar(p[i]);
+  }
+}
 
-  reset_rsa_info(info);
-  err = validate_signature(NULL, sig_buff, sig_buff_size, NULL, sizeof(msg),
-                           NULL, NULL);
-  CHECK2(err == ERROR_RSA_INVALID_PARAM1, -1);
+int corpus_read(void* buf, size_t len) {
+  uint8_t* p = (uint8_t*)buf;
+  for (size_t i = 0; i < len; i++) {
+    int c = getchar();
+    if (c < 0) return -1;
+    p[i] = (uint8_t)c;
+  }
+  return 0;
+}
 
-  reset_rsa_info(info);
-  err = validate_signature(NULL, sig_buff, 0, msg, sizeof(msg), NULL, NULL);
-  CHECK2(err == ERROR_RSA_INVALID_PARAM2, -1);
+void corpus_write_record(const CorpusRecord* rec, const uint8_t* sig,
+                         const uint8_t* msg) {
+  corpus_write(rec, sizeof(*rec));
+  corpus_write(sig, rec->sig_len);
+  corpus_write(msg, rec->msg_len);
+}
+
+// Read the next record, sig and msg must hold MAX_RSA_INFO_LENGTH and
+// CORPUS_MAX_MSG bytes.
+int corpus_read_record(CorpusRecord* rec, uint8_t* sig, uint8_t* msg) {
+  if (corpus_read(rec, sizeof(*rec)) != 0) return -1;
+  if (rec->sig_len > MAX_RSA_INFO_LENGTH || rec->msg_len > CORPUS_MAX_MSG) {
+    return -1;
+  }
+  if (corpus_read(sig, rec->sig_len) != 0) return -1;
+  return corpus_read(msg, rec->msg_len);
+}
+
+// validate_signature_rsa -gen-corpus > corpus.bin
+//   Signs the sweep of rsa_bench once and writes it to stdout: for every
+//   signature, a valid record and one with a modified message, expected to
+//   fail with ERROR_RSA_VERIFY_FAILED. Key generation is the slow part, it's
+//   done once per key size.
+int corpus_generate(void) {
+  int err = 0;
+  static uint8_t msg[CORPUS_MAX_MSG];
+  uint8_t info_buff[MAX_RSA_INFO_LENGTH];
+  RsaInfo* info = (RsaInfo*)info_buff;
+  CorpusHeader header = {CORPUS_MAGIC, 0};
+  CorpusRecord rec;
+  mbedtls_rsa_context rsa;
+  mbedtls_rsa_init(&rsa, MBEDTLS_RSA_PKCS_V15, 0);
+
+  int alloc_buff_size = 1024 * 1024;
+  unsigned char alloc_buff[alloc_buff_size];
+  mbedtls_memory_buffer_alloc_init(alloc_buff, alloc_buff_size);
+
+  header.count = count_of(BENCH_KEY_SIZES) * count_of(BENCH_PADDINGS) *
+                 count_of(BENCH_MD_TYPES) * count_of(BENCH_MSG_LENS) * 2;
+  corpus_write(&header, sizeof(header));
+
+  for (int i = 0; i < sizeof(msg); i++) {
+    msg[i] = (uint8_t)rand();
+  }
+  for (int i = 0; i < count_of(BENCH_KEY_SIZES); i++) {
+    uint32_t key_size = get_key_size(BENCH_KEY_SIZES[i]);
+    info->algorithm_id = CKB_VERIFY_RSA;
+    info->key_size = BENCH_KEY_SIZES[i];
+    info->padding = CKB_PKCS_15;
+    info->md_type = CKB_MD_SHA256;
+    mbedtls_rsa_free(&rsa);
+    err = gen_rsa_key(key_size, &rsa, info);
+    CHECK(err);
+    export_public_key(&rsa, info);
+    rec.sig_len = calculate_rsa_info_length(key_size);
+
+    for (int j = 0; j < count_of(BENCH_PADDINGS); j++) {
+      for (int k = 0; k < count_of(BENCH_MD_TYPES); k++) {
+        info->padding = BENCH_PADDINGS[j];
+        info->md_type = BENCH_MD_TYPES[k];
+        mbedtls_rsa_set_padding(&rsa, convert_padding(info->padding),
+                                convert_md_type(info->md_type));
+        for (int l = 0; l < count_of(BENCH_MSG_LENS); l++) {
+          rec.msg_len = BENCH_MSG_LENS[l];
+          // a different message for every signature
+          msg[0]++;
+          err = rsa_sign(&rsa, msg, rec.msg_len, get_rsa_signature(info),
+                         info);
+          CHECK(err);
+          rec.expected = CKB_SUCCESS;
+          corpus_write_record(&rec, info_buff, msg);
+          msg[1] ^= 1;
+          rec.expected = ERROR_RSA_VERIFY_FAILED;
+          corpus_write_record(&rec, info_buff, msg);
+          msg[1] ^= 1;
+        }
+      }
+    }
+  }
 
   err = 0;
 exit:
-  if (err == 0) {
-    mbedtls_printf("validate_signature_error_cases_test() passed.\n");
-  } else {
-    mbedtls_printf("validate_signature_error_cases_test() failed.\n");
-  }
+  // nothing else on stdout
+  mbedtls_rsa_free(&rsa);
   return err;
 }
 
-// cover all test cases
-int validate_signature_all_test(void) {
+// validate_signature_rsa -run-corpus [rounds] < corpus.bin
+//   Streams the records from stdin into validate_signature, each one `rounds`
+//   times, and prints the throughput as CSV. Fails on any unexpected result.
+int corpus_run(int rounds) {
   int err = 0;
-  uint8_t md_type_set[] = {CKB_MD_SHA224, CKB_MD_SHA256, CKB_MD_SHA384,
-                           CKB_MD_SHA512};
-  uint8_t key_size_set[] = {CKB_KEYSIZE_1024, CKB_KEYSIZE_2048,
-                            CKB_KEYSIZE_4096};
-  //  uint8_t key_size_set[] = {CKB_KEYSIZE_1024};
-  uint8_t padding_set[] = {CKB_PKCS_15, CKB_PKCS_21};
-  for (int i = 0; i < count_of(key_size_set); i++) {
-    for (int j = 0; j < count_of(md_type_set); j++) {
-      for (int k = 0; k < count_of(padding_set); k++) {
-        err = test_validate_signature(key_size_set[i], md_type_set[j],
-                                      padding_set[k]);
-        CHECK(err);
+  static uint8_t sig[MAX_RSA_INFO_LENGTH];
+  static uint8_t msg[CORPUS_MAX_MSG];
+  CorpusHeader header;
+  CorpusRecord rec;
+  uint32_t skipped = 0;
+  uint32_t mismatches = 0;
+  uint64_t verifications = 0;
+  long elapsed = 0;
+
+  CHECK2(rounds > 0, -1);
+  CHECK2(corpus_read(&header, sizeof(header)) == 0, -1);
+  CHECK2(header.magic == CORPUS_MAGIC, -1);
+
+  for (uint32_t i = 0; i < header.count; i++) {
+    err = corpus_read_record(&rec, sig, msg);
+    CHECK(err);
+    if (corpus_is_skipped(&rec)) {
+      skipped++;
+      continue;
+    }
+    long start = clock();
+    for (int r = 0; r < rounds; r++) {
+      if (corpus_check(&rec, sig, msg) != 0) {
+        mbedtls_printf("record %d: unexpected result\n", (int)i);
+        mismatches++;
+        break;
       }
     }
+    elapsed += clock() - start;
+    verifications += rounds;
   }
+  mbedtls_printf("mode,records,skipped,mismatches,verifications,total_us\n");
+  mbedtls_printf("native_corpus,%d,%d,%d,%d,%ld\n", (int)header.count,
+                 (int)skipped, (int)mismatches, (int)verifications, elapsed);
+  CHECK2(mismatches == 0, -1);
+
   err = 0;
 exit:
-  if (err == 0) {
-    mbedtls_printf("validate_signature_all_test() passed.\n");
-  } else {
-    mbedtls_printf("validate_signature_all_test() failed.\n");
+  return err;
+}
+
+// validate_signature_rsa -corpus-hex < corpus.bin
+//   Prints the records from stdin in hex, as many as fit in CORPUS_BATCH_SIZE
+//   bytes per line, for `ckbvm -corpus`.
+int corpus_print_hex(void) {
+  int err = 0;
+  static uint8_t batch[CORPUS_BATCH_SIZE];
+  static uint8_t sig[MAX_RSA_INFO_LENGTH];
+  static uint8_t msg[CORPUS_MAX_MSG];
+  size_t used = 0;
+  CorpusHeader header;
+  CorpusRecord rec;
+
+  CHECK2(corpus_read(&header, sizeof(header)) == 0, -1);
+  CHECK2(header.magic == CORPUS_MAGIC, -1);
+
+  for (uint32_t i = 0; i < header.count; i++) {
+    err = corpus_read_record(&rec, sig, msg);
+    CHECK(err);
+    size_t size = sizeof(rec) + rec.sig_len + rec.msg_len;
+    if (used + size > sizeof(batch)) {
+      print_hex(batch, used);
+      mbedtls_printf("\n");
+      used = 0;
+    }
+    memcpy(batch + used, &rec, sizeof(rec));
+    memcpy(batch + used + sizeof(rec), sig, rec.sig_len);
+    memcpy(batch + used + sizeof(rec) + rec.sig_len, msg, rec.msg_len);
+    used += size;
   }
+  if (used > 0) {
+    print_hex(batch, used);
+    mbedtls_printf("\n");
+  }
+
+  err = 0;
+exit:
   return err;
 }
+#endif
 
 int iso97962_test2(void) {
   int err = 0;
@@ -512,10 +2180,9 @@ int iso97962_test2(void) {
   uint32_t sig_len = 0;
   uint32_t msg_len = 0;
   uint8_t m1[128];
-  uint32_t m1_len = 128;
+  size_t m1_len = sizeof(m1);
   uint8_t full_msg[1024];
-  uint8_t new_msg[1024];
-  uint32_t new_msg_len = 1024;
+  uint8_t hash[MBEDTLS_MD_MAX_SIZE];
 
   int alloc_buff_size = 1024 * 1024;
   unsigned char alloc_buff[alloc_buff_size];
@@ -539,16 +2206,39 @@ int iso97962_test2(void) {
 
   ISO97962Encoding enc = {0};
   iso97962_init(&enc, 128, MBEDTLS_MD_SHA1, false);
-  err = iso97962_verify(&enc, block, sizeof(block), msg, msg_len, m1, &m1_len);
-  CHECK2(err == 0 || err == ERROR_ISO97962_MISMATCH_HASH,
-         ERROR_ISO97962_INVALID_ARG9);
+  err = iso97962_verify_recoverable(&enc, block, sizeof(block), msg, msg_len,
+                                    m1, &m1_len);
+  CHECK(err);
 
+  // the hash in the block is the one of m1 || m2, computed in two passes
+  int msg_start = 0;
+  int hash_off = 0;
+  err = iso97962_parse(&enc, block, sizeof(block), 20, &msg_start, &hash_off);
+  CHECK(err);
+  CHECK2(m1_len == (size_t)(hash_off - msg_start), -1);
+  CHECK2(memcmp(m1, block + msg_start, m1_len) == 0, -1);
   memcpy(full_msg, m1, m1_len);
   memcpy(full_msg + m1_len, msg, sizeof(msg));
+  err = mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA1), full_msg,
+                   m1_len + sizeof(msg), hash);
+  CHECK(err);
+  CHECK2(memcmp(block + hash_off, hash, 20) == 0, -1);
 
-  err = iso97962_verify(&enc, block, sizeof(block), full_msg,
-                        m1_len + sizeof(msg), new_msg, &new_msg_len);
+  // m1 is truncated to the output buffer
+  uint8_t recovered[16];
+  size_t recovered_len = sizeof(recovered);
+  err = iso97962_verify_recoverable(&enc, block, sizeof(block), msg, msg_len,
+                                    recovered, &recovered_len);
   CHECK(err);
+  CHECK2(recovered_len == sizeof(recovered), -1);
+  CHECK2(memcmp(recovered, m1, sizeof(recovered)) == 0, -1);
+
+  msg[0] ^= 1;
+  recovered_len = sizeof(recovered);
+  err = iso97962_verify_recoverable(&enc, block, sizeof(block), msg, msg_len,
+                                    recovered, &recovered_len);
+  CHECK2(err == ERROR_ISO97962_MISMATCH_HASH, -1);
+  msg[0] ^= 1;
 
   err = 0;
 exit:
@@ -571,9 +2261,9 @@ int iso97962_test(void) {
   err = iso97962_sign(&enc, msg, sizeof(msg), block, sizeof(block));
   CHECK(err);
   uint8_t new_msg[128];
-  uint32_t new_msg_len = 128;
-  err = iso97962_verify(&enc, block, sizeof(block), NULL, 0, new_msg,
-                        &new_msg_len);
+  size_t new_msg_len = sizeof(new_msg);
+  err = iso97962_verify_recoverable(&enc, block, sizeof(block), NULL, 0,
+                                    new_msg, &new_msg_len);
   CHECK(err);
   ASSERT(new_msg_len == msg_len);
   ASSERT(memcmp(msg, new_msg, msg_len) == 0);
@@ -602,47 +2292,47 @@ int iso97962_error_cases_test() {
   err = iso97962_sign(&enc, msg, sizeof(msg), block, sizeof(block));
   CHECK(err);
   uint8_t new_msg[128];
-  uint32_t new_msg_len = 128;
+  size_t new_msg_len = sizeof(new_msg);
 
   memcpy(wrong_block, block, sizeof(block));
   wrong_block[107] -= 1;
-  err = iso97962_verify(&enc, wrong_block, sizeof(wrong_block), NULL, 0,
-                        new_msg, &new_msg_len);
+  err = iso97962_verify_recoverable(&enc, wrong_block, sizeof(wrong_block),
+                                    NULL, 0, new_msg, &new_msg_len);
   CHECK2(err == ERROR_ISO97962_MISMATCH_HASH, -1);
 
   memcpy(wrong_block, block, sizeof(block));
-  new_msg_len = 128;
+  new_msg_len = sizeof(new_msg);
   wrong_block[sizeof(wrong_block) - 2] -= 1;
-  err = iso97962_verify(&enc, wrong_block, sizeof(wrong_block), NULL, 0,
-                        new_msg, &new_msg_len);
+  err = iso97962_verify_recoverable(&enc, wrong_block, sizeof(wrong_block),
+                                    NULL, 0, new_msg, &new_msg_len);
   CHECK2(err == ERROR_ISO97962_INVALID_ARG4, -1);
 
   memcpy(wrong_block, block, sizeof(block));
-  new_msg_len = 128;
+  new_msg_len = sizeof(new_msg);
   for (int i = 97; i < 108; i++) {
     wrong_block[i] = (wrong_block[i] & 0xF0) | 0x0B;
   }
-  err = iso97962_verify(&enc, wrong_block, sizeof(wrong_block), NULL, 0,
-                        new_msg, &new_msg_len);
+  err = iso97962_verify_recoverable(&enc, wrong_block, sizeof(wrong_block),
+                                    NULL, 0, new_msg, &new_msg_len);
   CHECK2(err == ERROR_ISO97962_INVALID_ARG5, -1);
 
   memcpy(wrong_block, block, sizeof(block));
-  new_msg_len = 128;
+  new_msg_len = sizeof(new_msg);
   wrong_block[0] = 0xC0;
-  err = iso97962_verify(&enc, wrong_block, sizeof(wrong_block), NULL, 0,
-                        new_msg, &new_msg_len);
+  err = iso97962_verify_recoverable(&enc, wrong_block, sizeof(wrong_block),
+                                    NULL, 0, new_msg, &new_msg_len);
   CHECK2(err == ERROR_ISO97962_INVALID_ARG2, -1);
 
   memcpy(wrong_block, block, sizeof(block));
   wrong_block[sizeof(wrong_block) - 1] = 0xFF;
-  err = iso97962_verify(&enc, wrong_block, sizeof(wrong_block), NULL, 0,
-                        new_msg, &new_msg_len);
+  err = iso97962_verify_recoverable(&enc, wrong_block, sizeof(wrong_block),
+                                    NULL, 0, new_msg, &new_msg_len);
   CHECK2(err == ERROR_ISO97962_INVALID_ARG3, -1);
 
   memcpy(&wrong_enc, &enc, sizeof(enc));
   wrong_enc.md = 100;
-  err = iso97962_verify(&wrong_enc, block, sizeof(block), NULL, 0, new_msg,
-                        &new_msg_len);
+  err = iso97962_verify_recoverable(&wrong_enc, block, sizeof(block), NULL, 0,
+                                    new_msg, &new_msg_len);
 
   CHECK2(err == ERROR_ISO97962_INVALID_ARG6, -1);
 
@@ -703,6 +2393,8 @@ int iso97962_sample_test(uint8_t key_size_enum, const char* N_str,
   err = validate_signature(NULL, (uint8_t*)&info, sizeof(info), msg, msg_len,
                            new_msg, &new_msg_len);
   CHECK(err);
+  // the recoverable part is returned
+  ASSERT(new_msg_len > 0 && new_msg_len < key_size_byte);
 
   err = 0;
 exit:
@@ -735,11 +2427,119 @@ exit:
   return err;
 }
 
+#if defined(CKB_RUN_IN_VM)
+#define SYS_BENCH_CURRENT_CYCLES 2042
+#define SYS_BENCH_DEBUG 2177
+
+// ckb_syscalls.h in this folder is a mock, issue the syscalls directly
+static long bench_syscall(long n, long arg) {
+  register long a0 asm("a0") = arg;
+  register long a7 asm("a7") = n;
+  asm volatile("scall" : "+r"(a0) : "r"(a7) : "memory");
+  return a0;
+}
+
+static char* bench_append_u64(char* p, uint64_t v) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  while (n > 0) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+// Cycles spent in validate_signature, printed through the debug syscall as
+// a CSV row, same columns as rsa_bench. The runner must implement the
+// current cycles syscall (2042), e.g. ckb-debugger.
+int rsa_bench_in_vm(const uint8_t* sig_buf, uint32_t sig_len,
+                    const uint8_t* msg_buf, uint32_t msg_len) {
+  int err = 0;
+  const RsaInfo* info = (const RsaInfo*)sig_buf;
+  char row[128];
+  char* p = row;
+
+  uint64_t start = (uint64_t)bench_syscall(SYS_BENCH_CURRENT_CYCLES, 0);
+  err = validate_signature(NULL, sig_buf, sig_len, msg_buf, msg_len, NULL,
+                           NULL);
+  uint64_t cycles =
+      (uint64_t)bench_syscall(SYS_BENCH_CURRENT_CYCLES, 0) - start;
+  CHECK(err);
+
+  const char* mode = "cycles,";
+  while (*mode) *p++ = *mode++;
+  p = bench_append_u64(p, info->algorithm_id);
+  *p++ = ',';
+  p = bench_append_u64(p, get_key_size(info->key_size));
+  *p++ = ',';
+  p = bench_append_u64(p, info->padding);
+  *p++ = ',';
+  p = bench_append_u64(p, info->md_type);
+  *p++ = ',';
+  p = bench_append_u64(p, msg_len);
+  *p++ = ',';
+  p = bench_append_u64(p, cycles);
+  *p = 0;
+  bench_syscall(SYS_BENCH_DEBUG, (long)row);
+
+exit:
+  return err;
+}
+
+// Run a batch of corpus records, one line of `-corpus-hex`, and print
+// "corpus_cycles,<records>,<mismatches>,<cycles>" through the debug syscall.
+int corpus_run_in_vm(const uint8_t* batch, size_t len) {
+  int err = 0;
+  CorpusRecord rec;
+  uint32_t records = 0;
+  uint32_t mismatches = 0;
+  uint64_t cycles = 0;
+  char row[96];
+  char* p = row;
+
+  size_t off = 0;
+  while (off < len) {
+    CHECK2(len - off >= sizeof(rec), -1);
+    memcpy(&rec, batch + off, sizeof(rec));
+    off += sizeof(rec);
+    CHECK2(len - off >= (size_t)rec.sig_len + rec.msg_len, -1);
+    const uint8_t* sig = batch + off;
+    const uint8_t* msg = sig + rec.sig_len;
+    off += rec.sig_len + rec.msg_len;
+
+    uint64_t start = (uint64_t)bench_syscall(SYS_BENCH_CURRENT_CYCLES, 0);
+    if (corpus_check(&rec, sig, msg) != 0) mismatches++;
+    cycles += (uint64_t)bench_syscall(SYS_BENCH_CURRENT_CYCLES, 0) - start;
+    records++;
+  }
+
+  const char* mode = "corpus_cycles,";
+  while (*mode) *p++ = *mode++;
+  p = bench_append_u64(p, records);
+  *p++ = ',';
+  p = bench_append_u64(p, mismatches);
+  *p++ = ',';
+  p = bench_append_u64(p, cycles);
+  *p = 0;
+  bench_syscall(SYS_BENCH_DEBUG, (long)row);
+  CHECK2(mismatches == 0, -1);
+
+  err = 0;
+exit:
+  return err;
+}
+#endif
+
 // validate_signature_rsa ckbvm <command> <arg1> <arg2> <arg3>
 // validate_signature_rsa ckbvm -iso97962_test2
 // validate_signature_rsa ckbvm -iso97962_test3
 // validate_signature_rsa ckbvm -rsa sig_buf_in_hex msg_buf_in_hex
 // validate_signature_rsa ckbvm -rsa sig_buf_in_hex msg_buf_in_hex
+// validate_signature_rsa ckbvm -bench_rsa sig_buf_in_hex msg_buf_in_hex
+// validate_signature_rsa ckbvm -corpus records_in_hex
 // ...
 int ckbvm_main(int argc, const char* argv[]) {
   int err = 0;
@@ -767,6 +2567,26 @@ int ckbvm_main(int argc, const char* argv[]) {
                              NULL);
     CHECK(err);
   }
+#if defined(CKB_RUN_IN_VM)
+  if (strcmp(argv[2], "-bench_rsa") == 0) {
+    if (argc != 5) return -1;
+    uint32_t sig_len = 0;
+    uint8_t sig_buf[1024 * 2];
+    uint32_t msg_len = 0;
+    uint8_t msg_buf[1024 * 2];
+    sig_len = read_string(argv[3], sig_buf, sizeof(sig_buf));
+    msg_len = read_string(argv[4], msg_buf, sizeof(msg_buf));
+    err = rsa_bench_in_vm(sig_buf, sig_len, msg_buf, msg_len);
+    CHECK(err);
+  }
+  if (strcmp(argv[2], "-corpus") == 0) {
+    if (argc != 4) return -1;
+    static uint8_t batch[CORPUS_BATCH_SIZE];
+    uint32_t len = read_string(argv[3], batch, sizeof(batch));
+    err = corpus_run_in_vm(batch, len);
+    CHECK(err);
+  }
+#endif
 
   err = 0;
 exit:
@@ -778,6 +2598,24 @@ int main(int argc, const char* argv[]) {
     if (strcmp(argv[1], "ckbvm") == 0) {
       return ckbvm_main(argc, argv);
     }
+#if !defined(CKB_RUN_IN_VM)
+    if (strcmp(argv[1], "-bench") == 0) {
+      int err = rsa_bench(false);
+      return err != 0 ? err : rsa_public_fast_bench();
+    }
+    if (strcmp(argv[1], "-bench-vectors") == 0) {
+      return rsa_bench(true);
+    }
+    if (strcmp(argv[1], "-gen-corpus") == 0) {
+      return corpus_generate();
+    }
+    if (strcmp(argv[1], "-run-corpus") == 0) {
+      return corpus_run(argc >= 3 ? atoi(argv[2]) : 1);
+    }
+    if (strcmp(argv[1], "-corpus-hex") == 0) {
+      return corpus_print_hex();
+    }
+#endif
   }
 
   int err = 0;
@@ -788,6 +2626,49 @@ int main(int argc, const char* argv[]) {
   err = validate_signature_all_test();
   CHECK(err);
 
+  err = test_validate_signature_batch(CKB_KEYSIZE_1024, CKB_MD_SHA256,
+                                      CKB_PKCS_15);
+  CHECK(err);
+
+  err = test_validate_signature_batch(CKB_KEYSIZE_2048, CKB_MD_SHA512,
+                                      CKB_PKCS_21);
+  CHECK(err);
+
+  err = md_context_test();
+  CHECK(err);
+
+  err = sha2_kernel_test();
+  CHECK(err);
+
+  err = rsa_public_fast_test();
+  CHECK(err);
+
+  err = rsa_mul_kernel_test();
+  CHECK(err);
+
+  err = rsa_pss_verify_test();
+  CHECK(err);
+
+  err = test_validate_signature_secp256r1();
+  CHECK(err);
+
+  err = test_validate_signature_precomputed(CKB_KEYSIZE_1024, CKB_MD_SHA256,
+                                            CKB_PKCS_15);
+  CHECK(err);
+
+  err = test_validate_signature_prefilled();
+  CHECK(err);
+
+  err = test_validate_signature_precomputed(CKB_KEYSIZE_2048, CKB_MD_SHA256,
+                                            CKB_PKCS_21);
+  CHECK(err);
+
+  err = test_validate_signature_rabin_williams(CKB_KEYSIZE_1024, CKB_MD_SHA256);
+  CHECK(err);
+
+  err = test_validate_signature_rabin_williams(CKB_KEYSIZE_2048, CKB_MD_SHA512);
+  CHECK(err);
+
 #ifdef CKB_COVERAGE
   err = validate_signature_error_cases_test();
   CHECK(err);